@@ -4,17 +4,32 @@ Based on example: https://www.linuxhowtos.org/C_C++/socket.htm
 
 Modified: Michael Alrøe
 Extended to support file client!
+-c continues a download that stopped, -n N splits the file over N parallel connections,
+each writing its own part of the file (needs a server that understands byte ranges).
+Several files are requested back to back over one persistent connection.
+-z offers the server deflate; it compresses the files that shrink, and they are inflated on arrival.
+
+Build: g++ -O2 -pthread -o file_client file_client.cpp iknlib.c payload.c -lz
+Usage: file_client [-c] [-n streams] [-s] [-z] hostname file...
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 #include <netdb.h> 
 #include "iknlib.h"
+#include "payload.h"
 
 #define STRBUFSIZE 256 //Buffer size for sending commands
+#define SAVEINTERVAL (8L << 20) //Bytes a segment receives between saves of the download state
+#define PIPELINEWINDOW 64 //Requests in flight on a persistent connection
 
 void error(const char *msg)
 {
@@ -22,33 +37,90 @@ void error(const char *msg)
 	exit(1);
 }
 
-void receiveFile(int serverSocket, const char* fileName, long fileSize)
+//Connects to the file server, returns the socket or -1
+int connectToServer(const char* host)
 {
-	printf("Receiving: '%s', size: %li\n", fileName, fileSize);
+	//Creates a TCP socket:
+	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sockfd < 0)
+	{
+		perror("ERROR opening socket");
+		return -1;
+	}
+
+	// Resolves server hostname to IP address:
+	struct hostent *server = gethostbyname(host);
+	if (server == NULL)
+	{
+		fprintf(stderr, "ERROR no such host\n");
+		close(sockfd);
+		return -1;
+	}
+
+	//Sets up server address struct:
+	struct sockaddr_in serv_addr;
+	bzero((char *) &serv_addr, sizeof(serv_addr));
+	serv_addr.sin_family = AF_INET;
+	bcopy((char *)server->h_addr_list[0], (char *)&serv_addr.sin_addr.s_addr, server->h_length);
+	serv_addr.sin_port = htons(PORT);
+
+	//Connects to server:
+	if (connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0)
+	{
+		perror("ERROR connecting");
+		close(sockfd);
+		return -1;
+	}
+	return sockfd;
+}
+
+//Sends a file request and returns the size of the whole file, -1 if the server closed the connection.
+//replyEncoding is set to the encoding the server chose for the data.
+long requestFile(int sockfd, struct tcpReader* reader, const char* fileName, long offset, long length, int encoding, int* replyEncoding)
+{
+	char request[STRBUFSIZE];
+	formatFileRequest(request, sizeof(request), fileName, offset, length, encoding);
+	writeTextTCP(sockfd, request);
+	initReaderTCP(reader, sockfd);
+	return readFileSizeBufferedTCP(reader, replyEncoding);
+}
+
+//Receives the rest of a file after its size; returns 0 if all of it arrived
+int receiveFile(struct tcpReader* serverReader, const char* fileName, long fileSize, long offset, int encoding)
+{
+	printf("Receiving: '%s', size: %li%s\n", fileName, fileSize, encoding == ENCODING_DEFLATE ? ", deflated" : "");
+	struct payloadReader payload;
+	if(initPayloadReader(&payload, serverReader, encoding) < 0)
+	{
+		printf("ERROR: Could not set up decompression\n");
+		return 1;
+	}
 
-	//Opens file in binary write mode:
-	FILE *file = fopen(fileName, "wb");
+	//Opens file in binary write mode, appending when continuing a download:
+	FILE *file = fopen(fileName, offset > 0 ? "ab" : "wb");
 	if(file==NULL)
 	{
 		perror("ERROR: Could not create file");
-		return;
+		return 1;
 	}
 
 	char buffer[1000]; //Buffer for file data
-	long totalBytesReceived = 0;
+	long totalBytesReceived = offset;
 	ssize_t bytesReceived;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	//Receives file data in chunks:
+	//Receives file data in chunks, starting with what was read along with the file size:
 	while(totalBytesReceived<fileSize)
 	{
-		bzero(buffer, sizeof(buffer));
-		bytesReceived = read(serverSocket, buffer, sizeof(buffer));
+		bytesReceived = readPayload(&payload, buffer, sizeof(buffer));
 
 		if(bytesReceived < 0)
 		{
 			perror ("ERROR: Recieving file data");
 			fclose(file);
-			return;
+			endPayloadReader(&payload);
+			return 1;
 		}
 		if(bytesReceived == 0)
 		{
@@ -63,71 +135,301 @@ void receiveFile(int serverSocket, const char* fileName, long fileSize)
 		printf("Recieved %ld/%ld bytes...\n", totalBytesReceived, fileSize);
 	}
 	fclose(file);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	int streamEnded = endPayloadReader(&payload) == 0;
 
 	//Verifies if the complete file was received:
-	if(totalBytesReceived==fileSize)
+	if(totalBytesReceived==fileSize && streamEnded)
 	{
-		printf("File transfer was succesful: %s\n", fileName);
+		double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("File transfer was succesful: %s (%ld bytes, %lld on the wire, in %.3f s, %.1f MB/s)\n", fileName,
+		       fileSize - offset, payload.wireBytes, seconds, seconds > 0 ? (fileSize - offset) / seconds / 1e6 : 0.0);
+		return 0;
 	}
-	else
+	printf("File transfer was unsuccesful. Received %ld of %ld bytes (run again with -c to continue).\n", totalBytesReceived, fileSize);
+	return 1;
+}
+
+//One part of a parallel download, received on its own connection
+struct segment
+{
+	long start;
+	long end;
+	long done; //Bytes of the segment written so far
+};
+
+//State shared by the connections of a parallel download
+struct download
+{
+	const char* host;
+	const char* fileName;
+	char stateName[STRBUFSIZE]; //Records the segments while the download is incomplete
+	long fileSize;
+	int encoding; //Encoding offered to the server for every segment
+	int file;
+	int segmentCount;
+	struct segment* segments;
+	pthread_mutex_t lock;
+};
+
+struct segmentJob
+{
+	struct download* download;
+	struct segment* segment;
+	pthread_t thread;
+	int started;
+};
+
+//Saves how far every segment got, so that -c can continue where the download stopped
+void saveState(struct download* d)
+{
+	char tempName[STRBUFSIZE + 4];
+	snprintf(tempName, sizeof(tempName), "%s.tmp", d->stateName);
+
+	pthread_mutex_lock(&d->lock);
+	FILE* state = fopen(tempName, "w");
+	if(state != NULL)
 	{
-		printf("File transfer was unsuccesful. Received %ld of %ld bytes.\n", totalBytesReceived, fileSize);
+		fprintf(state, "%ld %d\n", d->fileSize, d->segmentCount);
+		for(int i = 0; i < d->segmentCount; i++)
+		{
+			fprintf(state, "%ld %ld %ld\n", d->segments[i].start, d->segments[i].end, d->segments[i].done);
+		}
+		//Replaces the old state in one step, so that a crash leaves the old or the new one:
+		if(fclose(state) == 0)
+		{
+			rename(tempName, d->stateName);
+		}
 	}
+	pthread_mutex_unlock(&d->lock);
+}
 
+//Loads the segments of an earlier download of a file of the same size; returns 0 if there is none
+int loadState(struct download* d)
+{
+	FILE* state = fopen(d->stateName, "r");
+	if(state == NULL)
+	{
+		return 0;
+	}
+	long fileSize;
+	int count;
+	int ok = fscanf(state, "%ld %d", &fileSize, &count) == 2 && fileSize == d->fileSize && count > 0;
+	if(ok)
+	{
+		d->segments = (struct segment*)calloc(count, sizeof(struct segment));
+		d->segmentCount = count;
+		for(int i = 0; i < count && ok; i++)
+		{
+			struct segment* s = &d->segments[i];
+			ok = fscanf(state, "%ld %ld %ld", &s->start, &s->end, &s->done) == 3 &&
+			     s->start >= 0 && s->end <= fileSize && s->done >= 0 && s->done <= s->end - s->start;
+		}
+		if(!ok)
+		{
+			free(d->segments);
+			d->segments = NULL;
+			d->segmentCount = 0;
+		}
+	}
+	fclose(state);
+	return ok;
 }
 
-int main(int argc, char *argv[])
+//Receives one segment into its place in the file
+void* receiveSegment(void* arg)
 {
-	printf("Starting client...\n");
+	struct segmentJob* job = (struct segmentJob*)arg;
+	struct download* d = job->download;
+	struct segment* s = job->segment;
 
-	int sockfd, portno, n;
-	struct sockaddr_in serv_addr;
-	struct hostent *server;
-	uint8_t buffer[STRBUFSIZE];
-    
-	//Ensures number of arguments:
-	if (argc < 3)
+	int sockfd = connectToServer(d->host);
+	if(sockfd < 0)
+	{
+		return NULL;
+	}
+	struct tcpReader reader;
+	struct payloadReader payload;
+	int encoding;
+	long fileSize = requestFile(sockfd, &reader, d->fileName, s->start + s->done, s->end - s->start - s->done, d->encoding, &encoding);
+	if(fileSize != d->fileSize)
 	{
-		error( "ERROR usage: ""hostname""");
+		printf("Segment at %ld: server reports size %ld instead of %ld\n", s->start, fileSize, d->fileSize);
+		close(sockfd);
+		return NULL;
+	}
+	if(initPayloadReader(&payload, &reader, encoding) < 0)
+	{
+		close(sockfd);
+		return NULL;
 	}
-	    
-	portno = 9000; //Port number
 
-	//Creates a TCP socket:
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd < 0) 
+	char buffer[READERSIZE];
+	long sinceSave = 0;
+	while(s->done < s->end - s->start)
 	{
-		error("ERROR opening socket");
+		long want = s->end - s->start - s->done;
+		ssize_t bytesReceived = readPayload(&payload, buffer, want < (long)sizeof(buffer) ? want : sizeof(buffer));
+		if(bytesReceived <= 0)
+		{
+			printf("Segment at %ld: connection ended after %ld of %ld bytes\n", s->start, s->done, s->end - s->start);
+			break;
+		}
+
+		//Writes the data at its own position; the segments never overlap:
+		ssize_t written = 0;
+		while(written < bytesReceived)
+		{
+			ssize_t n = pwrite(d->file, buffer + written, bytesReceived - written, s->start + s->done + written);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n < 0)
+			{
+				perror("ERROR: Writing file data");
+				endPayloadReader(&payload);
+				close(sockfd);
+				saveState(d);
+				return NULL;
+			}
+			written += n;
+		}
+
+		pthread_mutex_lock(&d->lock);
+		s->done += bytesReceived;
+		pthread_mutex_unlock(&d->lock);
+		sinceSave += bytesReceived;
+		if(sinceSave >= SAVEINTERVAL)
+		{
+			saveState(d);
+			sinceSave = 0;
+		}
 	}
-	    
-	// Resolves server hostname to IP address:
-	server = gethostbyname(argv[1]);
-	if (server == NULL) 
+	endPayloadReader(&payload);
+	close(sockfd);
+	saveState(d);
+	return NULL;
+}
+
+//Downloads a file over several connections at once; returns 0 on success
+int downloadParallel(const char* host, const char* fileName, int streams, int resume, int encoding)
+{
+	struct download d;
+	memset(&d, 0, sizeof(d));
+	d.host = host;
+	d.fileName = fileName;
+	d.encoding = encoding;
+	snprintf(d.stateName, sizeof(d.stateName), "%s.segments", fileName);
+	pthread_mutex_init(&d.lock, NULL);
+
+	//Asks for no bytes, only the size:
+	int sockfd = connectToServer(host);
+	if(sockfd < 0)
 	{
-		error("ERROR no such host");
+		return 1;
+	}
+	struct tcpReader reader;
+	d.fileSize = requestFile(sockfd, &reader, fileName, 0, 0, ENCODING_IDENTITY, NULL);
+	close(sockfd);
+	if(d.fileSize <= 0)
+	{
+		printf("Server error: File not found, invalid size, or no support for byte ranges\n");
+		return 1;
 	}
-	    
-	printf("Connecting to server...\n");
 
-	//Sets up server address struct:
-	bzero((char *) &serv_addr, sizeof(serv_addr));
-	serv_addr.sin_family = AF_INET;
-	bcopy((char *)server->h_addr_list[0], (char *)&serv_addr.sin_addr.s_addr, server->h_length);
-	serv_addr.sin_port = htons(portno);
+	if(resume && loadState(&d))
+	{
+		d.file = open(fileName, O_WRONLY);
+		long done = 0;
+		for(int i = 0; i < d.segmentCount; i++)
+		{
+			done += d.segments[i].done;
+		}
+		printf("Continuing '%s': %ld of %ld bytes already received\n", fileName, done, d.fileSize);
+	}
+	else
+	{
+		//Reserves the whole file up front, so that the segments can be written in any order:
+		d.file = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(d.file >= 0 && posix_fallocate(d.file, 0, d.fileSize) != 0 && ftruncate(d.file, d.fileSize) < 0)
+		{
+			perror("ERROR: Could not allocate file");
+			close(d.file);
+			return 1;
+		}
+		d.segmentCount = streams < d.fileSize ? streams : (int)d.fileSize;
+		d.segments = (struct segment*)calloc(d.segmentCount, sizeof(struct segment));
+		for(int i = 0; i < d.segmentCount; i++)
+		{
+			d.segments[i].start = d.fileSize * i / d.segmentCount;
+			d.segments[i].end = d.fileSize * (i + 1) / d.segmentCount;
+		}
+	}
+	if(d.file < 0)
+	{
+		perror("ERROR: Could not open file");
+		return 1;
+	}
+	saveState(&d);
+	printf("Receiving: '%s', size: %li, over %d connections\n", fileName, d.fileSize, d.segmentCount);
 
-	//Connects to server:
-	if (connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0) 
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	struct segmentJob* jobs = (struct segmentJob*)calloc(d.segmentCount, sizeof(struct segmentJob));
+	for(int i = 0; i < d.segmentCount; i++)
 	{
-		error("ERROR connecting");
+		jobs[i].download = &d;
+		jobs[i].segment = &d.segments[i];
+		if(d.segments[i].done < d.segments[i].end - d.segments[i].start)
+		{
+			if(pthread_create(&jobs[i].thread, NULL, receiveSegment, &jobs[i]) != 0)
+			{
+				error("ERROR starting connection thread");
+			}
+			jobs[i].started = 1;
+		}
 	}
-	
-	//Sends file request to the server:
-	strncpy((char*)buffer, argv[2], sizeof(buffer) - 1);
-    buffer[sizeof(buffer) - 1] = '\0';  //0 termination
-    writeTextTCP(sockfd, (char*)buffer);
+	long received = 0;
+	for(int i = 0; i < d.segmentCount; i++)
+	{
+		if(jobs[i].started)
+		{
+			pthread_join(jobs[i].thread, NULL);
+		}
+		received += d.segments[i].done;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close(d.file);
 
-	//Receives file size from server:
-    long fileSize = readFileSizeTCP(sockfd);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	int complete = received == d.fileSize;
+	if(complete)
+	{
+		unlink(d.stateName);
+		printf("File transfer was succesful: %s (%.3f s)\n", fileName, seconds);
+	}
+	else
+	{
+		printf("File transfer was unsuccesful. Received %ld of %ld bytes (run again with -c to continue).\n", received, d.fileSize);
+	}
+	free(jobs);
+	free(d.segments);
+	return complete ? 0 : 1;
+}
+
+//Downloads one file over its own connection, from the end of the local file when continuing
+int downloadFile(const char* host, const char* fileName, int resume, int encoding)
+{
+	printf("Connecting to server...\n");
+	int sockfd = connectToServer(host);
+	if (sockfd < 0)
+	{
+		return 1;
+	}
+
+	//Sends file request to the server:
+	long offset = resume ? getFilesize(fileName) : 0;
+	struct tcpReader reader;
+	long fileSize = requestFile(sockfd, &reader, fileName, offset, -1, encoding, &encoding);
 
     if (fileSize <= 0)
     {
@@ -137,11 +439,244 @@ int main(int argc, char *argv[])
     }
 
     printf("File size received: %ld bytes\n", fileSize);
+    if (offset > fileSize)
+    {
+        printf("Local file is larger than the server's; remove it to download again\n");
+        close(sockfd);
+        return 1;
+    }
+    if (offset == fileSize)
+    {
+        printf("File is already complete: %s\n", fileName);
+        close(sockfd);
+        return 0;
+    }
+    if (offset > 0)
+    {
+        printf("Continuing at %ld bytes\n", offset);
+    }
 
 	//Receives and saves the requested file:
-    receiveFile(sockfd, argv[2], fileSize);
+    int result = receiveFile(&reader, fileName, fileSize, offset, encoding);
 
     printf("Closing client...\n");
     close(sockfd);
-    return 0;
+    return result;
+}
+
+//Downloads several files over one persistent connection, with up to PIPELINEWINDOW requests
+//in flight; returns 0 if all arrived, 1 if not, -1 if the server does not keep connections open
+int downloadPipelined(const char* host, char** fileNames, int count, int encoding)
+{
+	printf("Connecting to server...\n");
+	int sockfd = connectToServer(host);
+	if (sockfd < 0)
+	{
+		return 1;
+	}
+	//Requests are small; they must not wait for each other:
+	int noDelay = 1;
+	setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+	//Asks to keep the connection; a server without persistent connections just closes it:
+	struct tcpReader reader;
+	char header[STRBUFSIZE];
+	int status, replyEncoding;
+	long length, fileSize;
+	writeTextTCP(sockfd, "");
+	initReaderTCP(&reader, sockfd);
+	if (readTextBufferedTCP(&reader, header, sizeof(header)) < 0 ||
+	    parseReplyHeader(header, &status, &length, &fileSize, &replyEncoding) < 0 || status != REPLY_OK)
+	{
+		close(sockfd);
+		return -1;
+	}
+	printf("Receiving %d files over one connection\n", count);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	char requests[PIPELINEWINDOW * STRBUFSIZE];
+	char buffer[READERSIZE];
+	int sent = 0, received = 0, failed = 0;
+	long long totalBytesReceived = 0;
+	long long wireBytes = 0;
+	while (received < count)
+	{
+		//Tops up the requests in flight, all in one write:
+		if (sent < count && sent - received <= PIPELINEWINDOW / 2)
+		{
+			size_t used = 0;
+			for (; sent < count && sent - received < PIPELINEWINDOW; sent++)
+			{
+				formatFileRequest(requests + used, STRBUFSIZE, fileNames[sent], 0, -1, encoding);
+				used += strlen(requests + used) + 1;
+			}
+			for (size_t written = 0; written < used;)
+			{
+				ssize_t n = write(sockfd, requests + written, used - written);
+				if (n < 0)
+				{
+					perror("ERROR: Sending requests");
+					close(sockfd);
+					return 1;
+				}
+				written += n;
+			}
+		}
+
+		//Replies come in the order of the requests:
+		const char* fileName = fileNames[received];
+		if (readTextBufferedTCP(&reader, header, sizeof(header)) < 0 ||
+		    parseReplyHeader(header, &status, &length, &fileSize, &replyEncoding) < 0)
+		{
+			printf("Connection lost after %d of %d files\n", received, count);
+			break;
+		}
+		received++;
+		if (status != REPLY_OK)
+		{
+			printf("%s: %s\n", fileName, status == REPLY_NOT_FOUND ? "not found" : "refused by server");
+			failed++;
+			continue;
+		}
+
+		FILE *file = fopen(fileName, "wb");
+		if (file == NULL)
+		{
+			perror("ERROR: Could not create file");
+			failed++;
+		}
+		//The data is read even without a file, to get to the next reply:
+		struct payloadReader payload;
+		if (initPayloadReader(&payload, &reader, replyEncoding) < 0)
+		{
+			printf("ERROR: Could not set up decompression\n");
+			if (file != NULL)
+			{
+				fclose(file);
+			}
+			failed++;
+			break;
+		}
+		long remaining = length;
+		while (remaining > 0)
+		{
+			ssize_t n = readPayload(&payload, buffer, remaining < (long)sizeof(buffer) ? remaining : sizeof(buffer));
+			if (n <= 0)
+			{
+				break;
+			}
+			if (file != NULL)
+			{
+				fwrite(buffer, 1, n, file);
+			}
+			remaining -= n;
+		}
+		if (file != NULL)
+		{
+			fclose(file);
+		}
+		totalBytesReceived += length - remaining;
+		if (endPayloadReader(&payload) < 0)
+		{
+			remaining = remaining > 0 ? remaining : 1; //the next reply cannot be found either
+		}
+		wireBytes += payload.wireBytes;
+		if (remaining > 0)
+		{
+			printf("Connection lost during %s\n", fileName);
+			failed++;
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close(sockfd);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("Received %d of %d files (%lld bytes, %lld on the wire) in %.3f s, %.1f MB/s, %d failed\n", received - failed, count,
+	       totalBytesReceived, wireBytes, seconds, seconds > 0 ? totalBytesReceived / seconds / 1e6 : 0.0, failed + count - received);
+	return received == count && failed == 0 ? 0 : 1;
+}
+
+void usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-c] [-n streams] [-s] [-z] hostname file...\n"
+	                "  -c  continue a download that stopped\n"
+	                "  -n  download over N parallel connections (default 1)\n"
+	                "  -s  one connection per file, instead of all files over one connection\n"
+	                "  -z  accept deflate: the server compresses files that shrink\n", program);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	printf("Starting client...\n");
+
+	//Reads the options:
+	int opt;
+	int resume = 0;
+	int streams = 1;
+	int separate = 0;
+	int encoding = ENCODING_IDENTITY;
+	while ((opt = getopt(argc, argv, "cn:sz")) != -1)
+	{
+		if (opt == 'c')
+		{
+			resume = 1;
+			continue;
+		}
+		if (opt == 'n' && atoi(optarg) > 0)
+		{
+			streams = atoi(optarg);
+			continue;
+		}
+		if (opt == 's')
+		{
+			separate = 1;
+			continue;
+		}
+		if (opt == 'z')
+		{
+			encoding = ENCODING_DEFLATE;
+			continue;
+		}
+		usage(argv[0]);
+	}
+
+	//Ensures number of arguments:
+	if (argc - optind < 2)
+	{
+		usage(argv[0]);
+	}
+	const char* host = argv[optind];
+	char** fileNames = argv + optind + 1;
+	int count = argc - optind - 1;
+
+	//Several whole files: one connection, requests pipelined
+	if (count > 1 && !separate && !resume && streams == 1)
+	{
+		int result = downloadPipelined(host, fileNames, count, encoding);
+		if (result >= 0)
+		{
+			return result;
+		}
+		printf("Server does not keep connections open; using one connection per file\n");
+	}
+
+	int failed = 0;
+	for (int i = 0; i < count; i++)
+	{
+		//Parallel downloads, and continuing one, keep their segments in a state file:
+		char stateName[STRBUFSIZE];
+		snprintf(stateName, sizeof(stateName), "%s.segments", fileNames[i]);
+		if (streams > 1 || (resume && access(stateName, F_OK) == 0))
+		{
+			failed |= downloadParallel(host, fileNames[i], streams, resume, encoding);
+		}
+		else
+		{
+			failed |= downloadFile(host, fileNames[i], resume, encoding);
+		}
+	}
+	return failed;
 }
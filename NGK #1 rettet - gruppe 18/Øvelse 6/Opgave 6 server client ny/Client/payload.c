@@ -0,0 +1,98 @@
+/*
+ * payload.c
+ *
+ * Reads the file data of a reply. With ENCODING_DEFLATE the server sends the data as
+ * one zlib stream; it is inflated straight out of the tcpReader's buffer, and whatever
+ * follows the end of the stream (the next reply on a persistent connection) stays
+ * in the reader.
+ *
+ * Build: link with -lz
+ */
+#include <string.h>
+#include "payload.h"
+
+/**
+ * Prepares to read the data that follows a size text or reply header
+ *
+ * @param payload Reader to set up
+ * @param reader Reader of the connection, positioned at the start of the data
+ * @param encoding Encoding the server answered with
+ * @return 0, or -1 if zlib could not be set up
+ */
+int initPayloadReader(struct payloadReader* payload, struct tcpReader* reader, int encoding)
+{
+    memset(payload, 0, sizeof(*payload));
+    payload->reader = reader;
+    payload->encoding = encoding;
+    if(encoding == ENCODING_DEFLATE && inflateInit(&payload->z) != Z_OK)
+        return -1;
+    return 0;
+}
+
+/**
+ * Reads file data, inflated if the server compressed it
+ *
+ * @param payload Reader of the data
+ * @param data Buffer for the file data
+ * @param size Size of data
+ * @return Bytes read (at most size), 0 at the end of the stream or if the connection
+ *         closed, -1 on error or corrupt data
+ */
+ssize_t readPayload(struct payloadReader* payload, void* data, size_t size)
+{
+    if(payload->encoding != ENCODING_DEFLATE)
+    {
+        ssize_t n = readBufferedTCP(payload->reader, data, size);
+        if(n > 0)
+            payload->wireBytes += n;
+        return n;
+    }
+    if(payload->ended || size == 0)
+        return 0;
+
+    struct tcpReader* reader = payload->reader;
+    z_stream* z = &payload->z;
+    z->next_out = (Bytef*)data;
+    z->avail_out = (uInt)size;
+    for(;;)
+    {
+        // Inflate what is buffered first: zlib may hold output that needs no more input
+        size_t available = reader->end - reader->start;
+        z->next_in = (Bytef*)(reader->buffer + reader->start);
+        z->avail_in = (uInt)available;
+        int result = inflate(z, Z_NO_FLUSH);
+        size_t used = available - z->avail_in;
+        reader->start += used;
+        payload->wireBytes += used;
+
+        if(result == Z_STREAM_END)
+        {
+            payload->ended = 1;
+            break;
+        }
+        if(result != Z_OK && result != Z_BUF_ERROR)
+            return -1;
+        if(z->avail_out < size)
+            break;
+        ssize_t n = fillBufferedTCP(reader);
+        if(n <= 0)
+            return n;
+    }
+    return (ssize_t)(size - z->avail_out);
+}
+
+/**
+ * Finishes a reply: reads the end of a deflate stream, which may still be waiting after
+ * the last file byte, and frees the inflater
+ *
+ * @return 0, or -1 if the stream was cut short or held more data than expected
+ */
+int endPayloadReader(struct payloadReader* payload)
+{
+    if(payload->encoding != ENCODING_DEFLATE)
+        return 0;
+    char extra;
+    int result = readPayload(payload, &extra, 1) == 0 && payload->ended ? 0 : -1;
+    inflateEnd(&payload->z);
+    return result;
+}
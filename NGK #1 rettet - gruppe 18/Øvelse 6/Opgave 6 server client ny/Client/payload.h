@@ -0,0 +1,29 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <zlib.h>
+#include "iknlib.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+// Reads the data of one reply through a tcpReader, inflating it when the server sent it deflated
+struct payloadReader
+{
+    struct tcpReader* reader;
+    int encoding;           // ENCODING_IDENTITY or ENCODING_DEFLATE, as the server answered
+    int ended;              // the deflate stream has ended
+    long long wireBytes;    // bytes taken from the connection
+    z_stream z;
+};
+
+int initPayloadReader(struct payloadReader* payload, struct tcpReader* reader, int encoding);
+ssize_t readPayload(struct payloadReader* payload, void* data, size_t size);
+int endPayloadReader(struct payloadReader* payload);
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // PAYLOAD_H
@@ -0,0 +1,226 @@
+/*
+ * compress.c
+ *
+ * On-the-fly compression of file data for clients that offer "deflate" in their
+ * request (see formatFileRequest). The file is read in blocks, deflated with zlib and
+ * written to the socket as one zlib stream, which marks its own end, so the reply
+ * framing does not need to know the compressed size beforehand. Files in a compressed
+ * format (JPEG, PNG, archives, ...) are recognised by their signature and sent as they
+ * are, with sendfile; anything else is compressed only if the byte statistics of a
+ * sample of the range show that it will shrink.
+ *
+ * Build: link with -lz (and -lm when linking with gcc)
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "compress.h"
+
+#define CHUNKSIZE (64 * 1024)  // File bytes deflated per read, and size of the output buffer
+#define SAMPLESIZE (16 * 1024) // Bytes looked at by worthCompressing
+#define MAXENTROPY 7.2         // Bits per byte below which a sample is sure to shrink by a tenth
+#define MINCOMPRESS 1024       // Smaller ranges are never compressed; the stream costs more than it saves
+
+struct deflateStream
+{
+    z_stream z;
+    int file;
+    long offset;               // next file byte to read
+    long end;                  // end of the range
+    int finished;              // deflate has written the end of the stream
+    size_t outStart;           // first byte of out not yet sent
+    size_t outEnd;
+    long long wireBytes;       // compressed bytes sent
+    unsigned char in[CHUNKSIZE];
+    unsigned char out[CHUNKSIZE];
+};
+
+/* Signatures of formats that are compressed already; deflate would gain little on them */
+static const struct
+{
+    int offset;
+    const char *bytes;
+    size_t length;
+} compressedFormats[] = {
+    { 0, "\xff\xd8\xff", 3 },     // JPEG
+    { 0, "\x89PNG", 4 },          // PNG
+    { 0, "GIF8", 4 },             // GIF
+    { 0, "PK\x03\x04", 4 },       // zip, and docx, jar, apk, ...
+    { 0, "\x1f\x8b", 2 },         // gzip
+    { 0, "BZh", 3 },              // bzip2
+    { 0, "\xfd" "7zXZ", 5 },      // xz
+    { 0, "\x28\xb5\x2f\xfd", 4 }, // zstd
+    { 0, "7z\xbc\xaf", 4 },       // 7-Zip
+    { 4, "ftyp", 4 },             // MP4, MOV, HEIC
+    { 0, "ID3", 3 },              // MP3
+    { 0, "OggS", 4 },             // Ogg
+    { 0, "\x1a\x45\xdf\xa3", 4 }, // Matroska, WebM
+};
+
+/* 1 if the file starts with the signature of a compressed format */
+static int isCompressedFormat(int fileFd)
+{
+    unsigned char head[16];
+    ssize_t n = pread(fileFd, head, sizeof(head), 0);
+    for (size_t i = 0; n > 0 && i < sizeof(compressedFormats) / sizeof(compressedFormats[0]); i++)
+    {
+        if (compressedFormats[i].offset + (ssize_t)compressedFormats[i].length <= n &&
+            memcmp(head + compressedFormats[i].offset, compressedFormats[i].bytes, compressedFormats[i].length) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Order-0 entropy of a sample in bits per byte. The Huffman stage of deflate alone gets
+ * data down to about this, and repeated strings only make it smaller; data that repeats
+ * itself without favouring some byte values is missed, but it is rare. Counting bytes
+ * costs far less than test-compressing, which is slowest on exactly the data that does
+ * not compress.
+ */
+static double sampleEntropy(const unsigned char *sample, size_t size)
+{
+    size_t counts[256] = { 0 };
+    for (size_t i = 0; i < size; i++)
+        counts[sample[i]]++;
+    double bits = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        if (counts[c] > 0)
+        {
+            double p = (double)counts[c] / size;
+            bits -= p * log2(p);
+        }
+    }
+    return bits;
+}
+
+/**
+ * Decides whether a range of a file should be compressed: not if the file is in a
+ * compressed format, otherwise if the entropy of a sample of the range is low enough
+ *
+ * @param level zlib level the data would be sent with; 0 turns compression off
+ * @return 1 if the range should shrink by at least a tenth, 0 otherwise
+ */
+int worthCompressing(int fileFd, long offset, long length, int level)
+{
+    if (level <= 0 || length < MINCOMPRESS || isCompressedFormat(fileFd))
+        return 0;
+    unsigned char sample[SAMPLESIZE];
+    ssize_t n = pread(fileFd, sample, length < SAMPLESIZE ? length : SAMPLESIZE, offset);
+    return n > 0 && sampleEntropy(sample, n) < MAXENTROPY;
+}
+
+/**
+ * Starts sending length bytes of a file, from offset on, as a deflate stream
+ *
+ * @param level zlib level, 1 (fastest) to 9 (smallest)
+ * @return the stream, or NULL if zlib could not be set up
+ */
+struct deflateStream* openDeflateStream(int fileFd, long offset, long length, int level)
+{
+    struct deflateStream *s = (struct deflateStream *)malloc(sizeof(struct deflateStream));
+    if (s == NULL)
+        return NULL;
+    s->z.zalloc = Z_NULL;
+    s->z.zfree = Z_NULL;
+    s->z.opaque = Z_NULL;
+    s->z.next_in = s->in;
+    s->z.avail_in = 0;
+    if (deflateInit(&s->z, level) != Z_OK)
+    {
+        free(s);
+        return NULL;
+    }
+    s->file = fileFd;
+    s->offset = offset;
+    s->end = offset + length;
+    s->finished = 0;
+    s->outStart = s->outEnd = 0;
+    s->wireBytes = 0;
+    return s;
+}
+
+/**
+ * Compresses and sends as much of the stream as the socket takes now. On a blocking
+ * socket it only returns when the stream is done or maxBytes were sent.
+ *
+ * @param maxBytes most compressed bytes to send in this call
+ * @return Compressed bytes sent, 0 when the socket is full, -1 on error (errno is set)
+ */
+long deflateStreamStep(struct deflateStream* s, int outSocket, long maxBytes)
+{
+    long sent = 0;
+    while (sent < maxBytes)
+    {
+        if (s->outStart < s->outEnd)
+        {
+            ssize_t n = write(outSocket, s->out + s->outStart, s->outEnd - s->outStart);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                return -1;
+            }
+            s->outStart += n;
+            s->wireBytes += n;
+            sent += n;
+            continue;
+        }
+        if (s->finished)
+            break;
+
+        // Output sent: refill the input if deflate has used it up, and compress more
+        if (s->z.avail_in == 0 && s->offset < s->end)
+        {
+            ssize_t n = pread(s->file, s->in, s->end - s->offset < CHUNKSIZE ? s->end - s->offset : CHUNKSIZE, s->offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                if (n == 0)
+                    errno = EIO; // file shrank under us
+                return -1;
+            }
+            s->offset += n;
+            s->z.next_in = s->in;
+            s->z.avail_in = n;
+        }
+        s->z.next_out = s->out;
+        s->z.avail_out = CHUNKSIZE;
+        int result = deflate(&s->z, s->offset == s->end ? Z_FINISH : Z_NO_FLUSH);
+        if (result == Z_STREAM_END)
+            s->finished = 1;
+        else if (result != Z_OK && result != Z_BUF_ERROR)
+        {
+            errno = EIO;
+            return -1;
+        }
+        s->outStart = 0;
+        s->outEnd = CHUNKSIZE - s->z.avail_out;
+    }
+    return sent;
+}
+
+/* 1 once the whole stream, with its end, has been sent */
+int deflateStreamDone(const struct deflateStream* s)
+{
+    return s->finished && s->outStart == s->outEnd;
+}
+
+long long deflateStreamWireBytes(const struct deflateStream* s)
+{
+    return s->wireBytes;
+}
+
+/* Frees the stream; the file stays open */
+void closeDeflateStream(struct deflateStream* s)
+{
+    deflateEnd(&s->z);
+    free(s);
+}
@@ -0,0 +1,26 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <sys/types.h>
+
+#define DEFAULTLEVEL 1 // zlib level used unless the server is told otherwise; 1 is the fastest
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+/* A file range being sent as one deflate stream; see openDeflateStream */
+struct deflateStream;
+
+int worthCompressing(int fileFd, long offset, long length, int level);
+struct deflateStream* openDeflateStream(int fileFd, long offset, long length, int level);
+long deflateStreamStep(struct deflateStream* s, int outSocket, long maxBytes);
+int deflateStreamDone(const struct deflateStream* s);
+long long deflateStreamWireBytes(const struct deflateStream* s);
+void closeDeflateStream(struct deflateStream* s);
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // COMPRESS_H
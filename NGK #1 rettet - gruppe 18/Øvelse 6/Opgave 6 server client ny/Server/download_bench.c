@@ -0,0 +1,158 @@
+/*
+ * download_bench.c
+ *
+ * Concurrent downloads against a running file server. Opens N connections at once,
+ * requests the same file on each and reads every reply in one epoll loop, checking
+ * that each download delivers exactly the announced size. Prints how long it took
+ * and how many downloads failed.
+ *
+ * Build: gcc -O2 -o download_bench download_bench.c
+ * Usage: ./download_bench [connections] [file] [host]
+ *        (defaults 1000, Banan.jpeg, 127.0.0.1; port 9000)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define PORT 9000
+
+struct download
+{
+	int fd;
+	int requested;
+	char header[32];
+	int headerLen;
+	long size;      // -1 until the size text is complete
+	long received;
+};
+
+void error(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reads what has arrived; returns 1 when the download is over (complete or not)
+static int readReply(struct download *d, char *buffer, size_t bufferSize)
+{
+	for (;;)
+	{
+		ssize_t n = read(d->fd, buffer, bufferSize);
+		if (n < 0)
+			return errno == EAGAIN ? 0 : 1;
+		if (n == 0)
+			return 1;
+		ssize_t used = 0;
+		while (d->size < 0 && used < n)
+		{
+			char c = buffer[used++];
+			if (c == 0)
+				d->size = atol(d->header);
+			else if (d->headerLen < (int)sizeof(d->header) - 1)
+				d->header[d->headerLen++] = c;
+		}
+		d->received += n - used;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int count = argc > 1 ? atoi(argv[1]) : 1000;
+	const char *fileName = argc > 2 ? argv[2] : "Banan.jpeg";
+	const char *host = argc > 3 ? argv[3] : "127.0.0.1";
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(PORT);
+	if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+		error("ERROR bad host");
+
+	int epollFd = epoll_create1(0);
+	struct download *downloads = calloc(count, sizeof(struct download));
+	double start = now();
+	for (int i = 0; i < count; i++)
+	{
+		struct download *d = &downloads[i];
+		d->size = -1;
+		d->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (d->fd < 0)
+			error("ERROR opening socket");
+		if (connect(d->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+			error("ERROR connecting");
+		struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = d };
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, d->fd, &ev);
+	}
+
+	static char buffer[1 << 16];
+	struct epoll_event events[256];
+	int open = count;
+	while (open > 0)
+	{
+		int n = epoll_wait(epollFd, events, 256, 10000);
+		if (n == 0)
+		{
+			fprintf(stderr, "Timed out with %d downloads still open\n", open);
+			break;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			struct download *d = events[i].data.ptr;
+			int over = 0;
+			if (!d->requested)
+			{
+				// Connected: sends the null-terminated file name and waits for the reply
+				if (events[i].events & EPOLLERR || write(d->fd, fileName, strlen(fileName) + 1) < 0)
+					over = 1;
+				d->requested = 1;
+				struct epoll_event ev = { .events = EPOLLIN, .data.ptr = d };
+				epoll_ctl(epollFd, EPOLL_CTL_MOD, d->fd, &ev);
+			}
+			else
+				over = readReply(d, buffer, sizeof(buffer));
+			if (over)
+			{
+				close(d->fd);
+				d->fd = -1;
+				open--;
+			}
+		}
+	}
+	double seconds = now() - start;
+
+	int failed = 0;
+	long long bytes = 0;
+	for (int i = 0; i < count; i++)
+	{
+		bytes += downloads[i].received;
+		if (downloads[i].size < 0 || downloads[i].received != downloads[i].size)
+			failed++;
+	}
+	printf("%d downloads of %s in %.2f s: %d failed, %.1f MB received, %.1f MB/s\n", count, fileName, seconds, failed,
+	       bytes / 1e6, bytes / seconds / 1e6);
+	return failed != 0;
+}
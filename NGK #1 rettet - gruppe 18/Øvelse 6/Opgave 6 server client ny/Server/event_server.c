@@ -0,0 +1,454 @@
+/*
+ * event_server.c
+ *
+ * Event-driven mode of the file server: non-blocking sockets on epoll, so a slow
+ * client no longer holds up everyone else. Every connection walks through the
+ * same protocol as the blocking server, as a small state machine:
+ *
+ *   READ_NAME -> read the null-terminated file request
+ *   SEND_SIZE -> write the null-terminated size text (or reply header)
+ *   SEND_DATA -> send the file, or the range asked for, with sendfile, a slice per wakeup;
+ *                through deflate when the client offered it and the file shrinks
+ *
+ * On a persistent connection SEND_DATA leads back to READ_NAME, starting with any
+ * requests the client already pipelined behind the one just answered.
+ *
+ * With several workers, each thread has its own SO_REUSEPORT listener and epoll
+ * instance and the kernel spreads new connections over them; nothing is shared
+ * between the threads.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // accept4
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include "event_server.h"
+#include "iknlib.h"
+
+#define MAXEVENTS 256          // Events taken per epoll_wait
+#define SLICEBYTES (4L << 20)  // Most bytes sent to one connection per wakeup
+#define MAXREPLIES 64          // Most pipelined requests answered on one connection per wakeup
+#define STATSINTERVAL 10       // Seconds between statistics lines
+
+enum connState { READ_NAME, SEND_SIZE, SEND_DATA };
+
+struct connection
+{
+    int fd;
+    enum connState state;
+    unsigned events; // what epoll watches for
+    struct fileRequest req;
+};
+
+struct worker
+{
+    int index;
+    int port;
+    int backlog;
+    int reusePort;
+    enum transferMode mode;
+    int compressionLevel; // 0: never compress
+    int listenFd;
+    int epollFd;
+    long open;       // connections open now
+    long files;      // files sent completely
+    long long bytes; // bytes sent, after compression
+};
+
+/**
+ * Opens a non-blocking listening socket on port
+ *
+ * @param reusePort sets SO_REUSEPORT, so that every worker can have a listener of its own
+ * @return the socket, or -1
+ */
+int openListener(int port, int backlog, int reusePort)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, backlog) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void closeConnection(struct worker *w, struct connection *c)
+{
+    epoll_ctl(w->epollFd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    closeFileRequest(&c->req);
+    free(c);
+    w->open--;
+}
+
+static void watch(struct worker *w, struct connection *c, unsigned events)
+{
+    if (c->events == events)
+        return;
+    c->events = events;
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = c;
+    epoll_ctl(w->epollFd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+void initFileRequest(struct fileRequest *r)
+{
+    r->textLen = r->requestLen = r->persistent = 0;
+    r->headerLen = r->headerSent = 0;
+    r->file = -1;
+    r->offset = r->size = r->end = 0;
+    r->encoding = ENCODING_IDENTITY;
+    r->deflate = NULL;
+}
+
+// Prepares a reply without data; only a persistent connection gets one, others are closed
+static int replyStatus(struct fileRequest *r, int status)
+{
+    if (!r->persistent)
+        return -1; // as the blocking server: a missing file closes the connection
+    r->offset = r->end = r->size = 0;
+    formatReplyHeader(r->header, sizeof(r->header), status, 0, 0, ENCODING_IDENTITY);
+    r->headerLen = strlen(r->header) + 1; // with its terminator
+    return 1;
+}
+
+/**
+ * Takes the next complete request from the received text: opens the file and prepares
+ * the reply header. An empty request switches the connection to persistent mode.
+ *
+ * @param compressionLevel zlib level for clients that accept deflate; 0 never compresses
+ * @return 1 when a request was taken, 0 to wait for more text, -1 to close the connection
+ */
+int takeFileRequest(struct fileRequest *r, int compressionLevel)
+{
+    char *end = (char *)memchr(r->text, 0, r->textLen);
+    if (end == NULL)
+        return r->textLen == sizeof(r->text) - 1 ? -1 : 0; // no terminator within REQUESTBUFSIZE
+    r->requestLen = end - r->text + 1;
+    r->headerSent = 0;
+
+    if (r->requestLen == 1 && !r->persistent)
+    {
+        r->persistent = 1;
+        return replyStatus(r, REPLY_OK);
+    }
+
+    long offset, length;
+    int encoding;
+    struct stat st;
+    if (parseFileRequest(r->text, &offset, &length, &encoding) < 0)
+        return replyStatus(r, REPLY_BAD_REQUEST);
+    r->file = open(r->text, O_RDONLY | O_CLOEXEC);
+    if (r->file < 0 || fstat(r->file, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        if (r->file >= 0)
+            close(r->file);
+        r->file = -1;
+        return replyStatus(r, REPLY_NOT_FOUND);
+    }
+    r->size = st.st_size;
+    r->end = offset + clampRange(r->size, &offset, length);
+    r->offset = offset;
+    r->encoding = ENCODING_IDENTITY;
+    if (encoding == ENCODING_DEFLATE && worthCompressing(r->file, r->offset, r->end - r->offset, compressionLevel))
+    {
+        r->deflate = openDeflateStream(r->file, r->offset, r->end - r->offset, compressionLevel);
+        if (r->deflate != NULL)
+            r->encoding = ENCODING_DEFLATE;
+    }
+    if (r->persistent)
+        formatReplyHeader(r->header, sizeof(r->header), REPLY_OK, r->end - r->offset, r->size, r->encoding);
+    else
+        formatSizeText(r->header, sizeof(r->header), r->size, r->encoding);
+    r->headerLen = strlen(r->header) + 1; // with its terminator
+    return 1;
+}
+
+/**
+ * Ends the reply that was just sent: closes its file and drops its request, keeping
+ * whatever the client pipelined behind it
+ *
+ * @return 1 if the connection stays open for more requests, 0 if it should be closed
+ */
+int finishFileRequest(struct fileRequest *r)
+{
+    closeFileRequest(r);
+    if (!r->persistent)
+        return 0;
+    r->textLen -= r->requestLen;
+    memmove(r->text, r->text + r->requestLen, r->textLen);
+    r->requestLen = 0;
+    return 1;
+}
+
+/* Closes the file of the current reply and drops its deflate stream */
+void closeFileRequest(struct fileRequest *r)
+{
+    if (r->deflate != NULL)
+        closeDeflateStream(r->deflate);
+    r->deflate = NULL;
+    if (r->file >= 0)
+        close(r->file);
+    r->file = -1;
+}
+
+/**
+ * Takes the next request, reading more of it from the socket while it is incomplete
+ *
+ * @return 1 when a request was taken, 0 to wait for more, -1 to close the connection
+ */
+static int readRequest(struct worker *w, struct connection *c)
+{
+    struct fileRequest *r = &c->req;
+    for (;;)
+    {
+        int result = takeFileRequest(r, w->compressionLevel);
+        if (result != 0)
+            return result;
+        ssize_t n = read(c->fd, r->text + r->textLen, sizeof(r->text) - 1 - r->textLen);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        if (n == 0)
+            return -1;
+        r->textLen += n;
+    }
+}
+
+// Moves a connection as far through its states as the socket allows
+static void advance(struct worker *w, struct connection *c)
+{
+    struct fileRequest *r = &c->req;
+    int replies = 0;
+    for (;;)
+    {
+        if (c->state == READ_NAME)
+        {
+            int result = readRequest(w, c);
+            if (result < 0)
+                return closeConnection(w, c);
+            if (result == 0)
+                return watch(w, c, EPOLLIN);
+            c->state = SEND_SIZE;
+        }
+        else if (c->state == SEND_SIZE)
+        {
+            // MSG_MORE: the header goes out in one packet with the start of the data
+            ssize_t n = send(c->fd, r->header + r->headerSent, r->headerLen - r->headerSent,
+                             MSG_NOSIGNAL | (r->offset < r->end ? MSG_MORE : 0));
+            if (n < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    return watch(w, c, EPOLLOUT);
+                return closeConnection(w, c);
+            }
+            r->headerSent += n;
+            if (r->headerSent == r->headerLen)
+                c->state = SEND_DATA;
+        }
+        else
+        {
+            long sent;
+            if (r->deflate != NULL)
+                sent = deflateStreamStep(r->deflate, c->fd, SLICEBYTES);
+            else
+                sent = r->offset < r->end ? sendFileStep(c->fd, r->file, &r->offset, r->end, SLICEBYTES, w->mode) : 0;
+            if (sent < 0)
+                return closeConnection(w, c);
+            w->bytes += sent;
+            if (r->deflate != NULL ? !deflateStreamDone(r->deflate) : r->offset < r->end)
+                return watch(w, c, EPOLLOUT); // socket full or slice used up
+            if (r->file >= 0)
+                w->files++;
+            if (!finishFileRequest(r))
+                return closeConnection(w, c);
+            c->state = READ_NAME;
+            if (++replies == MAXREPLIES)
+                return watch(w, c, EPOLLOUT); // let the other connections have a turn
+        }
+    }
+}
+
+static void acceptAll(struct worker *w)
+{
+    for (;;)
+    {
+        int fd = accept4(w->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("ERROR on accept");
+            return; // EMFILE and the like: the listener stays readable and we retry
+        }
+        struct connection *c = (struct connection *)malloc(sizeof(struct connection));
+        if (c == NULL)
+        {
+            perror("ERROR allocating a connection");
+            close(fd); // the client sees the connection close and can retry
+            continue;
+        }
+        c->fd = fd;
+        c->state = READ_NAME;
+        c->events = EPOLLIN;
+        initFileRequest(&c->req);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            perror("ERROR adding a connection to epoll");
+            close(fd);
+            free(c);
+            continue;
+        }
+        w->open++;
+    }
+}
+
+static void *workerLoop(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // the listener
+    epoll_ctl(w->epollFd, EPOLL_CTL_ADD, w->listenFd, &ev);
+
+    struct epoll_event events[MAXEVENTS];
+    time_t lastStats = time(NULL);
+    long lastFiles = 0;
+    for (;;)
+    {
+        int n = epoll_wait(w->epollFd, events, MAXEVENTS, 1000);
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == NULL)
+                acceptAll(w);
+            else if (events[i].events & EPOLLERR)
+                closeConnection(w, (struct connection *)events[i].data.ptr);
+            else
+                advance(w, (struct connection *)events[i].data.ptr);
+        }
+
+        if (time(NULL) - lastStats >= STATSINTERVAL && (w->open > 0 || w->files != lastFiles))
+        {
+            printf("Worker %d: %ld connections open, %ld files sent, %.1f MB\n", w->index, w->open, w->files, w->bytes / 1e6);
+            fflush(stdout);
+            lastStats = time(NULL);
+            lastFiles = w->files;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Prepares the process for many concurrent connections: ignores SIGPIPE and raises the
+ * descriptor limit
+ *
+ * @param workers requested number of event loops, 0 for one per core
+ * @return the number of event loops to run
+ */
+int prepareServerProcess(int workers)
+{
+    // A client that goes away mid-transfer must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Thousands of downloads need thousands of descriptors
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if (workers <= 0)
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return workers > 0 ? workers : 1;
+}
+
+/**
+ * Serves files on port with non-blocking sockets on epoll; does not return unless
+ * setting up fails
+ *
+ * @param backlog listen backlog of each listener
+ * @param workers event loops, each on its own thread and SO_REUSEPORT listener;
+ *        0 for one per core
+ * @param mode TRANSFER_COPY to send through a buffer, otherwise sendfile
+ * @param compressionLevel zlib level for clients that accept deflate; 0 never compresses
+ * @return -1 if the workers, a listener or a thread could not be set up
+ */
+int runEventServer(int port, int backlog, int workers, enum transferMode mode, int compressionLevel)
+{
+    workers = prepareServerProcess(workers);
+
+    struct worker *pool = (struct worker *)calloc(workers, sizeof(struct worker));
+    if (pool == NULL)
+    {
+        perror("ERROR allocating workers");
+        return -1;
+    }
+    for (int i = 0; i < workers; i++)
+    {
+        struct worker *w = &pool[i];
+        w->index = i;
+        w->port = port;
+        w->backlog = backlog;
+        w->reusePort = workers > 1;
+        w->mode = mode;
+        w->compressionLevel = compressionLevel;
+        w->listenFd = openListener(port, backlog, w->reusePort);
+        w->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (w->listenFd < 0 || w->epollFd < 0)
+        {
+            perror("ERROR setting up event loop");
+            return -1;
+        }
+    }
+
+    printf("Serving on port %d with %d event loop%s, backlog %d (%s transfers)\n", port, workers, workers > 1 ? "s" : "",
+           backlog, mode == TRANSFER_COPY ? "copy" : "sendfile");
+    fflush(stdout);
+
+    // Worker 0 runs on this thread
+    for (int i = 1; i < workers; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, workerLoop, &pool[i]) != 0)
+        {
+            perror("ERROR starting worker");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    workerLoop(&pool[0]);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef EVENT_SERVER_H
+#define EVENT_SERVER_H
+
+#include <stddef.h>
+#include "transfer.h"
+#include "compress.h"
+
+#define REQUESTBUFSIZE 4096 // Received request bytes kept per connection; also the longest request
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+// Request side of a connection, shared by the epoll and io_uring servers
+struct fileRequest
+{
+    char text[REQUESTBUFSIZE]; // bytes received: the current request and any pipelined behind it
+    size_t textLen;
+    size_t requestLen;         // bytes of the current request with its terminator
+    int persistent;            // the client keeps the connection for more requests
+    char header[64];           // size text, or the reply header on a persistent connection
+    size_t headerLen;
+    size_t headerSent;
+    int file;                  // -1 when the reply carries no data
+    off_t offset;              // next byte to send
+    long size;
+    long end;                  // end of the range asked for
+    int encoding;              // ENCODING_DEFLATE when the range is sent through deflate
+    struct deflateStream *deflate;
+};
+
+void initFileRequest(struct fileRequest *r);
+int takeFileRequest(struct fileRequest *r, int compressionLevel);
+int finishFileRequest(struct fileRequest *r);
+void closeFileRequest(struct fileRequest *r);
+int openListener(int port, int backlog, int reusePort);
+int prepareServerProcess(int workers);
+int runEventServer(int port, int backlog, int workers, enum transferMode mode, int compressionLevel);
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // EVENT_SERVER_H
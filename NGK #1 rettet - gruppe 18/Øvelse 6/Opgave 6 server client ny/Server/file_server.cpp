@@ -4,19 +4,31 @@ Based on example: https://www.linuxhowtos.org/C_C++/socket.htm
 
 Modified: Michael Alrøe
 Extended to support file server!
+File data is sent with sendfile/splice (see transfer.c); -m copy keeps the old read/write loop.
+With -e (or -w) clients are served concurrently on epoll instead of one at a time (see event_server.c),
+with -u through io_uring, falling back to epoll where the kernel lacks it (see uring_server.c).
+Clients that offer deflate get compressible files compressed on the fly (see compress.c).
+
+Build: g++ -O2 -pthread -o file_server file_server.cpp iknlib.c transfer.c event_server.c uring_server.c compress.c -lz
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/types.h> 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+#include <time.h>
 #include "iknlib.h"
+#include "transfer.h"
+#include "event_server.h"
+#include "uring_server.h"
+#include "compress.h"
 
 #define STRBUFSIZE 256 // Buffer size
-#define CHUNKSIZE 1000 // File transfer chunk size
 #define PORT 9000 //Port number
 
 void error(const char *msg) 
@@ -25,55 +37,198 @@ void error(const char *msg)
 	exit(1);
 }
 
-void sendFile(int clientSocket, const char* fileName, long fileSize)
+// Transfer settings, set from the command line
+static enum transferMode transferMode = TRANSFER_SENDFILE;
+static double progressInterval = 0; // seconds between progress lines, 0 = no progress
+static int compressionLevel = DEFAULTLEVEL; // zlib level for clients that accept deflate, 0 = never compress
+
+//Answers a request that has no data; without a persistent connection the client only sees it closed
+int sendStatus(int clientSocket, int status, int persistent)
 {
-	printf("Sending: %s, size: %li\n", fileName, fileSize);
+	if(!persistent)
+	{
+		return -1;
+	}
+	char header[64];
+	formatReplyHeader(header, sizeof(header), status, 0, 0, ENCODING_IDENTITY);
+	writeTextTCP(clientSocket, header);
+	return 0;
+}
 
-	// Opens the requested file in binary read mode:
-	FILE *file = fopen(fileName, "rb");
-	if(file==NULL)
+//Sends a file, or part of it; returns -1 if the connection cannot be used for another request
+int sendFile(int clientSocket, const char* fileName, long fileSize, long offset, long length, int encoding, int persistent)
+{
+	long count = clampRange(fileSize, &offset, length);
+	if(count == fileSize)
 	{
-		perror("ERROR: File not found");
-		return;
+		printf("Sending: %s, size: %li\n", fileName, fileSize);
+	}
+	else
+	{
+		printf("Sending: %s, size: %li, bytes %ld-%ld\n", fileName, fileSize, offset, offset + count);
 	}
 
-	// Sends file size to client:
-	char fileSizeStr[20];
-	snprintf(fileSizeStr, sizeof(fileSizeStr), "%ld\n", fileSize);
-	writeTextTCP(clientSocket,fileSizeStr);
+	// Opens the requested file for reading:
+	int file = open(fileName, O_RDONLY);
+	if(file<0)
+	{
+		perror("ERROR: File not found");
+		return sendStatus(clientSocket, REPLY_NOT_FOUND, persistent);
+	}
 
-	char buffer[CHUNKSIZE]; //buffer for file data
-	size_t bytesRead;
-	long totalBytesSent = 0;
+	// Compresses only when the client accepts it and the file is not in a compressed format, nor looks random:
+	struct deflateStream* stream = NULL;
+	if(encoding == ENCODING_DEFLATE && worthCompressing(file, offset, count, compressionLevel))
+	{
+		stream = openDeflateStream(file, offset, count, compressionLevel);
+	}
+	encoding = stream != NULL ? ENCODING_DEFLATE : ENCODING_IDENTITY;
 
-	// Reads the file in chunks and sends to the client:
-	while((bytesRead=fread(buffer, 1, CHUNKSIZE, file))>0)
+	// Sends file size (on a persistent connection the reply header) to client, in one packet with the data:
+	char header[64];
+	if(persistent)
+	{
+		formatReplyHeader(header, sizeof(header), REPLY_OK, count, fileSize, encoding);
+	}
+	else
+	{
+		formatSizeText(header, sizeof(header), fileSize, encoding);
+	}
+	size_t headerLen = strlen(header)+1;
+	if(send(clientSocket, header, headerLen, count > 0 ? MSG_MORE : 0) != (ssize_t)headerLen)
 	{
-		ssize_t bytesSent = 0;
+		perror("ERROR: Failed to send file size");
+		if(stream != NULL)
+		{
+			closeDeflateStream(stream);
+		}
+		close(file);
+		return -1;
+	}
 
-		while(bytesSent < bytesRead)
+	// Sends the file data, without copying it through this process unless the mode is copy or it is compressed:
+	struct timespec start, end;
+	long long wireBytes = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long totalBytesSent;
+	if(stream != NULL)
+	{
+		//The socket blocks, so a step only ends early on an error:
+		totalBytesSent = count;
+		while(totalBytesSent >= 0 && !deflateStreamDone(stream))
 		{
-			ssize_t result = write(clientSocket, buffer + bytesSent, bytesRead - bytesSent);
-			if(result < 0)
+			if(deflateStreamStep(stream, clientSocket, LONG_MAX) < 0)
 			{
-				perror("ERROR: Failed to send file");
-				fclose(file);
-				return;
+				totalBytesSent = -1;
 			}
-			bytesSent += result;
 		}
-		totalBytesSent += bytesSent;
-		printf("Sent %ld/%ld bytes\n", totalBytesSent, fileSize);
+		wireBytes = deflateStreamWireBytes(stream);
+		closeDeflateStream(stream);
 	}
-	
-	printf("File transfer complete: %s (%ld bytes sent)\n", fileName, totalBytesSent);
-	fclose(file);
+	else
+	{
+		totalBytesSent = sendFileData(clientSocket, file, offset, count, transferMode, progressInterval);
+		wireBytes = totalBytesSent;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if(totalBytesSent < 0)
+	{
+		perror("ERROR: Failed to send file");
+		close(file);
+		return -1;
+	}
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	if(encoding == ENCODING_DEFLATE)
+	{
+		printf("File transfer complete: %s (%ld bytes sent as %lld deflated, %.0f%%, in %.3f s, %.1f MB/s)\n", fileName,
+		       totalBytesSent, wireBytes, count > 0 ? 100.0 * wireBytes / count : 100.0, seconds,
+		       seconds > 0 ? totalBytesSent / seconds / 1e6 : 0.0);
+	}
+	else
+	{
+		printf("File transfer complete: %s (%ld bytes sent in %.3f s, %.1f MB/s)\n", fileName, totalBytesSent, seconds,
+		       seconds > 0 ? totalBytesSent / seconds / 1e6 : 0.0);
+	}
+	close(file);
+	return totalBytesSent == count ? 0 : -1; // a file that shrank breaks the framing
 }
 
+void usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-m sendfile|splice|copy] [-p seconds] [-b backlog] [-e | -u] [-w workers] [-z level]\n"
+	                "  -m  how file data is sent (default sendfile)\n"
+	                "  -p  print progress at most every N seconds (default 0: off)\n"
+	                "  -b  listen backlog (default 128)\n"
+	                "  -e  serve clients concurrently on epoll\n"
+	                "  -u  serve clients concurrently through io_uring (epoll if the kernel lacks it)\n"
+	                "  -w  event loop threads for -e or -u, 0 for one per core (default 1; implies -e)\n"
+	                "  -z  zlib level 1-9 for clients that accept deflate, 0 to never compress (default %d)\n", program, DEFAULTLEVEL);
+	exit(1);
+}
 
 int main(int argc, char *argv[])
 {
-	printf("Starting server...\n");
+	// Reads the transfer options:
+	int opt;
+	int backlog = 128;
+	int eventMode = 0;
+	int uringMode = 0;
+	int workers = 1;
+	while ((opt = getopt(argc, argv, "m:p:b:euw:z:")) != -1)
+	{
+		if (opt == 'm' && parseTransferMode(optarg, &transferMode) == 0)
+			continue;
+		if (opt == 'p')
+		{
+			progressInterval = atof(optarg);
+			continue;
+		}
+		if (opt == 'b' && atoi(optarg) > 0)
+		{
+			backlog = atoi(optarg);
+			continue;
+		}
+		if (opt == 'e')
+		{
+			eventMode = 1;
+			continue;
+		}
+		if (opt == 'u')
+		{
+			uringMode = 1;
+			continue;
+		}
+		if (opt == 'w' && atoi(optarg) >= 0)
+		{
+			eventMode = 1;
+			workers = atoi(optarg);
+			continue;
+		}
+		if (opt == 'z' && atoi(optarg) >= 0 && atoi(optarg) <= 9)
+		{
+			compressionLevel = atoi(optarg);
+			continue;
+		}
+		usage(argv[0]);
+	}
+
+	//Event modes: many clients at once, no per-client logging
+	if (uringMode && runUringServer(PORT, backlog, workers, transferMode) >= 0)
+	{
+		return 1;
+	}
+	if (eventMode || uringMode)
+	{
+		if (uringMode)
+		{
+			printf("Falling back to epoll\n");
+		}
+		runEventServer(PORT, backlog, workers, transferMode, compressionLevel);
+		return 1;
+	}
+
+	printf("Starting server (%s transfers)...\n", transferModeName(transferMode));
 
 	int sockfd, newsockfd, portno;
 
@@ -88,6 +243,10 @@ int main(int argc, char *argv[])
 		{
 			error("ERROR opening socket");
 		} 
+
+	//Lets a restarted server bind while old connections are still in TIME_WAIT
+	int reuse = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 		
 	printf("Binding...\n");
 	bzero((char *) &serv_addr, sizeof(serv_addr)); //Clears server address struct
@@ -103,7 +262,7 @@ int main(int argc, char *argv[])
 	}
 		
 	printf("Listening for incoming connections...\n");
-	listen(sockfd,5); //Allows up to 5 connections
+	listen(sockfd,backlog); //Queues up to backlog connections
 	
 	clilen = sizeof(cli_addr);
 
@@ -122,15 +281,48 @@ int main(int argc, char *argv[])
 			printf("Client connected\n");
 		}
 		
-		//Receives file name from client
-		bzero(bufferRx,sizeof(bufferRx));
-		readTextTCP(newsockfd,(char*)bufferRx,sizeof(bufferRx));
+		//Receives file requests from client; an empty request keeps the connection for more:
+		struct tcpReader reader;
+		initReaderTCP(&reader, newsockfd);
+		int persistent = 0;
+		int requests = 0;
+		while (readTextBufferedTCP(&reader,(char*)bufferRx,sizeof(bufferRx)) >= 0)
+		{
+			requests++;
+			if (bufferRx[0] == 0 && !persistent)
+			{
+				printf("Persistent connection\n");
+				persistent = 1;
+				sendStatus(newsockfd, REPLY_OK, persistent);
+				continue;
+			}
 
-		//Gets the file size:
-		long fileSize = getFilesize((char*)bufferRx);
+			//Splits off the byte range, if the client asked for one:
+			long offset, length;
+			int encoding;
+			int result;
+			if (parseFileRequest((char*)bufferRx, &offset, &length, &encoding) < 0)
+			{
+				printf("Malformed request: %s\n", (char*)bufferRx);
+				result = sendStatus(newsockfd, REPLY_BAD_REQUEST, persistent);
+			}
+			else
+			{
+				//Gets the file size:
+				long fileSize = getFilesize((char*)bufferRx);
 
-		//Sends the requested file to client:
-		sendFile(newsockfd,(char*)bufferRx,fileSize);
+				//Sends the requested file, or the requested part of it, to client:
+				result = sendFile(newsockfd,(char*)bufferRx,fileSize,offset,length,encoding,persistent);
+			}
+			if (result < 0 || !persistent)
+			{
+				break;
+			}
+		}
+		if (requests == 0)
+		{
+			printf("Client closed the connection before sending a file name\n");
+		}
 		
 		//Closes clients connections after transfer
 		close(newsockfd);
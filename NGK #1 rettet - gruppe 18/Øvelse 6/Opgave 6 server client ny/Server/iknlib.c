@@ -13,29 +13,40 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include "iknlib.h"
 
 /**
- * Read a null terminated text stream from a socket
+ * Read a null terminated text stream from a socket, one byte at a time so that
+ * nothing after the terminator is consumed. Use a tcpReader when more data follows.
  *
  * @param inSocket socket stream 
- * @param maxlength Maximun number of chars for string
+ * @param maxlength Size of text; longer texts are cut to maxLength-1 chars
  * @param text pointer for char array to hold received text 
+ * @return Length of the text, -1 if the connection closed or failed before the terminator
  */
-void readTextTCP(int inSocket, char* text, int maxLength )
+int readTextTCP(int inSocket, char* text, int maxLength )
 {
     char ch=0;
     int pos=0;
 
-    read(inSocket, &ch, 1);
-
-    while(ch != 0)
+    for(;;)
     {
-        if(pos < maxLength)
+        ssize_t n = read(inSocket, &ch, 1);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+        {
+            text[pos]=0;
+            return -1;
+        }
+        if(ch == 0)
+            break;
+        if(pos < maxLength-1)
             text[pos++] = ch;
-        read(inSocket, &ch, 1);
     }
     text[pos]=0;  // insert null termination
+    return pos;
 }
 
 /**
@@ -53,15 +64,287 @@ void writeTextTCP(int outSocket, const char* text)
  * Reads a string holding filesize from a socket, and converts to a number
  *
  * @param inSocket Socket for reading data
- * @return Filesize as a number
+ * @return Filesize as a number, -1 if the connection closed or failed
  */
 long readFileSizeTCP(int inSocket)
 {
     char buffer[256] = {0};
-    readTextTCP(inSocket, buffer, sizeof(buffer));
+    if(readTextTCP(inSocket, buffer, sizeof(buffer)) < 0)
+        return -1;
+    return atol(buffer);
+}
+
+/**
+ * Prepares a reader for a socket. The reader reads ahead in blocks of READERSIZE, so
+ * texts cost one read per block instead of one per character; bytes read past a text
+ * stay in the reader and are returned first by readBufferedTCP.
+ *
+ * @param reader Reader to prepare
+ * @param inSocket Socket for reading data
+ */
+void initReaderTCP(struct tcpReader* reader, int inSocket)
+{
+    reader->socket = inSocket;
+    reader->start = 0;
+    reader->end = 0;
+}
+
+/**
+ * Reads the next block into an empty reader
+ *
+ * @return Bytes read, 0 if the connection closed, -1 on error
+ */
+static ssize_t fillReaderTCP(struct tcpReader* reader)
+{
+    ssize_t n;
+    do
+        n = read(reader->socket, reader->buffer, sizeof(reader->buffer));
+    while(n < 0 && errno == EINTR);
+    reader->start = 0;
+    reader->end = n > 0 ? (size_t)n : 0;
+    return n;
+}
+
+/**
+ * Read a null terminated text through a reader
+ *
+ * @param reader Reader of the socket
+ * @param text pointer for char array to hold received text
+ * @param maxLength Size of text; longer texts are cut to maxLength-1 chars
+ * @return Length of the text, -1 if the connection closed or failed before the terminator
+ */
+int readTextBufferedTCP(struct tcpReader* reader, char* text, int maxLength)
+{
+    int pos=0;
+    for(;;)
+    {
+        if(reader->start == reader->end && fillReaderTCP(reader) <= 0)
+        {
+            text[pos]=0;
+            return -1;
+        }
+        const char* begin = reader->buffer + reader->start;
+        size_t available = reader->end - reader->start;
+        const char* terminator = (const char*)memchr(begin, 0, available);
+        size_t count = terminator != NULL ? (size_t)(terminator - begin) : available;
+
+        size_t room = (size_t)(maxLength-1-pos);
+        size_t copy = count < room ? count : room;
+        memcpy(text+pos, begin, copy);
+        pos += (int)copy;
+
+        if(terminator != NULL)
+        {
+            reader->start += count+1;
+            text[pos]=0;
+            return pos;
+        }
+        reader->start = reader->end;
+    }
+}
+
+/**
+ * Reads a string holding filesize through a reader, and converts to a number
+ *
+ * @param reader Reader of the socket
+ * @param encoding Set to the encoding of the data that follows (see formatSizeText); may be NULL
+ * @return Filesize as a number, -1 if the connection closed or failed
+ */
+long readFileSizeBufferedTCP(struct tcpReader* reader, int* encoding)
+{
+    char buffer[256] = {0};
+    if(readTextBufferedTCP(reader, buffer, sizeof(buffer)) < 0)
+        return -1;
+    if(encoding != NULL)
+        *encoding = parseEncoding(buffer);
     return atol(buffer);
 }
 
+/**
+ * Reads raw data through a reader: bytes already read ahead come first, after that
+ * large requests go straight from the socket into data.
+ *
+ * @param reader Reader of the socket
+ * @param data Buffer for the data
+ * @param size Size of data
+ * @return Bytes read (at most size), 0 if the connection closed, -1 on error
+ */
+ssize_t readBufferedTCP(struct tcpReader* reader, void* data, size_t size)
+{
+    if(reader->start == reader->end)
+    {
+        if(size >= sizeof(reader->buffer))
+        {
+            ssize_t n;
+            do
+                n = read(reader->socket, data, size);
+            while(n < 0 && errno == EINTR);
+            return n;
+        }
+        ssize_t n = fillReaderTCP(reader);
+        if(n <= 0)
+            return n;
+    }
+    size_t available = reader->end - reader->start;
+    size_t copy = available < size ? available : size;
+    memcpy(data, reader->buffer + reader->start, copy);
+    reader->start += copy;
+    return (ssize_t)copy;
+}
+
+/**
+ * Makes sure a reader holds unread bytes, reading from the socket only when it has none,
+ * so that a decoder can work on reader->buffer in place and advance reader->start itself
+ *
+ * @param reader Reader of the socket
+ * @return Unread bytes in the buffer, 0 if the connection closed, -1 on error
+ */
+ssize_t fillBufferedTCP(struct tcpReader* reader)
+{
+    if(reader->start == reader->end)
+        return fillReaderTCP(reader);
+    return (ssize_t)(reader->end - reader->start);
+}
+
+/**
+ * Builds a file request. A request is the file name, optionally followed by a newline
+ * and "offset" or "offset length" to ask for part of the file; the reply is the size
+ * of the whole file followed by only the bytes asked for. Encodings the client accepts
+ * follow the range as words, e.g. "0 deflate" for the whole file, compressed if the
+ * server sees a point in it.
+ *
+ * @param request char array for the request text
+ * @param maxLength Size of request
+ * @param fileName Name of the file
+ * @param offset First byte wanted
+ * @param length Number of bytes wanted, -1 for the rest of the file
+ * @param encoding ENCODING_DEFLATE to accept compressed data, ENCODING_IDENTITY otherwise
+ */
+void formatFileRequest(char* request, int maxLength, const char* fileName, long offset, long length, int encoding)
+{
+    const char* accept = encoding == ENCODING_DEFLATE ? " deflate" : "";
+    if(offset == 0 && length == -1 && encoding == ENCODING_IDENTITY)
+        snprintf(request, maxLength, "%s", fileName); // the plain request every server understands
+    else if(length == -1)
+        snprintf(request, maxLength, "%s\n%ld%s", fileName, offset, accept);
+    else
+        snprintf(request, maxLength, "%s\n%ld %ld%s", fileName, offset, length, accept);
+}
+
+/**
+ * Splits a file request into file name, byte range and accepted encoding (see formatFileRequest)
+ *
+ * @param request Request text; the range is cut off, leaving only the file name
+ * @param offset Set to the first byte wanted, 0 without a range
+ * @param length Set to the number of bytes wanted, -1 for the rest of the file (also when
+ *        the request says -1 or gives no length)
+ * @param encoding Set to ENCODING_DEFLATE if the client accepts it; unknown encodings are ignored
+ * @return 0, or -1 if the range is malformed or the length is negative but not -1
+ */
+int parseFileRequest(char* request, long* offset, long* length, int* encoding)
+{
+    *offset = 0;
+    *length = -1;
+    *encoding = ENCODING_IDENTITY;
+    char* range = strchr(request, '\n');
+    if(range == NULL)
+        return 0;
+    *range++ = 0;
+
+    char* end;
+    *offset = strtol(range, &end, 10);
+    if(end == range || *offset < 0)
+        return -1;
+    if(end[0] == ' ' && ((end[1] >= '0' && end[1] <= '9') || end[1] == '-'))
+    {
+        range = end+1;
+        *length = strtol(range, &end, 10);
+        if(end == range || *length < -1)
+            return -1;
+    }
+    if(*end != 0 && *end != ' ')
+        return -1;
+    *encoding = parseEncoding(end);
+    return 0;
+}
+
+/**
+ * Looks for an encoding among the words of a request range, size text or reply header
+ *
+ * @param text Words separated by spaces or newlines
+ * @return ENCODING_DEFLATE if one of the words is "deflate", ENCODING_IDENTITY otherwise
+ */
+int parseEncoding(const char* text)
+{
+    while(*text != 0)
+    {
+        size_t length = strcspn(text, " \n");
+        if(length == 7 && strncmp(text, "deflate", length) == 0)
+            return ENCODING_DEFLATE;
+        text += length;
+        text += strspn(text, " \n");
+    }
+    return ENCODING_IDENTITY;
+}
+
+/**
+ * Fits a requested range to a file
+ *
+ * @param fileSize Size of the file
+ * @param offset First byte wanted; moved to the end of the file if it lies beyond
+ * @param length Number of bytes wanted, negative for the rest of the file
+ * @return Number of bytes to send
+ */
+long clampRange(long fileSize, long* offset, long length)
+{
+    if(*offset > fileSize)
+        *offset = fileSize;
+    long available = fileSize - *offset;
+    return length < 0 || length > available ? available : length;
+}
+
+/**
+ * Builds the size text that starts a reply when the connection is not persistent
+ *
+ * @param text char array for the size text
+ * @param maxLength Size of text
+ * @param fileSize Size of the whole file
+ * @param encoding ENCODING_DEFLATE if the data that follows is compressed
+ */
+void formatSizeText(char* text, int maxLength, long fileSize, int encoding)
+{
+    snprintf(text, maxLength, "%ld%s\n", fileSize, encoding == ENCODING_DEFLATE ? " deflate" : "");
+}
+
+/**
+ * Builds the header of a reply on a persistent connection
+ *
+ * @param header char array for the header text
+ * @param maxLength Size of header
+ * @param status REPLY_OK, or why there is no data
+ * @param length Number of file bytes the reply carries; with ENCODING_DEFLATE they
+ *        follow as one deflate stream, which ends itself
+ * @param fileSize Size of the whole file
+ * @param encoding Encoding of the data that follows the header
+ */
+void formatReplyHeader(char* header, int maxLength, int status, long length, long fileSize, int encoding)
+{
+    snprintf(header, maxLength, "%d %ld %ld%s\n", status, length, fileSize, encoding == ENCODING_DEFLATE ? " deflate" : "");
+}
+
+/**
+ * Reads the header of a reply on a persistent connection (see formatReplyHeader)
+ *
+ * @return 0, or -1 if the header is malformed
+ */
+int parseReplyHeader(const char* header, int* status, long* length, long* fileSize, int* encoding)
+{
+    if(sscanf(header, "%d %ld %ld", status, length, fileSize) != 3 || *length < 0)
+        return -1;
+    *encoding = parseEncoding(header);
+    return 0;
+}
+
 /**
  * Extracts a filename from a text string
  *
@@ -3,14 +3,49 @@
 
 #define PORT 9000
 #define BUFSIZE 1000
+#define READERSIZE (64 * 1024) // Read-ahead block of a tcpReader
+
+// Reply statuses on a persistent connection. An empty request asks the server to
+// keep the connection; after that every reply starts with a header from formatReplyHeader.
+#define REPLY_OK 200
+#define REPLY_BAD_REQUEST 400
+#define REPLY_NOT_FOUND 404
+
+// Encodings of the file data. A client may offer "deflate" in its request; the server
+// answers with the encoding it chose, naming it after the size or in the reply header.
+#define ENCODING_IDENTITY 0
+#define ENCODING_DEFLATE 1
+
+#include <sys/types.h>
 
 #ifdef __cplusplus
     extern "C" {
 #endif
 
-void readTextTCP(int inSocket, char* text, int maxLength);
+// Reads a socket in large blocks; see initReaderTCP
+struct tcpReader
+{
+    int socket;
+    size_t start;   // first unread byte in buffer
+    size_t end;     // end of the bytes read ahead
+    char buffer[READERSIZE];
+};
+
+int readTextTCP(int inSocket, char* text, int maxLength);
 void writeTextTCP(int outSocket, const char* text);
 long readFileSizeTCP(int inSocket);
+void initReaderTCP(struct tcpReader* reader, int inSocket);
+int readTextBufferedTCP(struct tcpReader* reader, char* text, int maxLength);
+long readFileSizeBufferedTCP(struct tcpReader* reader, int* encoding);
+ssize_t readBufferedTCP(struct tcpReader* reader, void* data, size_t size);
+ssize_t fillBufferedTCP(struct tcpReader* reader);
+void formatFileRequest(char* request, int maxLength, const char* fileName, long offset, long length, int encoding);
+int parseFileRequest(char* request, long* offset, long* length, int* encoding);
+int parseEncoding(const char* text);
+long clampRange(long fileSize, long* offset, long length);
+void formatSizeText(char* text, int maxLength, long fileSize, int encoding);
+void formatReplyHeader(char* header, int maxLength, int status, long length, long fileSize, int encoding);
+int parseReplyHeader(const char* header, int* status, long* length, long* fileSize, int* encoding);
 const char* extractFileName(const char* text);
 long getFilesize(const char* fileName);
 
@@ -0,0 +1,291 @@
+/*
+ * transfer.c
+ *
+ * Sends file data to a socket without copying it through user space:
+ * sendfile(2) where the kernel supports it for the file, splice(2) through
+ * a pipe otherwise. The original read/write loop is kept as TRANSFER_COPY
+ * for comparison.
+ *
+ * Build: g++ -O2 -pthread -o file_server file_server.cpp iknlib.c transfer.c event_server.c uring_server.c compress.c -lz
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // splice, F_SETPIPE_SZ
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include "transfer.h"
+
+#define COPYCHUNKSIZE 1000      // Buffer of the original loop
+#define MAXSENDCHUNK (1L << 30) // Largest request per sendfile/splice call
+#define PIPESIZE (1 << 20)      // Pipe capacity asked for by the splice path
+
+#define TRANSFER_UNSUPPORTED (-2)
+
+/* Progress output, at most once per interval seconds; 0 turns it off */
+struct progress
+{
+    double interval;
+    double start;
+    double last;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void reportProgress(struct progress* p, long sent, long total)
+{
+    if (p->interval <= 0)
+        return;
+    double t = now();
+    if (t - p->last < p->interval && sent < total)
+        return;
+    p->last = t;
+    double elapsed = t - p->start;
+    printf("Sent %ld/%ld bytes (%.0f%%, %.1f MB/s)\n", sent, total,
+           total > 0 ? 100.0 * sent / total : 100.0,
+           elapsed > 0 ? sent / elapsed / 1e6 : 0.0);
+}
+
+/**
+ * Sends size bytes of a file with sendfile(2)
+ *
+ * @return Bytes sent, -1 on error, TRANSFER_UNSUPPORTED if nothing was sent because
+ *         the kernel cannot sendfile from this file
+ */
+static long sendWithSendfile(int outSocket, int fileFd, long start, long size, struct progress* p)
+{
+    off_t offset = start;
+    long sent = 0;
+    while (sent < size)
+    {
+        long want = size - sent < MAXSENDCHUNK ? size - sent : MAXSENDCHUNK;
+        ssize_t n = sendfile(outSocket, fileFd, &offset, want);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (sent == 0 && (errno == EINVAL || errno == ENOSYS))
+                return TRANSFER_UNSUPPORTED;
+            return -1;
+        }
+        if (n == 0)
+            break; // file shrank
+        sent += n;
+        reportProgress(p, sent, size);
+    }
+    return sent;
+}
+
+/**
+ * Sends size bytes of a file with splice(2): file -> pipe -> socket
+ *
+ * @return Bytes sent, -1 on error, TRANSFER_UNSUPPORTED if splice cannot be used
+ */
+static long sendWithSplice(int outSocket, int fileFd, long start, long size, struct progress* p)
+{
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) < 0)
+        return -1;
+    fcntl(pipeFds[1], F_SETPIPE_SZ, PIPESIZE); // a bigger pipe means fewer calls; best effort
+
+    loff_t offset = start;
+    long sent = 0;
+    long result = 0;
+    while (sent < size)
+    {
+        long want = size - sent < MAXSENDCHUNK ? size - sent : MAXSENDCHUNK;
+        ssize_t inPipe = splice(fileFd, &offset, pipeFds[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (inPipe < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            result = (sent == 0 && (errno == EINVAL || errno == ENOSYS)) ? TRANSFER_UNSUPPORTED : -1;
+            break;
+        }
+        if (inPipe == 0)
+            break; // file shrank
+
+        // Everything put in the pipe must reach the socket before the next read
+        while (inPipe > 0)
+        {
+            ssize_t out = splice(pipeFds[0], NULL, outSocket, NULL, inPipe, SPLICE_F_MOVE | (sent + inPipe < size ? SPLICE_F_MORE : 0));
+            if (out < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                result = -1;
+                break;
+            }
+            inPipe -= out;
+            sent += out;
+        }
+        if (result < 0)
+            break;
+        reportProgress(p, sent, size);
+    }
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    return result < 0 ? result : sent;
+}
+
+/**
+ * Sends size bytes of a file through a user-space buffer
+ *
+ * @return Bytes sent, -1 on error
+ */
+static long sendWithCopy(int outSocket, int fileFd, long start, long size, struct progress* p)
+{
+    char buffer[COPYCHUNKSIZE];
+    long sent = 0;
+    if (lseek(fileFd, start, SEEK_SET) < 0)
+        return -1;
+    while (sent < size)
+    {
+        ssize_t bytesRead = read(fileFd, buffer, size - sent < COPYCHUNKSIZE ? size - sent : COPYCHUNKSIZE);
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (bytesRead == 0)
+            break;
+        ssize_t bytesSent = 0;
+        while (bytesSent < bytesRead)
+        {
+            ssize_t result = write(outSocket, buffer + bytesSent, bytesRead - bytesSent);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            bytesSent += result;
+        }
+        sent += bytesSent;
+        reportProgress(p, sent, size);
+    }
+    return sent;
+}
+
+/**
+ * Parses "sendfile", "splice" or "copy"
+ *
+ * @return 0 on success, -1 for an unknown name
+ */
+int parseTransferMode(const char* name, enum transferMode* mode)
+{
+    if (strcmp(name, "sendfile") == 0)
+        *mode = TRANSFER_SENDFILE;
+    else if (strcmp(name, "splice") == 0)
+        *mode = TRANSFER_SPLICE;
+    else if (strcmp(name, "copy") == 0)
+        *mode = TRANSFER_COPY;
+    else
+        return -1;
+    return 0;
+}
+
+const char* transferModeName(enum transferMode mode)
+{
+    switch (mode)
+    {
+    case TRANSFER_SENDFILE: return "sendfile";
+    case TRANSFER_SPLICE: return "splice";
+    default: return "copy";
+    }
+}
+
+/**
+ * Sends length bytes of a file, from offset on, to a socket.
+ * sendfile falls back to splice, and splice to the copy loop, when the kernel
+ * cannot use them for this file.
+ *
+ * @param outSocket connected socket
+ * @param fileFd file opened for reading
+ * @param offset first byte to send
+ * @param length number of bytes to send
+ * @param mode preferred transfer mode
+ * @param progressInterval seconds between progress lines; 0 for none
+ * @return Bytes sent, or -1 on error (errno is set)
+ */
+long sendFileData(int outSocket, int fileFd, long offset, long length, enum transferMode mode, double progressInterval)
+{
+    struct progress p;
+    p.interval = progressInterval;
+    p.start = p.last = now();
+
+    long sent = TRANSFER_UNSUPPORTED;
+    if (mode == TRANSFER_SENDFILE)
+        sent = sendWithSendfile(outSocket, fileFd, offset, length, &p);
+    if (sent == TRANSFER_UNSUPPORTED && mode != TRANSFER_COPY)
+        sent = sendWithSplice(outSocket, fileFd, offset, length, &p);
+    if (sent == TRANSFER_UNSUPPORTED)
+        sent = sendWithCopy(outSocket, fileFd, offset, length, &p);
+    return sent;
+}
+
+/**
+ * Sends as much of a file as a non-blocking socket takes now, from *offset on.
+ * Used by the event-driven server: nothing is kept between calls, so splice
+ * (which would leave data in its pipe) is not used and the copy path re-reads
+ * with pread from the new offset.
+ *
+ * @param offset position of the next byte to send; advanced past what was sent
+ * @param fileSize end of the data to send, the file size unless a range was asked for
+ * @param maxBytes most bytes to send in this call, so that one fast client cannot
+ *        keep an event loop from its other connections
+ * @return Bytes sent, 0 when the socket is full, -1 on error (errno is set)
+ */
+long sendFileStep(int outSocket, int fileFd, off_t* offset, long fileSize, long maxBytes, enum transferMode mode)
+{
+    long sent = 0;
+    int useCopy = mode == TRANSFER_COPY;
+    while (*offset < fileSize && sent < maxBytes)
+    {
+        long want = fileSize - *offset < maxBytes - sent ? fileSize - *offset : maxBytes - sent;
+        ssize_t n;
+        if (!useCopy)
+        {
+            n = sendfile(outSocket, fileFd, offset, want);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+            {
+                useCopy = 1;
+                continue;
+            }
+        }
+        else
+        {
+            char buffer[COPYCHUNKSIZE];
+            n = pread(fileFd, buffer, want < COPYCHUNKSIZE ? want : COPYCHUNKSIZE, *offset);
+            if (n > 0)
+                n = write(outSocket, buffer, n);
+            if (n > 0)
+                *offset += n;
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        if (n == 0)
+        {
+            errno = EIO; // file shrank under us
+            return -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
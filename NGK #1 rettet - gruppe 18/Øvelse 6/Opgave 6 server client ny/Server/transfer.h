@@ -0,0 +1,27 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+/* How file data is moved from disk to the socket */
+enum transferMode
+{
+    TRANSFER_SENDFILE, /* sendfile(2): the kernel copies page cache -> socket, no user buffer */
+    TRANSFER_SPLICE,   /* splice(2) through a pipe; used when sendfile is not supported */
+    TRANSFER_COPY      /* read(2) + write(2) through a 1000-byte buffer (the original loop) */
+};
+
+int parseTransferMode(const char* name, enum transferMode* mode);
+const char* transferModeName(enum transferMode mode);
+long sendFileData(int outSocket, int fileFd, long offset, long length, enum transferMode mode, double progressInterval);
+long sendFileStep(int outSocket, int fileFd, off_t* offset, long fileSize, long maxBytes, enum transferMode mode);
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // TRANSFER_H
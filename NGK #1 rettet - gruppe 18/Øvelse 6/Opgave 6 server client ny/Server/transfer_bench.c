@@ -0,0 +1,178 @@
+/*
+ * transfer_bench.c
+ *
+ * Loopback throughput of the file server's transfer modes. For each file size the
+ * file is sent over a TCP connection to 127.0.0.1 with copy (the original 1000-byte
+ * read/write loop, without its per-chunk printf), splice and sendfile, while a
+ * reader thread discards what arrives. Small files are sent repeatedly so that
+ * every run moves at least 256 MB. The file is read once beforehand, so all modes
+ * read from the page cache.
+ *
+ * Build: gcc -O2 -pthread -o transfer_bench transfer_bench.c transfer.c
+ * Usage: ./transfer_bench [maxMB] [dir]
+ *        sizes 1 MB, 10 MB, 100 MB, 1 GB and 10 GB up to maxMB (default 1024),
+ *        test file written in dir (default /tmp)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "transfer.h"
+
+#define BLOCKSIZE (1 << 20)
+#define MINRUNBYTES (256L << 20)
+
+void error(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double threadCpu(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_THREAD, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+struct reader
+{
+	int listenFd;
+	long received;
+};
+
+// Accepts one connection and reads it to the end
+static void *readAll(void *arg)
+{
+	struct reader *r = (struct reader *)arg;
+	int fd = accept(r->listenFd, NULL, NULL);
+	if (fd < 0)
+		error("ERROR on accept");
+	char *buffer = (char *)malloc(BLOCKSIZE);
+	ssize_t n;
+	while ((n = read(fd, buffer, BLOCKSIZE)) > 0)
+		r->received += n;
+	free(buffer);
+	close(fd);
+	return NULL;
+}
+
+// Writes size bytes of pseudo-random data, so nothing along the way can shortcut zeros
+static void writeTestFile(const char *path, long size)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		error("ERROR creating test file");
+	unsigned *block = (unsigned *)malloc(BLOCKSIZE);
+	unsigned x = 2463534242u;
+	for (long written = 0; written < size; written += BLOCKSIZE)
+	{
+		for (size_t i = 0; i < BLOCKSIZE / sizeof(unsigned); i++)
+		{
+			x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+			block[i] = x;
+		}
+		long n = size - written < BLOCKSIZE ? size - written : BLOCKSIZE;
+		if (write(fd, block, n) != n)
+			error("ERROR writing test file");
+	}
+	free(block);
+	close(fd);
+}
+
+// Sends the file repeats times over one loopback connection; returns MB/s and sender CPU s/GB
+static void run(int listenFd, const struct sockaddr_in *addr, int fileFd, long size, int repeats,
+                enum transferMode mode, double *mbps, double *cpuPerGB)
+{
+	struct reader r = { listenFd, 0 };
+	pthread_t thread;
+	pthread_create(&thread, NULL, readAll, &r);
+
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+		error("ERROR connecting");
+
+	double start = now(), cpuStart = threadCpu();
+	for (int i = 0; i < repeats; i++)
+	{
+		lseek(fileFd, 0, SEEK_SET);
+		if (sendFileData(sock, fileFd, 0, size, mode, 0) != size)
+			error("ERROR sending");
+	}
+	double cpu = threadCpu() - cpuStart;
+	close(sock);
+	pthread_join(thread, NULL);
+	double seconds = now() - start;
+
+	if (r.received != size * repeats)
+	{
+		fprintf(stderr, "ERROR: received %ld of %ld bytes\n", r.received, size * repeats);
+		exit(1);
+	}
+	*mbps = r.received / seconds / 1e6;
+	*cpuPerGB = cpu / (r.received / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+	long maxMB = argc > 1 ? atol(argv[1]) : 1024;
+	const char *dir = argc > 2 ? argv[2] : "/tmp";
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/transfer_bench.dat", dir);
+
+	int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addrLen = sizeof(addr);
+	if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd, 16) < 0 ||
+	    getsockname(listenFd, (struct sockaddr *)&addr, &addrLen) < 0)
+		error("ERROR on loopback listener");
+
+	const long sizesMB[] = { 1, 10, 100, 1024, 10240 };
+	const enum transferMode modes[] = { TRANSFER_COPY, TRANSFER_SPLICE, TRANSFER_SENDFILE };
+
+	printf("%10s %10s %10s %14s %10s\n", "size", "mode", "MB/s", "CPU s/GB", "speedup");
+	for (size_t s = 0; s < sizeof(sizesMB) / sizeof(sizesMB[0]) && sizesMB[s] <= maxMB; s++)
+	{
+		long size = sizesMB[s] << 20;
+		int repeats = size >= MINRUNBYTES ? 1 : (int)(MINRUNBYTES / size);
+		writeTestFile(path, size);
+		int fileFd = open(path, O_RDONLY);
+		if (fileFd < 0)
+			error("ERROR opening test file");
+		posix_fadvise(fileFd, 0, 0, POSIX_FADV_WILLNEED);
+
+		double baseline = 0;
+		for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+		{
+			double mbps, cpuPerGB;
+			run(listenFd, &addr, fileFd, size, repeats, modes[m], &mbps, &cpuPerGB);
+			if (m == 0)
+				baseline = mbps;
+			printf("%8ld MB %10s %10.0f %14.3f %9.1fx\n", sizesMB[s], transferModeName(modes[m]), mbps, cpuPerGB, mbps / baseline);
+			fflush(stdout);
+		}
+		close(fileFd);
+	}
+	unlink(path);
+	close(listenFd);
+	return 0;
+}
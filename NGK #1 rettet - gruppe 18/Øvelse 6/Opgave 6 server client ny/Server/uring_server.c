@@ -0,0 +1,591 @@
+/*
+ * uring_server.c
+ *
+ * io_uring mode of the file server, for the nodes that move the most data. Accepts,
+ * reads of the requests and all file data go through one submission ring per worker,
+ * so a busy loop enters the kernel once per batch of completions rather than once per
+ * operation. The protocol, persistent connections included, and the connection states
+ * are those of event_server.c; clients that offer deflate get the data uncompressed.
+ *
+ * File data moves in chunks of two linked operations:
+ *   sendfile/splice modes: SPLICE file -> pipe, then SPLICE pipe -> socket, so the data
+ *                          is never copied through this process
+ *   copy mode:             READ_FIXED into a registered buffer, then SEND_ZC from it
+ *                          (plain SEND on kernels without zero-copy send)
+ * When the first operation of a chunk comes up short the kernel cancels the second, and
+ * the connection sends what it got before reading on.
+ *
+ * Talks to the kernel with the raw system calls, so liburing is not needed.
+ * runUringServer returns -1 when the kernel lacks io_uring or one of the operations used
+ * here, and the caller falls back to epoll.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // pipe2, F_SETPIPE_SZ
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "uring_server.h"
+#include "event_server.h"
+
+#define RINGENTRIES 1024       // Submission queue entries per worker
+#define ACCEPTS 16             // Accepts kept in flight per worker
+#define PIPESIZE (256 << 10)   // Splice chunk, if the pipe can be made that large
+#define BUFFERSIZE (64 << 10)  // Copy mode chunk
+#define BUFFERSLOTS 64         // Registered copy buffers per worker
+#define ZEROCOPYMIN (16 << 10) // Smaller sends are copied: waiting for the notification costs more
+#define STATSINTERVAL 10       // Seconds between statistics lines
+
+// What a completion is for; kept in the low bits of user_data, the rest is the connection
+enum uringOp { OP_ACCEPT, OP_RETRY_ACCEPT, OP_TICK, OP_RECV_NAME, OP_SEND_SIZE, OP_FILL, OP_DRAIN };
+#define OPMASK 7
+
+enum connState { READ_NAME, SEND_SIZE, SEND_DATA };
+
+struct connection
+{
+    int fd;
+    enum connState state;
+    int pending; // operations in flight; a zero-copy send counts until its notification
+    int failed;
+    struct fileRequest req; // req.offset counts the file bytes read into the pipe or buffer
+    long filled;  // bytes of the current chunk in the pipe or buffer
+    long drained; // of which sent
+    int pipe[2];
+    long chunk;   // pipe or buffer size
+    int slot;     // registered buffer, -1 if none
+    char *buffer;
+};
+
+struct ring
+{
+    int fd;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned localTail; // sqes filled in, published to the kernel on enter
+    unsigned toSubmit;
+    void *sqMap, *cqMap; // the mappings, for ringTeardown
+    size_t sqMapSize, cqMapSize, sqesSize;
+};
+
+struct worker
+{
+    int index;
+    int listenFd;
+    enum transferMode mode;
+    int zeroCopy; // SEND_ZC is supported
+    struct ring ring;
+    char *buffers; // BUFFERSLOTS registered buffers of BUFFERSIZE
+    int freeSlots[BUFFERSLOTS];
+    int freeCount;
+    struct __kernel_timespec retryDelay; // timeouts read these when submitted
+    struct __kernel_timespec tickDelay;
+    long open;       // connections open now
+    long files;      // files sent completely
+    long long bytes; // file bytes sent
+    long lastFiles;
+};
+
+// Unmaps a ring set up, fully or partly, by ringSetup and closes it
+static void ringTeardown(struct ring *r)
+{
+    if (r->sqes != NULL)
+        munmap(r->sqes, r->sqesSize);
+    if (r->cqMap != NULL)
+        munmap(r->cqMap, r->cqMapSize);
+    if (r->sqMap != NULL)
+        munmap(r->sqMap, r->sqMapSize);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+static int ringSetup(struct ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cqSize > sqSize)
+        sqSize = cqSize;
+    char *sq = (char *)mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    char *cq = single ? sq : (char *)mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = (struct io_uring_sqe *)mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    r->sqMap = sq == MAP_FAILED ? NULL : sq;
+    r->sqMapSize = sqSize;
+    r->cqMap = cq == MAP_FAILED || single ? NULL : cq;
+    r->cqMapSize = cqSize;
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (r->sqes == MAP_FAILED)
+        r->sqes = NULL;
+    if (sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == NULL)
+    {
+        ringTeardown(r);
+        return -1;
+    }
+
+    r->sqHead = (unsigned *)(sq + p.sq_off.head);
+    r->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    r->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sqArray = (unsigned *)(sq + p.sq_off.array);
+    r->cqHead = (unsigned *)(cq + p.cq_off.head);
+    r->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    r->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->localTail = *r->sqTail;
+    return 0;
+}
+
+// Submits what is queued and, with wait, blocks until at least one completion is ready
+static int ringEnter(struct ring *r, unsigned wait)
+{
+    __atomic_store_n(r->sqTail, r->localTail, __ATOMIC_RELEASE);
+    if (r->toSubmit == 0 && wait == 0)
+        return 0;
+    int submitted = (int)syscall(__NR_io_uring_enter, r->fd, r->toSubmit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted < 0)
+        return errno == EINTR ? 0 : -1;
+    r->toSubmit -= submitted;
+    return 0;
+}
+
+static struct io_uring_sqe *getSqe(struct ring *r, int opcode, int fd, struct connection *c, enum uringOp op)
+{
+    if (r->localTail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE) > *r->sqMask)
+        ringEnter(r, 0); // submission queue full: hand it to the kernel first
+    unsigned index = r->localTail & *r->sqMask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t)opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uint64_t)(uintptr_t)c | op;
+    r->sqArray[index] = index;
+    r->localTail++;
+    r->toSubmit++;
+    return sqe;
+}
+
+static int probeOps(int ringFd, int *zeroCopy)
+{
+    static const int needed[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_SPLICE,
+                                  IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_TIMEOUT };
+    size_t size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+    *zeroCopy = 0;
+    if (probe == NULL)
+        return -1;
+    int result = (int)syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST);
+    for (size_t i = 0; result == 0 && i < sizeof(needed) / sizeof(needed[0]); i++)
+        if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+            result = -1;
+    *zeroCopy = IORING_OP_SEND_ZC <= probe->last_op && (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return result;
+}
+
+static void queueAccept(struct worker *w)
+{
+    struct io_uring_sqe *sqe = getSqe(&w->ring, IORING_OP_ACCEPT, w->listenFd, NULL, OP_ACCEPT);
+    sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+static void queueTimeout(struct worker *w, struct __kernel_timespec *delay, enum uringOp op)
+{
+    struct io_uring_sqe *sqe = getSqe(&w->ring, IORING_OP_TIMEOUT, -1, NULL, op);
+    sqe->addr = (uint64_t)(uintptr_t)delay;
+    sqe->len = 1;
+}
+
+static void closeConnection(struct worker *w, struct connection *c)
+{
+    close(c->fd);
+    closeFileRequest(&c->req);
+    if (c->pipe[0] >= 0)
+    {
+        close(c->pipe[0]);
+        close(c->pipe[1]);
+    }
+    if (c->slot >= 0)
+        w->freeSlots[w->freeCount++] = c->slot;
+    else
+        free(c->buffer);
+    free(c);
+    w->open--;
+}
+
+// Gets a pipe (splice) or a buffer (copy) for the file data; a persistent connection keeps it
+static int startData(struct worker *w, struct connection *c)
+{
+    if (c->chunk > 0)
+        return 0;
+    if (w->mode != TRANSFER_COPY)
+    {
+        if (pipe2(c->pipe, O_CLOEXEC) < 0)
+            return -1;
+        fcntl(c->pipe[1], F_SETPIPE_SZ, PIPESIZE); // a smaller pipe only means smaller chunks
+        c->chunk = fcntl(c->pipe[1], F_GETPIPE_SZ);
+        return c->chunk > 0 ? 0 : -1;
+    }
+    c->chunk = BUFFERSIZE;
+    if (w->freeCount > 0)
+    {
+        c->slot = w->freeSlots[--w->freeCount];
+        c->buffer = w->buffers + (size_t)c->slot * BUFFERSIZE;
+        return 0;
+    }
+    c->buffer = (char *)malloc(BUFFERSIZE); // all registered buffers taken
+    return c->buffer != NULL ? 0 : -1;
+}
+
+// Queues the send of the current chunk's unsent bytes; linked to a fill queued just before
+static void queueDrain(struct worker *w, struct connection *c, long length)
+{
+    struct io_uring_sqe *sqe;
+    if (w->mode != TRANSFER_COPY)
+    {
+        sqe = getSqe(&w->ring, IORING_OP_SPLICE, c->fd, c, OP_DRAIN);
+        sqe->splice_fd_in = c->pipe[0];
+        sqe->splice_off_in = (uint64_t)-1;
+        sqe->off = (uint64_t)-1;
+        sqe->splice_flags = SPLICE_F_MOVE;
+    }
+    else
+    {
+        int zeroCopy = w->zeroCopy && length >= ZEROCOPYMIN;
+        sqe = getSqe(&w->ring, zeroCopy ? IORING_OP_SEND_ZC : IORING_OP_SEND, c->fd, c, OP_DRAIN);
+        sqe->addr = (uint64_t)(uintptr_t)(c->buffer + c->drained);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        if (zeroCopy && c->slot >= 0)
+        {
+            sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+            sqe->buf_index = (uint16_t)c->slot;
+        }
+    }
+    sqe->len = (uint32_t)length;
+    c->pending++;
+}
+
+// Queues a linked fill and drain of the next chunk
+static void queueChunk(struct worker *w, struct connection *c)
+{
+    struct fileRequest *r = &c->req;
+    long length = r->end - r->offset < c->chunk ? r->end - r->offset : c->chunk;
+    struct io_uring_sqe *sqe;
+    if (w->mode != TRANSFER_COPY)
+    {
+        sqe = getSqe(&w->ring, IORING_OP_SPLICE, c->pipe[1], c, OP_FILL);
+        sqe->splice_fd_in = r->file;
+        sqe->splice_off_in = (uint64_t)r->offset;
+        sqe->off = (uint64_t)-1;
+        sqe->splice_flags = SPLICE_F_MOVE;
+    }
+    else
+    {
+        sqe = getSqe(&w->ring, c->slot >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ, r->file, c, OP_FILL);
+        sqe->addr = (uint64_t)(uintptr_t)c->buffer;
+        sqe->off = (uint64_t)r->offset;
+        if (c->slot >= 0)
+            sqe->buf_index = (uint16_t)c->slot;
+    }
+    sqe->len = (uint32_t)length;
+    sqe->flags = IOSQE_IO_LINK;
+    c->pending++;
+    c->filled = c->drained = 0;
+    queueDrain(w, c, length);
+}
+
+// Queues the next step of a connection once everything it had in flight has completed
+static void advance(struct worker *w, struct connection *c)
+{
+    struct fileRequest *r = &c->req;
+    if (c->failed)
+        return closeConnection(w, c);
+
+    if (c->state == READ_NAME)
+    {
+        // A pipelining client may have sent the next request along with the last one.
+        // Data always leaves the file in the kernel here, so deflate is never chosen.
+        int result = takeFileRequest(r, 0);
+        if (result < 0)
+            return closeConnection(w, c);
+        if (result > 0)
+        {
+            c->state = SEND_SIZE;
+            return advance(w, c);
+        }
+        struct io_uring_sqe *sqe = getSqe(&w->ring, IORING_OP_RECV, c->fd, c, OP_RECV_NAME);
+        sqe->addr = (uint64_t)(uintptr_t)(r->text + r->textLen);
+        sqe->len = (uint32_t)(sizeof(r->text) - 1 - r->textLen);
+        c->pending++;
+    }
+    else if (c->state == SEND_SIZE && r->headerSent < r->headerLen)
+    {
+        struct io_uring_sqe *sqe = getSqe(&w->ring, IORING_OP_SEND, c->fd, c, OP_SEND_SIZE);
+        sqe->addr = (uint64_t)(uintptr_t)(r->header + r->headerSent);
+        sqe->len = (uint32_t)(r->headerLen - r->headerSent);
+        sqe->msg_flags = MSG_NOSIGNAL | (r->offset < r->end ? MSG_MORE : 0); // one packet with the data
+        c->pending++;
+    }
+    else if (c->state == SEND_SIZE)
+    {
+        c->state = SEND_DATA;
+        if (r->offset < r->end && startData(w, c) < 0)
+            return closeConnection(w, c);
+        advance(w, c);
+    }
+    else if (c->drained < c->filled)
+        queueDrain(w, c, c->filled - c->drained); // the socket took part of the chunk
+    else if (r->offset < r->end)
+        queueChunk(w, c);
+    else
+    {
+        if (r->file >= 0)
+            w->files++;
+        if (!finishFileRequest(r))
+            return closeConnection(w, c);
+        c->state = READ_NAME;
+        c->filled = c->drained = 0;
+        advance(w, c);
+    }
+}
+
+static void accepted(struct worker *w, int fd)
+{
+    if (fd < 0)
+    {
+        if (fd != -EINTR && fd != -ECONNABORTED)
+        {
+            errno = -fd;
+            perror("ERROR on accept");
+            queueTimeout(w, &w->retryDelay, OP_RETRY_ACCEPT); // e.g. out of descriptors: try again later
+            return;
+        }
+        queueAccept(w);
+        return;
+    }
+    queueAccept(w);
+
+    struct connection *c = (struct connection *)calloc(1, sizeof(struct connection));
+    if (c == NULL)
+    {
+        perror("ERROR allocating a connection");
+        close(fd); // the client sees the connection close and can retry
+        return;
+    }
+    c->fd = fd;
+    initFileRequest(&c->req);
+    c->pipe[0] = c->pipe[1] = -1;
+    c->slot = -1;
+    c->state = READ_NAME;
+    w->open++;
+    advance(w, c);
+}
+
+static void complete(struct worker *w, const struct io_uring_cqe *cqe)
+{
+    enum uringOp op = (enum uringOp)(cqe->user_data & OPMASK);
+    struct connection *c = (struct connection *)(uintptr_t)(cqe->user_data & ~(uint64_t)OPMASK);
+    int res = cqe->res;
+
+    if (op == OP_ACCEPT)
+        return accepted(w, res);
+    if (op == OP_RETRY_ACCEPT)
+        return queueAccept(w);
+    if (op == OP_TICK)
+    {
+        if (w->open > 0 || w->files != w->lastFiles)
+        {
+            printf("Worker %d: %ld connections open, %ld files sent, %.1f MB\n", w->index, w->open, w->files, w->bytes / 1e6);
+            fflush(stdout);
+            w->lastFiles = w->files;
+        }
+        return queueTimeout(w, &w->tickDelay, OP_TICK);
+    }
+
+    if (cqe->flags & IORING_CQE_F_MORE)
+        c->pending++; // a zero-copy send: its buffer is in use until the notification
+    c->pending--;
+    if (!(cqe->flags & IORING_CQE_F_NOTIF))
+    {
+        if (op == OP_RECV_NAME && res > 0)
+            c->req.textLen += res;
+        else if (op == OP_SEND_SIZE && res > 0)
+            c->req.headerSent += res;
+        else if (op == OP_FILL && res > 0)
+        {
+            c->req.offset += res;
+            c->filled += res;
+        }
+        else if (op == OP_DRAIN && res > 0)
+        {
+            c->drained += res;
+            w->bytes += res;
+        }
+        else if (!(op == OP_DRAIN && res == -ECANCELED))
+            c->failed = 1; // errors, a closed socket, or a file that shrank
+    }
+    if (c->pending == 0)
+        advance(w, c);
+}
+
+static void *workerLoop(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    struct ring *r = &w->ring;
+    for (int i = 0; i < ACCEPTS; i++)
+        queueAccept(w);
+    queueTimeout(w, &w->tickDelay, OP_TICK);
+
+    for (;;)
+    {
+        if (ringEnter(r, 1) < 0)
+        {
+            perror("ERROR on io_uring_enter");
+            return NULL;
+        }
+        unsigned head = *r->cqHead;
+        unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+            complete(w, &r->cqes[head & *r->cqMask]);
+        __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Registers the worker's copy buffers; without them copy mode reads into plain buffers
+static void registerBuffers(struct worker *w)
+{
+    struct iovec iov[BUFFERSLOTS];
+    w->buffers = (char *)malloc((size_t)BUFFERSLOTS * BUFFERSIZE);
+    if (w->buffers == NULL)
+    {
+        perror("Allocating io_uring buffers failed, using plain buffers");
+        return;
+    }
+    for (int i = 0; i < BUFFERSLOTS; i++)
+    {
+        iov[i].iov_base = w->buffers + (size_t)i * BUFFERSIZE;
+        iov[i].iov_len = BUFFERSIZE;
+    }
+    if (syscall(__NR_io_uring_register, w->ring.fd, IORING_REGISTER_BUFFERS, iov, BUFFERSLOTS) < 0)
+    {
+        perror("Registering io_uring buffers failed, using plain buffers");
+        return;
+    }
+    for (int i = 0; i < BUFFERSLOTS; i++)
+        w->freeSlots[w->freeCount++] = i;
+}
+
+// Releases what runUringServer set up before its threads started: rings, buffers, listeners
+static void releasePool(struct worker *pool, int workers)
+{
+    for (int i = 0; i < workers; i++)
+    {
+        ringTeardown(&pool[i].ring);
+        free(pool[i].buffers);
+        if (pool[i].listenFd >= 0)
+            close(pool[i].listenFd);
+    }
+    free(pool);
+}
+
+/**
+ * Serves files on port through io_uring; does not return unless setting up fails
+ *
+ * @param backlog listen backlog of each listener
+ * @param workers rings, each on its own thread and SO_REUSEPORT listener; 0 for one per core
+ * @param mode TRANSFER_COPY to send from registered buffers, otherwise splice
+ * @return -1 if io_uring or one of the operations used is not available, or a listener
+ *         or the first thread could not be set up; nothing is left running then. 1 if a
+ *         ring failed while serving, or a later thread could not be started while the
+ *         earlier ones serve on the port: the caller must not fall back, but exit.
+ */
+int runUringServer(int port, int backlog, int workers, enum transferMode mode)
+{
+    workers = prepareServerProcess(workers);
+    struct worker *pool = (struct worker *)calloc(workers, sizeof(struct worker));
+    if (pool == NULL)
+    {
+        perror("ERROR allocating workers");
+        return -1;
+    }
+    for (int i = 0; i < workers; i++)
+    {
+        pool[i].ring.fd = -1;
+        pool[i].listenFd = -1;
+    }
+
+    // Rings first, so that nothing is bound yet if we have to fall back
+    for (int i = 0; i < workers; i++)
+    {
+        struct worker *w = &pool[i];
+        errno = 0;
+        if (ringSetup(&w->ring, RINGENTRIES) < 0 || probeOps(w->ring.fd, &w->zeroCopy) < 0)
+        {
+            fprintf(stderr, "io_uring is not available (%s)\n", errno ? strerror(errno) : "operations missing");
+            releasePool(pool, workers);
+            return -1;
+        }
+        w->index = i;
+        w->mode = mode;
+        w->retryDelay.tv_nsec = 100000000;
+        w->tickDelay.tv_sec = STATSINTERVAL;
+        if (mode == TRANSFER_COPY)
+            registerBuffers(w);
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        // io_uring waits for connections itself; a non-blocking listener would only fail with EAGAIN
+        pool[i].listenFd = openListener(port, backlog, workers > 1);
+        if (pool[i].listenFd < 0 || fcntl(pool[i].listenFd, F_SETFL, 0) < 0)
+        {
+            perror("ERROR setting up listener");
+            releasePool(pool, workers); // the epoll fallback binds the port again
+            return -1;
+        }
+    }
+
+    printf("Serving on port %d with %d io_uring worker%s, backlog %d (%s transfers)\n", port, workers,
+           workers > 1 ? "s" : "", backlog,
+           mode != TRANSFER_COPY ? "splice" : pool[0].zeroCopy ? "registered buffer, zero-copy send" : "registered buffer");
+    fflush(stdout);
+
+    // Worker 0 runs on this thread
+    for (int i = 1; i < workers; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, workerLoop, &pool[i]) != 0)
+        {
+            perror("ERROR starting worker");
+            if (i > 1)
+                return 1; // workers already serve on the port
+            releasePool(pool, workers);
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    workerLoop(&pool[0]);
+    return 1;
+}
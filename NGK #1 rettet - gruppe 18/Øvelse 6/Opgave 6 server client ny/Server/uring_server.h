@@ -0,0 +1,16 @@
+#ifndef URING_SERVER_H
+#define URING_SERVER_H
+
+#include "transfer.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+int runUringServer(int port, int backlog, int workers, enum transferMode mode);
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // URING_SERVER_H
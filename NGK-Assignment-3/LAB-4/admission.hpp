@@ -0,0 +1,205 @@
+#pragma once
+
+// Admission control for the weather server.
+//
+// Every request is checked before it is routed, so nothing is parsed for a request that will
+// be shed. Each client IP has one token bucket for read routes (GET, OPTIONS) and one for
+// write routes (POST, PUT, DELETE); a client that runs dry gets 429 with Retry-After. Independently,
+// when more requests are in flight than the global limit, new ones get 503 straight away.
+//
+// Clients are kept in recency order. When the table is full, idle clients are forgotten from
+// the least recently seen end, and if none is idle the least recently seen client makes room,
+// so a full table costs O(1) per new client instead of a scan under the lock.
+
+#include "metrics.hpp"
+
+#include <restinio/all.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace weather_admission {
+
+enum class class_t : std::size_t { read, write, count };
+enum class reason_t : std::size_t { rate_limit, overload, count };
+
+constexpr std::size_t class_count = static_cast<std::size_t>(class_t::count);
+constexpr std::size_t reason_count = static_cast<std::size_t>(reason_t::count);
+
+struct config_t {
+    double read_rate = 0;       // requests per second per client, 0: unlimited
+    double write_rate = 0;
+    std::size_t max_in_flight = 0; // 0: unlimited
+};
+
+class admission_t {
+public:
+    static admission_t &instance() {
+        static admission_t admission;
+        return admission;
+    }
+
+    // Set once at startup, before the server runs
+    void configure(config_t config) { m_config = config; }
+
+    bool enabled() const { return m_config.read_rate > 0 || m_config.write_rate > 0 || m_config.max_in_flight > 0; }
+
+    struct verdict_t {
+        bool admitted;
+        reason_t reason;
+        unsigned retry_after; // seconds
+    };
+
+    verdict_t admit(const std::string &client, class_t cls) {
+        auto c = static_cast<std::size_t>(cls);
+        if (m_config.max_in_flight > 0 &&
+            weather_metrics::registry_t::instance().in_flight() >= static_cast<std::int64_t>(m_config.max_in_flight))
+            return shed(reason_t::overload, c, 1);
+
+        double rate = cls == class_t::write ? m_config.write_rate : m_config.read_rate;
+        if (rate <= 0)
+            return { true, reason_t::count, 0 };
+
+        // A bucket holds one second's worth of requests, so short bursts pass
+        double burst = std::max(rate, 1.0);
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto &state = touch(client, now);
+        auto &bucket = state.buckets[c];
+        if (bucket.last == std::chrono::steady_clock::time_point{})
+            bucket = { burst, now }; // first request of this class
+        bucket.tokens = std::min(burst, bucket.tokens + rate * std::chrono::duration<double>(now - bucket.last).count());
+        bucket.last = now;
+        state.last_seen = now;
+
+        if (bucket.tokens < 1.0)
+            return shed(reason_t::rate_limit, c, static_cast<unsigned>(std::ceil((1.0 - bucket.tokens) / rate)));
+        bucket.tokens -= 1.0;
+        return { true, reason_t::count, 0 };
+    }
+
+    // Shed counters and tracked clients in the Prometheus text exposition format
+    std::string render() const {
+        static const char *reasons[] = { "rate_limit", "overload" };
+        static const char *classes[] = { "read", "write" };
+        std::string out = "# HELP weather_shed_requests_total Requests rejected before routing, by reason and route class.\n"
+                          "# TYPE weather_shed_requests_total counter\n";
+        for (std::size_t r = 0; r < reason_count; ++r) {
+            for (std::size_t c = 0; c < class_count; ++c) {
+                out += std::string("weather_shed_requests_total{reason=\"") + reasons[r] + "\",class=\"" + classes[c] + "\"} " +
+                       std::to_string(m_shed[r][c].load(std::memory_order_relaxed)) + "\n";
+            }
+        }
+        std::lock_guard<std::mutex> lock(m_lock);
+        out += "# HELP weather_rate_limited_clients Client IPs with a token bucket.\n"
+               "# TYPE weather_rate_limited_clients gauge\n"
+               "weather_rate_limited_clients " + std::to_string(m_lru.size()) + "\n";
+        return out;
+    }
+
+private:
+    admission_t() = default;
+
+    // Buckets of clients idle this long are full again and can be forgotten
+    static constexpr std::chrono::seconds idle_after{10};
+    static constexpr std::size_t max_clients = 65536;
+    // Idle clients are looked for at most this often; in between a full table evicts one client
+    static constexpr std::chrono::seconds prune_every{1};
+
+    struct bucket_t {
+        double tokens = 0;
+        std::chrono::steady_clock::time_point last{};
+    };
+    struct client_t {
+        std::string address;
+        std::array<bucket_t, class_count> buckets;
+        std::chrono::steady_clock::time_point last_seen;
+    };
+    using lru_t = std::list<client_t>; // most recently seen first
+
+    verdict_t shed(reason_t reason, std::size_t c, unsigned retry_after) {
+        m_shed[static_cast<std::size_t>(reason)][c].fetch_add(1, std::memory_order_relaxed);
+        return { false, reason, std::max(retry_after, 1u) };
+    }
+
+    // The state of a client, moved to the front of the recency order; called with m_lock held
+    client_t &touch(const std::string &client, std::chrono::steady_clock::time_point now) {
+        auto it = m_index.find(client);
+        if (it != m_index.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            return *it->second;
+        }
+        if (m_lru.size() >= max_clients)
+            make_room(now);
+        m_lru.push_front({ client, {}, now });
+        m_index.emplace(client, m_lru.begin());
+        return m_lru.front();
+    }
+
+    // Forgets the idle clients, which are all at the back, then the least recently seen client
+    // if the table is still full. An evicted active client starts again with full buckets.
+    void make_room(std::chrono::steady_clock::time_point now) {
+        if (now - m_last_prune >= prune_every) {
+            m_last_prune = now;
+            while (!m_lru.empty() && now - m_lru.back().last_seen > idle_after)
+                erase(std::prev(m_lru.end()));
+        }
+        if (m_lru.size() >= max_clients)
+            erase(std::prev(m_lru.end()));
+    }
+
+    void erase(lru_t::iterator client) {
+        m_index.erase(client->address);
+        m_lru.erase(client);
+    }
+
+    config_t m_config;
+    mutable std::mutex m_lock;
+    lru_t m_lru;
+    std::unordered_map<std::string, lru_t::iterator> m_index;
+    std::chrono::steady_clock::time_point m_last_prune{};
+    std::array<std::array<std::atomic<std::uint64_t>, class_count>, reason_count> m_shed{};
+};
+
+// Request handler that sheds requests before handing the rest to ROUTER. /metrics is never
+// shed, so overload stays observable.
+template <typename ROUTER>
+class admission_router_t {
+public:
+    explicit admission_router_t(std::unique_ptr<ROUTER> router) : m_router{ std::move(router) } {}
+
+    template <typename REQ>
+    auto operator()(REQ req) const {
+        auto &admission = admission_t::instance();
+        if (admission.enabled() && req->header().path() != "/metrics") {
+            auto method = req->header().method();
+            auto cls = method == restinio::http_method_post() || method == restinio::http_method_put() ||
+                               method == restinio::http_method_delete()
+                           ? class_t::write
+                           : class_t::read;
+            auto verdict = admission.admit(req->remote_endpoint().address().to_string(), cls);
+            if (!verdict.admitted) {
+                bool limited = verdict.reason == reason_t::rate_limit;
+                return req->create_response(limited ? restinio::status_too_many_requests() : restinio::status_service_unavailable())
+                    .append_header("Server", "RESTinio WeatherServer")
+                    .append_header("Retry-After", std::to_string(verdict.retry_after))
+                    .set_body(limited ? "Too many requests" : "Server overloaded")
+                    .done();
+            }
+        }
+        return (*m_router)(std::move(req));
+    }
+
+private:
+    std::unique_ptr<ROUTER> m_router;
+};
+
+} // namespace weather_admission
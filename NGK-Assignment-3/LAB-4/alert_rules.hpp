@@ -0,0 +1,323 @@
+#pragma once
+
+// Threshold alert rules evaluated as records are ingested.
+//
+// A rule watches Temperature or Humidity, either at one place or at every place. Level rules
+// (">", ">=", "<", "<=") fire when a place's value crosses the threshold, not on every sample
+// above it. Change rules ("rise", "drop") fire when a sample differs by more than the threshold
+// from the lowest or highest value at that place within the preceding window, measured on the
+// records' Date/Time.
+//
+// Rules are indexed by (place, field). Level rules are kept sorted by threshold, so a sample
+// only visits the thresholds between the previous value and the new one: with 100k rules on a
+// place a sample still costs a few binary searches plus the rules that actually fire. Change
+// rules are grouped by window, each group sorted by threshold: one walk back through the
+// history yields the low and high of every window in turn, and only the rules whose threshold
+// the rise or drop exceeds are visited.
+
+#include "weather_registration.hpp"
+
+#include <json_dto/pub.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace weather_alerts {
+
+// A rule as registered through POST /alerts
+struct alert_rule_t {
+    int m_id = 0;
+    std::string m_placeName; // empty: every place
+    std::string m_field;     // "Temperature" or "Humidity"
+    std::string m_op;        // ">", ">=", "<", "<=", "rise" or "drop"
+    double m_threshold = 0;
+    int m_windowMinutes = 60; // change rules only
+
+    template <typename JSON_IO>
+    void json_io(JSON_IO &io) {
+        io & json_dto::optional("ID", m_id, 0)
+           & json_dto::optional("PlaceName", m_placeName, std::string{})
+           & json_dto::mandatory("Field", m_field)
+           & json_dto::mandatory("Op", m_op)
+           & json_dto::mandatory("Threshold", m_threshold)
+           & json_dto::optional("WindowMinutes", m_windowMinutes, 60);
+    }
+};
+
+// What subscribers receive when a rule fires
+struct alert_t {
+    std::string m_type = "alert";
+    alert_rule_t m_rule;
+    weatherRegistration m_record;
+    double m_value = 0;
+    double m_change = 0; // change rules: the rise or drop seen within the window
+
+    template <typename JSON_IO>
+    void json_io(JSON_IO &io) {
+        io & json_dto::mandatory("Type", m_type)
+           & json_dto::mandatory("Rule", m_rule)
+           & json_dto::mandatory("Record", m_record)
+           & json_dto::mandatory("Value", m_value)
+           & json_dto::mandatory("Change", m_change);
+    }
+};
+
+enum class field_t : std::uint8_t { temperature, humidity, count };
+enum class op_t : std::uint8_t { above, at_least, below, at_most, rise, drop };
+
+constexpr std::size_t field_count = static_cast<std::size_t>(field_t::count);
+
+// Minutes since 1970-01-01 for a record's Date (YYYYMMDD) and Time (HHMM)
+inline std::int64_t sample_minutes(int date, int time) {
+    std::int64_t y = date / 10000, m = date / 100 % 100, d = date % 100;
+    y -= m <= 2;
+    std::int64_t era = (y >= 0 ? y : y - 399) / 400;
+    std::int64_t yoe = y - era * 400;
+    std::int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    std::int64_t days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+    return days * 1440 + time / 100 * 60 + time % 100;
+}
+
+class rule_engine_t {
+public:
+    static constexpr std::size_t max_rules = 1000000;
+    static constexpr std::size_t max_history = 4096; // samples kept per (place, field)
+
+    // Validates and indexes a rule, returning its ID; throws std::invalid_argument. With keep_id
+    // the rule keeps the ID it has, if free: rules handed over by a restarting server.
+    int add(alert_rule_t rule, bool keep_id = false) {
+        auto field = parse_field(rule.m_field);
+        auto op = parse_op(rule.m_op);
+        if (!field || !op)
+            throw std::invalid_argument("Field must be Temperature or Humidity, Op one of >, >=, <, <=, rise, drop");
+        if ((*op == op_t::rise || *op == op_t::drop) && (rule.m_windowMinutes <= 0 || rule.m_threshold < 0))
+            throw std::invalid_argument("change rules need a positive WindowMinutes and a non-negative Threshold");
+        if (m_rules.size() >= max_rules)
+            throw std::length_error("too many alert rules");
+
+        if (keep_id && rule.m_id > 0 && m_rules.count(rule.m_id) == 0)
+            m_next_id = std::max(m_next_id, rule.m_id + 1);
+        else
+            rule.m_id = m_next_id++;
+        auto &bucket = m_index[key(rule.m_placeName, *field)];
+        if (*op == op_t::above || *op == op_t::at_least)
+            bucket.above.emplace(rule.m_threshold, rule.m_id);
+        else if (*op == op_t::below || *op == op_t::at_most)
+            bucket.below.emplace(rule.m_threshold, rule.m_id);
+        else {
+            auto &window = bucket.change[rule.m_windowMinutes];
+            (*op == op_t::rise ? window.rise : window.drop).emplace(rule.m_threshold, rule.m_id);
+            m_change_rules++;
+            m_max_window = std::max(m_max_window, rule.m_windowMinutes);
+        }
+        m_rules.emplace(rule.m_id, stored_t{ rule, *field, *op });
+        return rule.m_id;
+    }
+
+    bool remove(int id) {
+        auto it = m_rules.find(id);
+        if (it == m_rules.end())
+            return false;
+        const auto &stored = it->second;
+        auto bucket_it = m_index.find(key(stored.rule.m_placeName, stored.field));
+        auto &bucket = bucket_it->second;
+        auto erase_from = [&](std::multimap<double, int> &thresholds) {
+            auto [first, last] = thresholds.equal_range(stored.rule.m_threshold);
+            for (; first != last; ++first) {
+                if (first->second == id) {
+                    thresholds.erase(first);
+                    break;
+                }
+            }
+        };
+        erase_from(bucket.above);
+        erase_from(bucket.below);
+        if (stored.op == op_t::rise || stored.op == op_t::drop) {
+            auto window = bucket.change.find(stored.rule.m_windowMinutes);
+            erase_from(stored.op == op_t::rise ? window->second.rise : window->second.drop);
+            if (window->second.rise.empty() && window->second.drop.empty())
+                bucket.change.erase(window);
+            m_change_rules--;
+        }
+        if (bucket.above.empty() && bucket.below.empty() && bucket.change.empty())
+            m_index.erase(bucket_it);
+        m_rules.erase(it);
+        return true;
+    }
+
+    // All rules, by ID
+    std::vector<alert_rule_t> rules() const {
+        std::vector<alert_rule_t> out;
+        out.reserve(m_rules.size());
+        for (const auto &[id, stored] : m_rules)
+            out.push_back(stored.rule);
+        std::sort(out.begin(), out.end(), [](const auto &a, const auto &b) { return a.m_id < b.m_id; });
+        return out;
+    }
+
+    std::size_t size() const { return m_rules.size(); }
+    std::uint64_t evaluated() const { return m_evaluated; }
+    std::uint64_t fired() const { return m_fired; }
+
+    // Checks a newly stored sample against the rules for its place and the wildcard rules
+    std::vector<alert_t> evaluate(const weatherRegistration &entry) {
+        std::vector<alert_t> alerts;
+        if (m_rules.empty())
+            return alerts;
+        auto minutes = sample_minutes(entry.m_date, entry.m_time);
+        for (std::size_t f = 0; f < field_count; ++f) {
+            auto field = static_cast<field_t>(f);
+            double value = field == field_t::temperature ? entry.m_temperature : static_cast<double>(entry.m_humidity);
+            auto sample_key = key(entry.m_placeName, field);
+
+            std::optional<double> previous;
+            if (auto last = m_last.find(sample_key); last != m_last.end())
+                previous = last->second;
+            static const history_t no_history;
+            auto *history = m_change_rules > 0 ? &m_history[sample_key] : nullptr;
+
+            for (const auto &bucket_key : { sample_key, key({}, field) }) {
+                auto bucket = m_index.find(bucket_key);
+                if (bucket != m_index.end())
+                    check(bucket->second, entry, value, previous, history ? *history : no_history, minutes, alerts);
+            }
+
+            m_last[sample_key] = value;
+            if (history) {
+                history->emplace_back(minutes, value);
+                while (history->size() > max_history || history->front().first < minutes - m_max_window)
+                    history->pop_front();
+            }
+        }
+        m_fired += alerts.size();
+        return alerts;
+    }
+
+private:
+    struct stored_t {
+        alert_rule_t rule;
+        field_t field;
+        op_t op;
+    };
+
+    // Change rules sharing one window
+    struct window_t {
+        std::multimap<double, int> rise;   // by threshold
+        std::multimap<double, int> drop;   // by threshold
+    };
+
+    struct bucket_t {
+        std::multimap<double, int> above;  // ">" and ">=" by threshold
+        std::multimap<double, int> below;  // "<" and "<=" by threshold
+        std::map<int, window_t> change;    // "rise" and "drop" by WindowMinutes, shortest first
+    };
+
+    using history_t = std::deque<std::pair<std::int64_t, double>>; // (minutes, value), oldest first
+
+    static std::optional<field_t> parse_field(const std::string &name) {
+        if (name == "Temperature")
+            return field_t::temperature;
+        if (name == "Humidity")
+            return field_t::humidity;
+        return std::nullopt;
+    }
+
+    static std::optional<op_t> parse_op(const std::string &name) {
+        if (name == ">")
+            return op_t::above;
+        if (name == ">=")
+            return op_t::at_least;
+        if (name == "<")
+            return op_t::below;
+        if (name == "<=")
+            return op_t::at_most;
+        if (name == "rise")
+            return op_t::rise;
+        if (name == "drop")
+            return op_t::drop;
+        return std::nullopt;
+    }
+
+    static std::string key(const std::string &place, field_t field) {
+        std::string k = place;
+        k += '\0';
+        k += static_cast<char>(field);
+        return k;
+    }
+
+    static bool holds(op_t op, double threshold, double value) {
+        switch (op) {
+        case op_t::above: return value > threshold;
+        case op_t::at_least: return value >= threshold;
+        case op_t::below: return value < threshold;
+        case op_t::at_most: return value <= threshold;
+        default: return false;
+        }
+    }
+
+    void check(const bucket_t &bucket, const weatherRegistration &entry, double value, std::optional<double> previous,
+               const history_t &history, std::int64_t minutes, std::vector<alert_t> &alerts) {
+        auto fire = [&](const stored_t &stored, double change) {
+            alerts.push_back({ "alert", stored.rule, entry, value, change });
+        };
+
+        // A level rule fires when the new value satisfies it and the previous one did not,
+        // which only thresholds between the two values can do
+        auto crossing = [&](const std::multimap<double, int> &thresholds, double low, double high) {
+            for (auto it = thresholds.lower_bound(low), end = thresholds.upper_bound(high); it != end; ++it) {
+                const auto &stored = m_rules.at(it->second);
+                ++m_evaluated;
+                if (holds(stored.op, it->first, value) && !(previous && holds(stored.op, it->first, *previous)))
+                    fire(stored, 0);
+            }
+        };
+        if (!previous || value > *previous)
+            crossing(bucket.above, previous ? *previous : bucket.above.empty() ? 0 : bucket.above.begin()->first, value);
+        if (!previous || value < *previous)
+            crossing(bucket.below, value, previous ? *previous : bucket.below.empty() ? 0 : bucket.below.rbegin()->first);
+
+        // Windows are nested, shortest first, so the walk back through the history carries on
+        // from where the previous window stopped
+        std::optional<double> low, high;
+        auto sample = history.rbegin();
+        auto exceeded = [&](const std::multimap<double, int> &thresholds, double change) {
+            for (auto it = thresholds.begin(); it != thresholds.end() && change > it->first; ++it) {
+                ++m_evaluated;
+                fire(m_rules.at(it->second), change);
+            }
+        };
+        for (const auto &[window, rules] : bucket.change) {
+            auto since = minutes - window;
+            for (; sample != history.rend() && sample->first >= since; ++sample) {
+                if (sample->first > minutes)
+                    continue;
+                low = low ? std::min(*low, sample->second) : sample->second;
+                high = high ? std::max(*high, sample->second) : sample->second;
+            }
+            if (low)
+                exceeded(rules.rise, value - *low);
+            if (high)
+                exceeded(rules.drop, *high - value);
+        }
+    }
+
+    std::unordered_map<int, stored_t> m_rules;
+    std::unordered_map<std::string, bucket_t> m_index;   // (place, field) -> rules; "" is every place
+    std::unordered_map<std::string, double> m_last;      // (place, field) -> last value seen
+    std::unordered_map<std::string, history_t> m_history; // (place, field) -> recent samples, for change rules
+    std::size_t m_change_rules = 0;
+    int m_max_window = 0;
+    int m_next_id = 1;
+    std::uint64_t m_evaluated = 0;
+    std::uint64_t m_fired = 0;
+};
+
+} // namespace weather_alerts
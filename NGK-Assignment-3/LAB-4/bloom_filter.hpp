@@ -0,0 +1,119 @@
+#pragma once
+
+// Scalable Bloom filter over record IDs, used to skip the duplicate check on ingest.
+//
+// "No" answers are exact, "maybe" answers must be confirmed against the store. The filter is
+// a chain of stages: when the newest stage holds its capacity, a stage twice as large with
+// half the false-positive target of the previous one is added. The stage targets add up to
+// less than the configured rate however many IDs arrive, and nothing is ever rehashed.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace weather_bloom {
+
+class bloom_filter_t {
+public:
+    explicit bloom_filter_t(std::size_t initial_capacity = 1 << 16, double fp_rate = 0.005)
+        : m_initial_capacity{ initial_capacity }, m_fp_rate{ fp_rate } {}
+
+    void add(std::int64_t id) {
+        if (m_stages.empty() || m_stages.back().count >= m_stages.back().capacity) {
+            auto stage_no = m_stages.size();
+            add_stage(m_initial_capacity << stage_no, m_fp_rate / static_cast<double>(std::uint64_t{ 1 } << (stage_no + 1)));
+        }
+        auto &stage = m_stages.back();
+        auto [h1, h2] = hashes(id);
+        for (unsigned i = 0; i < stage.hashes; ++i) {
+            auto bit = reduce(h1 + i * h2, stage.bits);
+            stage.words[bit / 64] |= std::uint64_t{ 1 } << (bit % 64);
+        }
+        ++stage.count;
+    }
+
+    // false: id was never added; true: it probably was
+    bool may_contain(std::int64_t id) const {
+        auto [h1, h2] = hashes(id);
+        for (const auto &stage : m_stages) {
+            bool all = true;
+            for (unsigned i = 0; i < stage.hashes && all; ++i) {
+                auto bit = reduce(h1 + i * h2, stage.bits);
+                all = (stage.words[bit / 64] >> (bit % 64)) & 1;
+            }
+            if (all)
+                return true;
+        }
+        return false;
+    }
+
+    // False-positive probability implied by how full the stages are
+    double estimated_fp_rate() const {
+        double none = 1.0;
+        for (const auto &stage : m_stages) {
+            double fill = 1.0 - std::exp(-static_cast<double>(stage.hashes) * stage.count / stage.bits);
+            none *= 1.0 - std::pow(fill, stage.hashes);
+        }
+        return 1.0 - none;
+    }
+
+    std::size_t size() const {
+        std::size_t count = 0;
+        for (const auto &stage : m_stages)
+            count += stage.count;
+        return count;
+    }
+
+    std::size_t stages() const { return m_stages.size(); }
+
+    std::size_t bytes() const {
+        std::size_t total = 0;
+        for (const auto &stage : m_stages)
+            total += stage.words.size() * sizeof(std::uint64_t);
+        return total;
+    }
+
+private:
+    struct stage_t {
+        std::vector<std::uint64_t> words;
+        std::uint64_t bits;
+        unsigned hashes;
+        std::size_t capacity;
+        std::size_t count = 0;
+    };
+
+    // Optimal size for n items at rate p: m = -n ln p / ln^2 2 bits and k = m/n ln 2 hashes
+    void add_stage(std::size_t capacity, double p) {
+        const double ln2 = std::log(2.0);
+        auto bits = static_cast<std::uint64_t>(std::ceil(-static_cast<double>(capacity) * std::log(p) / (ln2 * ln2)));
+        bits = (bits + 63) / 64 * 64;
+        auto hashes = static_cast<unsigned>(std::max(1.0, std::round(static_cast<double>(bits) / capacity * ln2)));
+        m_stages.push_back({ std::vector<std::uint64_t>(bits / 64), bits, hashes, capacity });
+    }
+
+    // Maps a hash onto [0, range) with a multiply instead of a division
+    static std::uint64_t reduce(std::uint64_t hash, std::uint64_t range) {
+        return static_cast<std::uint64_t>((static_cast<unsigned __int128>(hash) * range) >> 64);
+    }
+
+    // Two independent hashes for double hashing (Kirsch-Mitzenmacher), from splitmix64
+    static std::pair<std::uint64_t, std::uint64_t> hashes(std::int64_t id) {
+        auto mix = [](std::uint64_t x) {
+            x += 0x9e3779b97f4a7c15ULL;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+            return x ^ (x >> 31);
+        };
+        auto h1 = mix(static_cast<std::uint64_t>(id));
+        auto h2 = mix(h1) | 1; // odd, so the probes do not repeat early
+        return { h1, h2 };
+    }
+
+    std::size_t m_initial_capacity;
+    double m_fp_rate;
+    std::vector<stage_t> m_stages;
+};
+
+} // namespace weather_bloom
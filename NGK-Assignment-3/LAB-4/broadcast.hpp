@@ -0,0 +1,55 @@
+#pragma once
+
+// WebSocket fan-out of the weather server.
+//
+// A write queues its message and returns; the fan-out then sends every queued message to
+// every subscriber as a separate task on the I/O thread. The queue and the loop over the
+// subscribers are templated on the subscriber handle, so bench/micro_bench.cpp measures the
+// same fan-out the server runs.
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+
+namespace weather_broadcast {
+
+// Sends msg to every subscriber of registry (ID -> handle) with send(handle, msg); returns the
+// number of messages sent
+template <typename REGISTRY, typename SEND>
+std::uint64_t send_to_all(const REGISTRY &registry, const std::string &msg, SEND &send) {
+    std::uint64_t sent = 0;
+    for (const auto &[id, subscriber] : registry) {
+        send(subscriber, msg);
+        ++sent;
+    }
+    return sent;
+}
+
+// Messages waiting to be fanned out, oldest first
+class queue_t {
+public:
+    // Queues a message; true when the queue was empty, so the caller must schedule drain()
+    bool push(std::string msg) {
+        m_queue.push_back(std::move(msg));
+        return m_queue.size() == 1;
+    }
+
+    std::size_t depth() const { return m_queue.size(); }
+
+    // Sends every queued message to every subscriber; returns the number of messages sent
+    template <typename REGISTRY, typename SEND>
+    std::uint64_t drain(const REGISTRY &registry, SEND send) {
+        std::uint64_t sent = 0;
+        while (!m_queue.empty()) {
+            sent += send_to_all(registry, m_queue.front(), send);
+            m_queue.pop_front();
+        }
+        return sent;
+    }
+
+private:
+    std::deque<std::string> m_queue;
+};
+
+} // namespace weather_broadcast
@@ -0,0 +1,606 @@
+// Routing front end for a cluster of LAB-4 weather servers.
+//
+// Records are spread over the nodes with a consistent-hash ring on their ID (or, with
+// --by place, their PlaceName, so one place lives on one node). Writes and point lookups go to
+// the owning node; GET /, /date/:date and /latest are scattered to every node and gathered.
+// Records do not move between nodes on a PUT: one that would change the key to one another
+// node owns (a new ID with --by id, a new PlaceName with --by place) gets 409.
+// /chat subscribes to every node's feed and relays it to the proxy's own subscribers.
+//
+// A node that joins through POST /cluster/nodes takes over only the arcs of the ring next to
+// its points: the records there are copied to it, then the ring is switched. Writes to those
+// keys get 503 while the copy runs; writes already on their way to the old owner are waited
+// for before the copy starts. Copies are marked X-Weather-Copy, so the new node stores them
+// without announcing them on /chat. The old copies stay on their nodes but are no longer owned
+// there, and gathered results only keep records from the node that owns them.
+//
+// A node that does not answer in time gets 504, one that cannot be reached 502.
+
+#include <iostream>
+#include <restinio/all.hpp>
+#include <restinio/websocket/websocket.hpp>
+#include <json_dto/pub.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include "weather_registration.hpp"
+#include "hash_ring.hpp"
+#include "http_client.hpp"
+
+namespace rr = restinio::router;
+using router_t = rr::express_router_t<>;
+
+using traits_t = restinio::traits_t<
+    restinio::asio_timer_manager_t,
+    restinio::shared_ostream_logger_t,
+    router_t>;
+
+namespace rws = restinio::websocket::basic;
+
+enum class shard_by_t { id, place };
+
+// Body of POST /cluster/nodes
+struct node_request_t {
+    std::string m_node;
+
+    template <typename JSON_IO>
+    void json_io(JSON_IO &io) {
+        io & json_dto::mandatory("Node", m_node);
+    }
+};
+
+// One entry of GET /cluster
+struct node_info_t {
+    std::string m_node;
+    double m_share = 0;
+    bool m_feed = false;
+
+    template <typename JSON_IO>
+    void json_io(JSON_IO &io) {
+        io & json_dto::mandatory("Node", m_node)
+           & json_dto::mandatory("Share", m_share)
+           & json_dto::mandatory("Feed", m_feed);
+    }
+};
+
+template <typename RESP>
+RESP init_resp(RESP resp) {
+    resp.append_header("Server", "RESTinio WeatherProxy")
+        .append_header_date_field()
+        .append_header("Content-Type", "application/json; charset=utf-8")
+        .append_header("Access-Control-Allow-Origin", "*");
+    return resp;
+}
+
+class clusterProxy {
+public:
+    clusterProxy(const std::vector<std::string> &nodes, shard_by_t shard_by, std::size_t vnodes) : m_shard_by{ shard_by } {
+        auto state = std::make_shared<ring_state_t>(vnodes);
+        for (const auto &node : nodes)
+            add_node(*state, node);
+        m_ring = state;
+        for (const auto &client : state->clients)
+            add_feed(*client);
+    }
+
+    ~clusterProxy() {
+        if (m_rebalance.joinable())
+            m_rebalance.join();
+    }
+
+    // POST a new record to the node that owns it
+    auto on_weather_post(const restinio::request_handle_t &req, rr::route_params_t) {
+        weatherRegistration entry;
+        try {
+            entry = json_dto::from_json<weatherRegistration>(req->body());
+        } catch (const std::exception &ex) {
+            return req->create_response(restinio::status_bad_request()).set_body(std::string("Error: ") + ex.what()).done();
+        }
+        auto key = key_of(entry);
+        auto writing = write_lock();
+        auto state = write_ring({ key });
+        if (!state)
+            return rebalancing(req);
+        return forward(req, *state, state->ring.owner(key), "POST", "/", req->body());
+    }
+
+    // PUT a record on the node that holds it
+    auto on_weather_put(const restinio::request_handle_t &req, rr::route_params_t params) {
+        auto id = std::string(params["id"]);
+        weatherRegistration entry;
+        try {
+            entry = json_dto::from_json<weatherRegistration>(req->body());
+        } catch (const std::exception &ex) {
+            return req->create_response(restinio::status_bad_request()).set_body(std::string("Error: ") + ex.what()).done();
+        }
+        auto writing = write_lock();
+        if (m_shard_by == shard_by_t::id) {
+            auto state = write_ring({ id, std::to_string(entry.m_id) });
+            if (!state)
+                return rebalancing(req);
+            // The node would store the record under its new ID, where lookups and gathers
+            // never look for it, and would check that ID against the wrong records
+            auto owner = state->ring.owner(id);
+            if (state->ring.owner(std::to_string(entry.m_id)) != owner)
+                return req->create_response(restinio::status_conflict())
+                    .set_body("The new ID belongs to another node; records cannot move between nodes")
+                    .done();
+            return forward(req, *state, owner, "PUT", "/" + id, req->body());
+        }
+
+        // By place, the record stays where it is, so its new place must map to the same node
+        auto state = write_ring({ entry.m_placeName });
+        if (!state)
+            return rebalancing(req);
+        auto holder = find_holder(*state, id);
+        if (!holder)
+            return req->create_response(restinio::status_not_found()).set_body("ID not found").done();
+        if (state->ring.owner(entry.m_placeName) != *holder)
+            return req->create_response(restinio::status_conflict())
+                .set_body("The new PlaceName belongs to another node; records cannot move between nodes")
+                .done();
+        return forward(req, *state, *holder, "PUT", "/" + id, req->body());
+    }
+
+    // GET one record from the node that owns it
+    auto on_weather_by_id(const restinio::request_handle_t &req, rr::route_params_t params) {
+        auto id = std::string(params["id"]);
+        auto state = ring();
+        if (m_shard_by == shard_by_t::id)
+            return forward(req, *state, state->ring.owner(id), "GET", "/id/" + id, {});
+        if (auto holder = find_holder(*state, id))
+            return forward(req, *state, *holder, "GET", "/id/" + id, {});
+        return req->create_response(restinio::status_not_found()).set_body("Not found").done();
+    }
+
+    auto on_weather_list(const restinio::request_handle_t &req, rr::route_params_t) {
+        return gather(req, "/");
+    }
+
+    auto on_weather_by_date(const restinio::request_handle_t &req, rr::route_params_t params) {
+        return gather(req, "/date/" + std::to_string(restinio::cast_to<int>(params["date"])));
+    }
+
+    // GET the 3 latest records of the cluster, by Date and Time
+    auto on_weather_latest(const restinio::request_handle_t &req, rr::route_params_t) {
+        auto state = ring();
+        bool late = false;
+        auto records = scatter(*state, "/latest", late);
+        if (!records)
+            return late ? timed_out(req) : unreachable(req);
+        std::sort(records->begin(), records->end(), [](const auto &a, const auto &b) {
+            return std::tie(a.m_date, a.m_time) > std::tie(b.m_date, b.m_time);
+        });
+        if (records->size() > 3)
+            records->resize(3);
+        return init_resp(req->create_response()).set_body(json_dto::to_json(*records)).done();
+    }
+
+    // GET the records of one place: from its node when sharding by place, else from all
+    auto on_place(const restinio::request_handle_t &req, rr::route_params_t params) {
+        auto target = "/place/" + std::string(params["name"]);
+        if (m_shard_by == shard_by_t::place) {
+            auto state = ring();
+            std::string name;
+            try {
+                name = restinio::utils::unescape_percent_encoding(params["name"]);
+            } catch (...) {
+                return req->create_response(restinio::status_bad_request()).set_body("Invalid place name").done();
+            }
+            return forward(req, *state, state->ring.owner(name), "GET", target, {});
+        }
+        return gather(req, target);
+    }
+
+    // WebSocket feed of every node
+    auto on_live_update(const restinio::request_handle_t &req, rr::route_params_t) {
+        if (restinio::http_connection_header_t::upgrade != req->header().connection())
+            return restinio::request_rejected();
+        auto wsh = rws::upgrade<traits_t>(*req, rws::activation_t::immediate, [this](auto wsh, auto m) {
+            if (rws::opcode_t::connection_close_frame == m->opcode()) {
+                std::lock_guard<std::mutex> lock(m_subscribers_lock);
+                m_subscribers.erase(wsh->connection_id());
+            }
+        });
+        std::lock_guard<std::mutex> lock(m_subscribers_lock);
+        m_subscribers.emplace(wsh->connection_id(), wsh);
+        return restinio::request_accepted();
+    }
+
+    // GET the nodes and the share of the keys each owns
+    auto on_cluster(const restinio::request_handle_t &req, rr::route_params_t) {
+        auto state = ring();
+        auto shares = state->ring.shares();
+        std::vector<node_info_t> nodes;
+        {
+            std::lock_guard<std::mutex> lock(m_feeds_lock);
+            for (std::size_t i = 0; i < state->clients.size(); ++i)
+                nodes.push_back({ state->ring.nodes()[i], shares[i], i < m_feeds.size() && m_feeds[i]->connected() });
+        }
+        return init_resp(req->create_response()).set_body(json_dto::to_json(nodes)).done();
+    }
+
+    // POST {"Node": "127.0.0.1:8083"}: add a node and move its share of the records to it
+    auto on_add_node(const restinio::request_handle_t &req, rr::route_params_t) {
+        std::string node;
+        try {
+            node = json_dto::from_json<node_request_t>(req->body()).m_node;
+            http_client_t probe{ node };
+        } catch (const std::exception &ex) {
+            return req->create_response(restinio::status_bad_request()).set_body(std::string("Error: ") + ex.what()).done();
+        }
+
+        std::lock_guard<std::mutex> lock(m_rebalance_lock);
+        if (rebalancing_now())
+            return rebalancing(req);
+        auto next = std::make_shared<ring_state_t>(*ring());
+        try {
+            add_node(*next, node);
+        } catch (const std::exception &ex) {
+            return req->create_response(restinio::status_conflict()).set_body(std::string("Error: ") + ex.what()).done();
+        }
+        {
+            std::lock_guard<std::mutex> ring_lock(m_ring_lock);
+            m_next_ring = next;
+        }
+        if (m_rebalance.joinable())
+            m_rebalance.join();
+        m_rebalance = std::thread([this, next] { rebalance(next); });
+        return init_resp(req->create_response(restinio::status_accepted())).set_body(R"({"status": "rebalancing"})").done();
+    }
+
+    auto on_metrics(const restinio::request_handle_t &req, rr::route_params_t) {
+        auto state = ring();
+        std::string body = "# HELP weather_proxy_node_requests_total Requests sent to each node.\n"
+                           "# TYPE weather_proxy_node_requests_total counter\n";
+        for (std::size_t i = 0; i < state->clients.size(); ++i)
+            body += "weather_proxy_node_requests_total{node=\"" + state->ring.nodes()[i] + "\"} " +
+                    std::to_string(state->stats[i]->requests.load()) + "\n";
+        body += "# HELP weather_proxy_node_errors_total Requests to each node that failed to connect or read.\n"
+                "# TYPE weather_proxy_node_errors_total counter\n";
+        for (std::size_t i = 0; i < state->clients.size(); ++i)
+            body += "weather_proxy_node_errors_total{node=\"" + state->ring.nodes()[i] + "\"} " +
+                    std::to_string(state->stats[i]->errors.load()) + "\n";
+        body += "# HELP weather_proxy_rebalanced_records_total Records copied to joining nodes.\n"
+                "# TYPE weather_proxy_rebalanced_records_total counter\n"
+                "weather_proxy_rebalanced_records_total " + std::to_string(m_moved.load()) + "\n"
+                "# HELP weather_proxy_rebalancing Whether a node is joining.\n"
+                "# TYPE weather_proxy_rebalancing gauge\n"
+                "weather_proxy_rebalancing " + std::to_string(rebalancing_now() ? 1 : 0) + "\n"
+                "# HELP weather_proxy_ws_messages_relayed_total Node feed messages relayed to subscribers.\n"
+                "# TYPE weather_proxy_ws_messages_relayed_total counter\n"
+                "weather_proxy_ws_messages_relayed_total " + std::to_string(m_relayed.load()) + "\n";
+        return req->create_response()
+            .append_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8")
+            .set_body(std::move(body))
+            .done();
+    }
+
+    auto on_options(const restinio::request_handle_t &req, rr::route_params_t) {
+        return req->create_response()
+            .append_header("Access-Control-Allow-Origin", "*")
+            .append_header("Access-Control-Allow-Methods", "GET, POST, PUT, OPTIONS")
+            .append_header("Access-Control-Allow-Headers", "Content-Type")
+            .done();
+    }
+
+private:
+    using http_client_t = weather_cluster::http_client_t;
+    using response_t = weather_cluster::response_t;
+
+    struct node_stats_t {
+        std::atomic<std::uint64_t> requests{0};
+        std::atomic<std::uint64_t> errors{0};
+    };
+
+    // The ring and a client per node; replaced as a whole when a node joins
+    struct ring_state_t {
+        explicit ring_state_t(std::size_t vnodes) : ring{ vnodes } {}
+        weather_cluster::hash_ring_t ring;
+        std::vector<std::shared_ptr<http_client_t>> clients;
+        std::vector<std::shared_ptr<node_stats_t>> stats;
+    };
+
+    static void add_node(ring_state_t &state, const std::string &node) {
+        auto client = std::make_shared<http_client_t>(node);
+        state.ring.add(node);
+        state.clients.push_back(std::move(client));
+        state.stats.push_back(std::make_shared<node_stats_t>());
+    }
+
+    std::shared_ptr<const ring_state_t> ring() const {
+        std::lock_guard<std::mutex> lock(m_ring_lock);
+        return m_ring;
+    }
+
+    bool rebalancing_now() const {
+        std::lock_guard<std::mutex> lock(m_ring_lock);
+        return m_next_ring != nullptr;
+    }
+
+    std::string key_of(const weatherRegistration &entry) const {
+        return m_shard_by == shard_by_t::id ? std::to_string(entry.m_id) : entry.m_placeName;
+    }
+
+    // Held by a write from routing to the node's answer. New writes queue behind a rebalance
+    // waiting for the lock, so a steady stream of them cannot starve it.
+    std::shared_lock<std::shared_mutex> write_lock() const {
+        std::lock_guard<std::mutex> turn(m_writes_turn);
+        return std::shared_lock<std::shared_mutex>(m_writes_lock);
+    }
+
+    // The ring to route a write on, or nullptr when one of its keys changes owner in the
+    // rebalance under way. Both rings are read at once, so a write never pairs the ring before
+    // a switch with the absence of a rebalance after it.
+    std::shared_ptr<const ring_state_t> write_ring(std::initializer_list<std::string> keys) const {
+        std::lock_guard<std::mutex> lock(m_ring_lock);
+        if (m_next_ring) {
+            for (const auto &key : keys) {
+                if (m_next_ring->ring.owner(key) != m_ring->ring.owner(key))
+                    return nullptr;
+            }
+        }
+        return m_ring;
+    }
+
+    response_t call(const ring_state_t &state, std::size_t node, std::string_view method, const std::string &target,
+                    std::string_view body, std::string_view headers = {}) const {
+        ++state.stats[node]->requests;
+        try {
+            return state.clients[node]->request(method, target, body, headers);
+        } catch (...) {
+            ++state.stats[node]->errors;
+            throw;
+        }
+    }
+
+    // Relays one request to a node and its status, reason and body back to the client
+    restinio::request_handling_status_t forward(const restinio::request_handle_t &req, const ring_state_t &state, std::size_t node,
+                                                std::string_view method, const std::string &target, std::string_view body) {
+        try {
+            auto response = call(state, node, method, target, body);
+            return init_resp(req->create_response(restinio::http_status_line_t{
+                                 restinio::http_status_code_t{ static_cast<std::uint16_t>(response.status) }, response.reason }))
+                .set_body(std::move(response.body))
+                .done();
+        } catch (const weather_cluster::timeout_error &) {
+            return timed_out(req);
+        } catch (const std::exception &) {
+            return unreachable(req);
+        }
+    }
+
+    // Fetches target from every node in parallel and keeps the records each node owns;
+    // nullopt when a node could not answer, with timed_out set if one did not answer in time
+    std::optional<weatherStation_t> scatter(const ring_state_t &state, const std::string &target, bool &timed_out) const {
+        std::vector<std::future<response_t>> replies;
+        for (std::size_t i = 0; i < state.clients.size(); ++i)
+            replies.push_back(std::async(std::launch::async, [this, &state, i, &target] { return call(state, i, "GET", target, {}); }));
+
+        weatherStation_t records;
+        bool failed = false;
+        for (std::size_t i = 0; i < replies.size(); ++i) {
+            try {
+                auto reply = replies[i].get();
+                if (reply.status != 200) {
+                    failed = true;
+                    continue;
+                }
+                for (auto &entry : json_dto::from_json<weatherStation_t>(reply.body)) {
+                    if (state.ring.owner(key_of(entry)) == i)
+                        records.push_back(std::move(entry));
+                }
+            } catch (const weather_cluster::timeout_error &) {
+                failed = timed_out = true;
+            } catch (const std::exception &) {
+                failed = true;
+            }
+        }
+        if (failed)
+            return std::nullopt;
+        return records;
+    }
+
+    restinio::request_handling_status_t gather(const restinio::request_handle_t &req, const std::string &target) {
+        auto state = ring();
+        bool late = false;
+        auto records = scatter(*state, target, late);
+        if (!records)
+            return late ? timed_out(req) : unreachable(req);
+        return init_resp(req->create_response()).set_body(json_dto::to_json(*records)).done();
+    }
+
+    // The node that holds the owned copy of a record, when the ring is not keyed by ID
+    std::optional<std::size_t> find_holder(const ring_state_t &state, const std::string &id) const {
+        std::vector<std::future<std::optional<std::size_t>>> replies;
+        for (std::size_t i = 0; i < state.clients.size(); ++i) {
+            replies.push_back(std::async(std::launch::async, [this, &state, i, &id]() -> std::optional<std::size_t> {
+                try {
+                    auto reply = call(state, i, "GET", "/id/" + id, {});
+                    if (reply.status == 200 && state.ring.owner(key_of(json_dto::from_json<weatherRegistration>(reply.body))) == i)
+                        return i;
+                } catch (const std::exception &) {
+                }
+                return std::nullopt;
+            }));
+        }
+        std::optional<std::size_t> holder;
+        for (auto &reply : replies) {
+            if (auto node = reply.get(); node && !holder)
+                holder = node;
+        }
+        return holder;
+    }
+
+    // Copies the records the new node takes over, then switches to the new ring. m_next_ring is
+    // already published, so writes to moving keys get 503 from here on; the ones that were
+    // routed before are waited for, so none lands on an old owner after its records are copied.
+    void rebalance(std::shared_ptr<ring_state_t> next) {
+        {
+            std::lock_guard<std::mutex> turn(m_writes_turn);
+            std::unique_lock<std::shared_mutex> drain(m_writes_lock);
+        }
+        auto current = ring();
+        auto target = next->clients.size() - 1;
+        for (std::size_t i = 0; i < current->clients.size(); ++i) {
+            try {
+                auto reply = call(*current, i, "GET", "/", {});
+                if (reply.status != 200)
+                    throw std::runtime_error("status " + std::to_string(reply.status));
+                for (const auto &entry : json_dto::from_json<weatherStation_t>(reply.body)) {
+                    auto key = key_of(entry);
+                    if (current->ring.owner(key) != i || next->ring.owner(key) != target)
+                        continue;
+                    auto body = json_dto::to_json(entry);
+                    auto copied = call(*next, target, "POST", "/", body, copy_header);
+                    if (copied.status == 409)
+                        copied = call(*next, target, "PUT", "/" + std::to_string(entry.m_id), body, copy_header);
+                    if (copied.status >= 300)
+                        throw std::runtime_error("copy of ID " + std::to_string(entry.m_id) + " got status " + std::to_string(copied.status));
+                    ++m_moved;
+                }
+            } catch (const std::exception &ex) {
+                std::cerr << "Rebalance to " << next->ring.nodes()[target] << " failed: " << ex.what() << std::endl;
+                std::lock_guard<std::mutex> lock(m_ring_lock);
+                m_next_ring = nullptr;
+                return;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_ring_lock);
+            m_ring = next;
+            m_next_ring = nullptr;
+        }
+        add_feed(*next->clients.back());
+    }
+
+    void add_feed(const http_client_t &client) {
+        auto feed = std::make_unique<weather_cluster::ws_feed_t>(client.host(), client.port(), [this](std::string message) {
+            relay(std::move(message));
+        });
+        std::lock_guard<std::mutex> lock(m_feeds_lock);
+        m_feeds.push_back(std::move(feed));
+    }
+
+    void relay(std::string message) {
+        std::lock_guard<std::mutex> lock(m_subscribers_lock);
+        for (auto &[id, ws] : m_subscribers) {
+            ws->send_message(rws::message_t{ rws::final_frame_flag_t::final_frame, rws::opcode_t::text_frame, message });
+            ++m_relayed;
+        }
+    }
+
+    restinio::request_handling_status_t rebalancing(const restinio::request_handle_t &req) {
+        return req->create_response(restinio::status_service_unavailable())
+            .append_header("Retry-After", "1")
+            .set_body("Rebalancing; retry shortly")
+            .done();
+    }
+
+    restinio::request_handling_status_t unreachable(const restinio::request_handle_t &req) {
+        return req->create_response(restinio::status_bad_gateway()).set_body("A cluster node could not be reached").done();
+    }
+
+    restinio::request_handling_status_t timed_out(const restinio::request_handle_t &req) {
+        return req->create_response(restinio::status_gateway_time_out()).set_body("A cluster node did not answer in time").done();
+    }
+
+    // Marks the records rebalance() copies, so the joining node does not announce them as new
+    static constexpr std::string_view copy_header = "X-Weather-Copy: rebalance\r\n";
+
+    shard_by_t m_shard_by;
+    mutable std::mutex m_ring_lock;
+    std::shared_ptr<const ring_state_t> m_ring;
+    std::shared_ptr<const ring_state_t> m_next_ring; // while a node joins
+    // Held shared by writes from routing to the node's answer, exclusively by a rebalance once
+    mutable std::shared_mutex m_writes_lock;
+    mutable std::mutex m_writes_turn;
+    std::mutex m_rebalance_lock;
+    std::thread m_rebalance;
+    std::atomic<std::uint64_t> m_moved{0};
+
+    std::mutex m_subscribers_lock;
+    std::map<std::uint64_t, rws::ws_handle_t> m_subscribers;
+    std::atomic<std::uint64_t> m_relayed{0};
+    std::mutex m_feeds_lock;
+    std::vector<std::unique_ptr<weather_cluster::ws_feed_t>> m_feeds; // last: their threads call relay()
+};
+
+auto proxy_handler(std::shared_ptr<clusterProxy> proxy) {
+    auto router = std::make_unique<router_t>();
+    auto bind = [&proxy](auto method) {
+        return [proxy, method](const restinio::request_handle_t &req, rr::route_params_t params) {
+            return ((*proxy).*method)(req, std::move(params));
+        };
+    };
+
+    router->http_get("/", bind(&clusterProxy::on_weather_list));
+    router->http_post("/", bind(&clusterProxy::on_weather_post));
+    router->http_put(R"(/:id(\d+))", bind(&clusterProxy::on_weather_put));
+    router->http_get(R"(/id/:id(\d+))", bind(&clusterProxy::on_weather_by_id));
+    router->http_get(R"(/date/:date(\d+))", bind(&clusterProxy::on_weather_by_date));
+    router->http_get("/latest", bind(&clusterProxy::on_weather_latest));
+    router->http_get("/place/:name", bind(&clusterProxy::on_place));
+    router->http_get("/chat", bind(&clusterProxy::on_live_update));
+    router->http_get("/cluster", bind(&clusterProxy::on_cluster));
+    router->http_post("/cluster/nodes", bind(&clusterProxy::on_add_node));
+    router->http_get("/metrics", bind(&clusterProxy::on_metrics));
+    router->add_handler(restinio::http_method_options(), "/", bind(&clusterProxy::on_options));
+    router->add_handler(restinio::http_method_options(), R"(/:id(\d+))", bind(&clusterProxy::on_options));
+    return router;
+}
+
+// Entry point of the proxy
+//   --node HOST:PORT  a weather server in the cluster (repeatable, at least one)
+//   --port N          HTTP port of the proxy (default 9090)
+//   --by id|place     shard on the record ID (default) or on PlaceName
+//   --vnodes N        points per node on the hash ring (default 128)
+//   --threads N       proxy threads (default 4)
+int main(int argc, char *argv[]) {
+    using namespace std::chrono;
+
+    try {
+        std::vector<std::string> nodes;
+        std::uint16_t port = 9090;
+        shard_by_t shard_by = shard_by_t::id;
+        std::size_t vnodes = 128;
+        std::size_t threads = 4;
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--node") == 0 && i + 1 < argc)
+                nodes.push_back(argv[++i]);
+            else if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+                port = static_cast<std::uint16_t>(std::stoul(argv[++i]));
+            else if (std::strcmp(argv[i], "--by") == 0 && i + 1 < argc)
+                shard_by = std::strcmp(argv[++i], "place") == 0 ? shard_by_t::place : shard_by_t::id;
+            else if (std::strcmp(argv[i], "--vnodes") == 0 && i + 1 < argc)
+                vnodes = std::max<std::size_t>(std::stoul(argv[++i]), 1);
+            else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+                threads = std::max<std::size_t>(std::stoul(argv[++i]), 1);
+        }
+        if (nodes.empty())
+            throw std::invalid_argument("at least one --node HOST:PORT is needed");
+
+        auto proxy = std::make_shared<clusterProxy>(nodes, shard_by, vnodes);
+        restinio::run(
+            restinio::on_thread_pool<traits_t>(threads)
+                .address("localhost")
+                .port(port)
+                .request_handler(proxy_handler(proxy))
+                .read_next_http_message_timelimit(10s)
+                .write_http_response_timelimit(1s)
+                .handle_request_timeout(10s));
+    } catch (const std::exception &ex) {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,379 @@
+#pragma once
+
+// Cold tier of the weather store: immutable, zlib-compressed segment files on local disk.
+//
+// When the in-memory store outgrows its hot window, its oldest records are compacted into a
+// segment. A segment is mmap'd and carries its own indexes, so lookups decompress only the
+// blocks that can hold a match:
+//
+//   header_t | id_entry_t[records] (sorted by ID) | date_entry_t[dates] (sorted by date)
+//            | block_entry_t[blocks] | compressed blocks of block_records records each
+//
+// Files use the native byte order; they are scratch data owned by the running server.
+
+#include "weather_registration.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace weather_cold {
+
+constexpr std::size_t block_records = 256;
+
+// Appends one record in the compact binary form used inside segment blocks
+inline void append_record(std::string &out, const weatherRegistration &entry) {
+    auto put = [&out](const auto &value) { out.append(reinterpret_cast<const char *>(&value), sizeof(value)); };
+    put(static_cast<std::int32_t>(entry.m_id));
+    put(static_cast<std::int32_t>(entry.m_date));
+    put(static_cast<std::int32_t>(entry.m_time));
+    put(static_cast<std::int32_t>(entry.m_humidity));
+    put(entry.m_lat);
+    put(entry.m_lon);
+    put(entry.m_temperature);
+    put(static_cast<std::uint16_t>(std::min<std::size_t>(entry.m_placeName.size(), UINT16_MAX)));
+    out.append(entry.m_placeName, 0, UINT16_MAX);
+}
+
+// Reads the record at pos and moves pos past it; throws on truncated input
+inline weatherRegistration read_record(std::string_view in, std::size_t &pos) {
+    auto get = [&in, &pos](auto &value) {
+        if (in.size() - pos < sizeof(value))
+            throw std::runtime_error("truncated weather record");
+        std::memcpy(&value, in.data() + pos, sizeof(value));
+        pos += sizeof(value);
+    };
+    std::int32_t id, date, time, humidity;
+    double lat, lon, temperature;
+    std::uint16_t name_size;
+    get(id), get(date), get(time), get(humidity), get(lat), get(lon), get(temperature), get(name_size);
+    if (in.size() - pos < name_size)
+        throw std::runtime_error("truncated weather record");
+    weatherRegistration entry{ id, date, time, std::string(in.substr(pos, name_size)), lat, lon, temperature, humidity };
+    pos += name_size;
+    return entry;
+}
+
+class segment_t {
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct header_t {
+        char magic[4];
+        std::uint32_t records;
+        std::uint32_t blocks;
+        std::uint32_t dates;
+        std::int32_t min_date, max_date;
+        std::int32_t min_id, max_id;
+    };
+    struct id_entry_t { std::int32_t id; std::uint32_t pos; };
+    struct date_entry_t { std::int32_t date; std::uint32_t block; };
+    struct block_entry_t { std::uint64_t offset; std::uint32_t size; std::uint32_t raw_size; };
+
+    // Writes records, in insertion order, to a new segment file at path
+    static void write(const std::string &path, const weatherStation_t &records) {
+        header_t header{ { 'W', 'S', 'G', '1' }, static_cast<std::uint32_t>(records.size()), 0, 0,
+                         INT32_MAX, INT32_MIN, INT32_MAX, INT32_MIN };
+
+        std::vector<id_entry_t> ids;
+        std::vector<date_entry_t> dates;
+        for (std::size_t i = 0; i < records.size(); ++i) {
+            const auto &entry = records[i];
+            ids.push_back({ entry.m_id, static_cast<std::uint32_t>(i) });
+            dates.push_back({ entry.m_date, static_cast<std::uint32_t>(i / block_records) });
+            header.min_date = std::min(header.min_date, entry.m_date);
+            header.max_date = std::max(header.max_date, entry.m_date);
+            header.min_id = std::min(header.min_id, entry.m_id);
+            header.max_id = std::max(header.max_id, entry.m_id);
+        }
+        std::sort(ids.begin(), ids.end(), [](auto a, auto b) { return a.id != b.id ? a.id < b.id : a.pos < b.pos; });
+        std::sort(dates.begin(), dates.end(), [](auto a, auto b) { return a.date != b.date ? a.date < b.date : a.block < b.block; });
+        dates.erase(std::unique(dates.begin(), dates.end(),
+                                [](auto a, auto b) { return a.date == b.date && a.block == b.block; }),
+                    dates.end());
+
+        std::vector<block_entry_t> blocks;
+        std::string blob;
+        for (std::size_t first = 0; first < records.size(); first += block_records) {
+            std::string raw;
+            for (std::size_t i = first; i < std::min(first + block_records, records.size()); ++i)
+                append_record(raw, records[i]);
+
+            uLongf size = compressBound(raw.size());
+            std::string compressed(size, '\0');
+            if (compress2(reinterpret_cast<Bytef *>(compressed.data()), &size,
+                          reinterpret_cast<const Bytef *>(raw.data()), raw.size(), Z_BEST_SPEED) != Z_OK)
+                throw std::runtime_error("failed to compress segment block");
+            blocks.push_back({ blob.size(), static_cast<std::uint32_t>(size), static_cast<std::uint32_t>(raw.size()) });
+            blob.append(compressed, 0, size);
+        }
+        header.blocks = static_cast<std::uint32_t>(blocks.size());
+        header.dates = static_cast<std::uint32_t>(dates.size());
+
+        std::uint64_t data_start = sizeof(header_t) + ids.size() * sizeof(id_entry_t) +
+                                   dates.size() * sizeof(date_entry_t) + blocks.size() * sizeof(block_entry_t);
+        for (auto &block : blocks)
+            block.offset += data_start;
+
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("cannot create segment " + path + ": " + std::strerror(errno));
+        auto put = [fd, &path](const void *data, std::size_t size) {
+            for (auto p = static_cast<const char *>(data); size > 0;) {
+                auto n = ::write(fd, p, size);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0) {
+                    auto err = errno;
+                    ::close(fd);
+                    throw std::runtime_error("cannot write segment " + path + ": " + std::strerror(err));
+                }
+                p += n;
+                size -= static_cast<std::size_t>(n);
+            }
+        };
+        put(&header, sizeof(header));
+        put(ids.data(), ids.size() * sizeof(id_entry_t));
+        put(dates.data(), dates.size() * sizeof(date_entry_t));
+        put(blocks.data(), blocks.size() * sizeof(block_entry_t));
+        put(blob.data(), blob.size());
+        ::close(fd);
+    }
+
+    explicit segment_t(const std::string &path) : m_path{ path } {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("cannot open segment " + path + ": " + std::strerror(errno));
+        struct stat st{};
+        ::fstat(fd, &st);
+        m_size = static_cast<std::size_t>(st.st_size);
+        void *base = m_size >= sizeof(header_t) ? ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (base == MAP_FAILED)
+            throw std::runtime_error("cannot map segment " + path);
+        m_base = static_cast<const char *>(base);
+
+        m_header = reinterpret_cast<const header_t *>(m_base);
+        m_ids = reinterpret_cast<const id_entry_t *>(m_header + 1);
+        m_dates = reinterpret_cast<const date_entry_t *>(m_ids + m_header->records);
+        m_blocks = reinterpret_cast<const block_entry_t *>(m_dates + m_header->dates);
+        auto index_end = reinterpret_cast<const char *>(m_blocks + m_header->blocks);
+        if (std::memcmp(m_header->magic, "WSG1", 4) != 0 || index_end > m_base + m_size ||
+            (m_header->blocks > 0 && m_blocks[m_header->blocks - 1].offset + m_blocks[m_header->blocks - 1].size > m_size)) {
+            ::munmap(const_cast<char *>(m_base), m_size);
+            throw std::runtime_error("corrupt segment " + path);
+        }
+        m_dropped = std::make_unique<std::atomic<bool>[]>(m_header->records);
+        ::madvise(const_cast<char *>(m_base), m_size, MADV_RANDOM);
+    }
+
+    ~segment_t() { ::munmap(const_cast<char *>(m_base), m_size); }
+
+    segment_t(const segment_t &) = delete;
+    segment_t &operator=(const segment_t &) = delete;
+
+    const std::string &path() const { return m_path; }
+    std::size_t records() const { return m_header->records; }
+    std::size_t blocks() const { return m_header->blocks; }
+    std::size_t bytes() const { return m_size; }
+
+    // Position of the first record in the insertion order of the whole store
+    std::uint64_t first_seq() const { return m_first_seq; }
+
+    bool may_hold_dates(int from, int to) const { return m_header->min_date <= to && m_header->max_date >= from; }
+
+    // Position of the first record with this ID, or npos
+    std::size_t find(int id) const {
+        if (id < m_header->min_id || id > m_header->max_id)
+            return npos;
+        auto end = m_ids + m_header->records;
+        auto it = std::lower_bound(m_ids, end, id, [](const id_entry_t &e, int key) { return e.id < key; });
+        for (; it != end && it->id == id; ++it) {
+            if (!dropped(it->pos))
+                return it->pos;
+        }
+        return npos;
+    }
+
+    weatherRegistration at(std::size_t pos) const {
+        auto block = decompress(pos / block_records);
+        std::size_t offset = 0;
+        for (std::size_t i = pos % block_records; i > 0; --i)
+            read_record(block, offset);
+        return read_record(block, offset);
+    }
+
+    // Hides a record that was superseded by a newer copy in the hot store
+    void drop(std::size_t pos) { m_dropped[pos].store(true, std::memory_order_relaxed); }
+
+    // Calls fn for the live records from pos to the end of its block; returns the position
+    // after the block
+    template <typename FN>
+    std::size_t read_from(std::size_t pos, FN fn) const {
+        auto block = pos / block_records;
+        scan_block(block, [&fn, &pos](std::size_t at, const weatherRegistration &entry) {
+            if (at >= pos)
+                fn(entry);
+        });
+        return std::min<std::size_t>((block + 1) * block_records, m_header->records);
+    }
+
+    // Calls fn for every live record, in insertion order
+    template <typename FN>
+    void for_each(FN fn) const {
+        for (std::size_t block = 0; block < m_header->blocks; ++block)
+            scan_block(block, [&fn](std::size_t, const weatherRegistration &entry) { fn(entry); });
+    }
+
+    // Calls fn for every live record of the given date; only blocks holding the date are read
+    template <typename FN>
+    void for_date(int date, FN fn) const {
+        if (date < m_header->min_date || date > m_header->max_date)
+            return;
+        auto end = m_dates + m_header->dates;
+        auto it = std::lower_bound(m_dates, end, date, [](const date_entry_t &e, int key) { return e.date < key; });
+        for (; it != end && it->date == date; ++it) {
+            scan_block(it->block, [&fn, date](std::size_t, const weatherRegistration &entry) {
+                if (entry.m_date == date)
+                    fn(entry);
+            });
+        }
+    }
+
+    // Calls fn(pos, record) for the live records of one block
+    template <typename FN>
+    void scan_block(std::size_t block, FN fn) const {
+        auto raw = decompress(block);
+        std::size_t offset = 0;
+        for (std::size_t pos = block * block_records; offset < raw.size(); ++pos) {
+            auto entry = read_record(raw, offset);
+            if (!dropped(pos))
+                fn(pos, entry);
+        }
+    }
+
+private:
+    bool dropped(std::size_t pos) const { return m_dropped[pos].load(std::memory_order_relaxed); }
+
+    std::string decompress(std::size_t block) const {
+        const auto &entry = m_blocks[block];
+        std::string raw(entry.raw_size, '\0');
+        uLongf size = entry.raw_size;
+        if (uncompress(reinterpret_cast<Bytef *>(raw.data()), &size,
+                       reinterpret_cast<const Bytef *>(m_base + entry.offset), entry.size) != Z_OK ||
+            size != entry.raw_size)
+            throw std::runtime_error("corrupt block in segment " + m_path);
+        return raw;
+    }
+
+
+    std::string m_path;
+    std::size_t m_size = 0;
+    const char *m_base = nullptr;
+    const header_t *m_header = nullptr;
+    const id_entry_t *m_ids = nullptr;
+    const date_entry_t *m_dates = nullptr;
+    const block_entry_t *m_blocks = nullptr;
+    std::unique_ptr<std::atomic<bool>[]> m_dropped;
+    std::uint64_t m_first_seq = 0;
+
+    friend class cold_store_t;
+};
+
+using segments_t = std::vector<std::shared_ptr<segment_t>>;
+
+// The segments of one server, oldest first
+class cold_store_t {
+public:
+    // Segment files left in dir by an earlier run are removed: the hot store they belonged to
+    // is gone, so they would only resurrect part of it.
+    explicit cold_store_t(std::string dir) : m_dir{ std::move(dir) } {
+        namespace fs = std::filesystem;
+        fs::create_directories(m_dir);
+        for (const auto &file : fs::directory_iterator(m_dir)) {
+            auto name = file.path().filename().string();
+            if (name.rfind("segment-", 0) == 0 && (file.path().extension() == ".wseg" || file.path().extension() == ".tmp"))
+                fs::remove(file.path());
+        }
+    }
+
+    // Writes records to a new segment file and opens it. The caller publishes it with add().
+    // Safe to call from any thread, one compaction at a time.
+    std::shared_ptr<segment_t> write(const weatherStation_t &records) {
+        auto path = m_dir + "/segment-" + std::to_string(m_next_file++) + ".wseg";
+        segment_t::write(path + ".tmp", records);
+        std::filesystem::rename(path + ".tmp", path);
+        return std::make_shared<segment_t>(path);
+    }
+
+    // Publishes a segment holding the records that follow those of the previous one
+    void add(std::shared_ptr<segment_t> segment) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        segment->m_first_seq = m_end_seq;
+        m_end_seq += segment->records();
+        m_segments.push_back(std::move(segment));
+    }
+
+    segments_t segments() const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_segments;
+    }
+
+    // Number of records ever compacted, i.e. the insertion position of the oldest hot record
+    std::uint64_t end_seq() const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_end_seq;
+    }
+
+    // The segment holding the record at insertion position seq, if any
+    std::shared_ptr<segment_t> locate(std::uint64_t seq) const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto it = std::upper_bound(m_segments.begin(), m_segments.end(), seq,
+                                   [](std::uint64_t key, const auto &segment) { return key < segment->first_seq(); });
+        if (it == m_segments.begin() || seq >= (*std::prev(it))->first_seq() + (*std::prev(it))->records())
+            return nullptr;
+        return *std::prev(it);
+    }
+
+    // Forgets every segment, for a store replaced as a whole, and removes their files. end_seq
+    // keeps counting, so insertion positions are never reused; scans still holding a segment
+    // keep reading its mapping.
+    void clear() {
+        segments_t segments;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            segments.swap(m_segments);
+        }
+        for (const auto &segment : segments)
+            discard(segment);
+    }
+
+    // Removes the file of a segment that was written but never added
+    static void discard(const std::shared_ptr<segment_t> &segment) {
+        std::error_code ignored;
+        std::filesystem::remove(segment->path(), ignored);
+    }
+
+private:
+    std::string m_dir;
+    std::atomic<std::uint64_t> m_next_file{ 1 };
+    mutable std::mutex m_lock;
+    segments_t m_segments;
+    std::uint64_t m_end_seq = 0;
+};
+
+} // namespace weather_cold
@@ -0,0 +1,122 @@
+#pragma once
+
+// Accept-Encoding negotiation and one-shot body compression for HTTP responses.
+//
+// gzip and deflate come from zlib; zstd is offered only when built with WEATHER_WITH_ZSTD.
+
+#include <zlib.h>
+#ifdef WEATHER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace weather_encoding {
+
+enum class encoding_t : std::size_t { identity, gzip, deflate, zstd };
+
+inline const char *name(encoding_t encoding) {
+    switch (encoding) {
+    case encoding_t::gzip: return "gzip";
+    case encoding_t::deflate: return "deflate";
+    case encoding_t::zstd: return "zstd";
+    default: return "identity";
+    }
+}
+
+// Picks the encoding with the highest q-value in an Accept-Encoding header. Ties go to the
+// one that compresses best: zstd, then gzip, then deflate. "*" stands for gzip and deflate
+// where they are not named themselves, so "gzip;q=0, *" still refuses gzip; zstd is used
+// only when named.
+inline encoding_t negotiate(std::string_view header) {
+    constexpr double unnamed = -1.0;
+    std::array<double, 4> named;
+    named.fill(unnamed);
+    double any = unnamed;
+
+    while (!header.empty()) {
+        auto comma = header.find(',');
+        auto item = header.substr(0, comma);
+        header.remove_prefix(comma == std::string_view::npos ? header.size() : comma + 1);
+
+        auto semicolon = item.find(';');
+        auto token = item.substr(0, semicolon);
+        while (!token.empty() && std::isspace(static_cast<unsigned char>(token.front())))
+            token.remove_prefix(1);
+        while (!token.empty() && std::isspace(static_cast<unsigned char>(token.back())))
+            token.remove_suffix(1);
+
+        double q = 1.0;
+        if (semicolon != std::string_view::npos) {
+            auto params = item.substr(semicolon + 1);
+            auto at = params.find("q=");
+            if (at != std::string_view::npos)
+                q = std::strtod(std::string(params.substr(at + 2)).c_str(), nullptr);
+        }
+
+        std::string lower(token);
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (lower == "gzip" || lower == "x-gzip")
+            named[static_cast<std::size_t>(encoding_t::gzip)] = q;
+        else if (lower == "deflate")
+            named[static_cast<std::size_t>(encoding_t::deflate)] = q;
+#ifdef WEATHER_WITH_ZSTD
+        else if (lower == "zstd")
+            named[static_cast<std::size_t>(encoding_t::zstd)] = q;
+#endif
+        else if (lower == "*")
+            any = q;
+    }
+
+    // In order of preference on equal q
+    encoding_t best = encoding_t::identity;
+    double best_q = 0.0;
+    for (auto candidate : { encoding_t::zstd, encoding_t::gzip, encoding_t::deflate }) {
+        double q = named[static_cast<std::size_t>(candidate)];
+        if (q == unnamed && candidate != encoding_t::zstd)
+            q = any;
+        if (q > best_q) {
+            best = candidate;
+            best_q = q;
+        }
+    }
+    return best;
+}
+
+inline std::string compress(std::string_view body, encoding_t encoding) {
+#ifdef WEATHER_WITH_ZSTD
+    if (encoding == encoding_t::zstd) {
+        std::string out(ZSTD_compressBound(body.size()), '\0');
+        auto size = ZSTD_compress(out.data(), out.size(), body.data(), body.size(), 3);
+        if (ZSTD_isError(size))
+            throw std::runtime_error(ZSTD_getErrorName(size));
+        out.resize(size);
+        return out;
+    }
+#endif
+
+    // gzip and deflate (zlib framing, as HTTP defines it) differ only in the window bits
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, encoding == encoding_t::gzip ? 15 + 16 : 15,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("deflateInit2 failed");
+    std::string out(deflateBound(&stream, body.size()) + 32, '\0');
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(body.data()));
+    stream.avail_in = static_cast<uInt>(body.size());
+    stream.next_out = reinterpret_cast<Bytef *>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+    int rc = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (rc != Z_STREAM_END)
+        throw std::runtime_error("deflate failed");
+    return out;
+}
+
+} // namespace weather_encoding
@@ -0,0 +1,191 @@
+#pragma once
+
+// Encoders and streaming compressors for GET /export.
+//
+// Records are written as NDJSON (one POST / body per line), CSV (the layout the --seed loader
+// reads) or binary (a "WSB1" magic followed by records in the segment block encoding). The
+// output may be compressed chunk by chunk with gzip, or with zstd when built with
+// WEATHER_WITH_ZSTD.
+
+#include "weather_registration.hpp"
+#include "cold_store.hpp"
+
+#include <zlib.h>
+#ifdef WEATHER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <charconv>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace weather_export {
+
+enum class format_t { ndjson, csv, binary };
+enum class compression_t { none, gzip, zstd };
+
+inline std::optional<format_t> parse_format(std::string_view name) {
+    if (name == "ndjson")
+        return format_t::ndjson;
+    if (name == "csv")
+        return format_t::csv;
+    if (name == "binary")
+        return format_t::binary;
+    return std::nullopt;
+}
+
+inline std::optional<compression_t> parse_compression(std::string_view name) {
+    if (name == "none")
+        return compression_t::none;
+    if (name == "gzip")
+        return compression_t::gzip;
+#ifdef WEATHER_WITH_ZSTD
+    if (name == "zstd")
+        return compression_t::zstd;
+#endif
+    return std::nullopt;
+}
+
+inline const char *content_type(format_t format) {
+    switch (format) {
+    case format_t::ndjson: return "application/x-ndjson; charset=utf-8";
+    case format_t::csv: return "text/csv; charset=utf-8";
+    default: return "application/octet-stream";
+    }
+}
+
+inline const char *content_encoding(compression_t compression) {
+    return compression == compression_t::gzip ? "gzip" : compression == compression_t::zstd ? "zstd" : nullptr;
+}
+
+// What goes before the first record
+inline std::string preamble(format_t format) {
+    if (format == format_t::csv)
+        return "ID,Date,Time,PlaceName,Lat,Lon,Temperature,Humidity\n";
+    if (format == format_t::binary)
+        return "WSB1";
+    return {};
+}
+
+inline void append_csv_field(std::string &out, const std::string &field) {
+    if (field.find_first_of(",\"\r\n") == std::string::npos) {
+        out += field;
+        return;
+    }
+    out += '"';
+    for (char c : field) {
+        if (c == '"')
+            out += '"';
+        out += c;
+    }
+    out += '"';
+}
+
+inline void append(std::string &out, format_t format, const weatherRegistration &entry) {
+    switch (format) {
+    case format_t::ndjson:
+        out += json_dto::to_json(entry);
+        out += '\n';
+        break;
+    case format_t::csv: {
+        out += std::to_string(entry.m_id) + ',' + std::to_string(entry.m_date) + ',' + std::to_string(entry.m_time) + ',';
+        append_csv_field(out, entry.m_placeName);
+        for (double value : { entry.m_lat, entry.m_lon, entry.m_temperature }) {
+            char buf[32];
+            auto result = std::to_chars(buf, buf + sizeof(buf), value); // shortest exact form
+            out += ',';
+            out.append(buf, result.ptr);
+        }
+        out += ',' + std::to_string(entry.m_humidity) + '\n';
+        break;
+    }
+    case format_t::binary:
+        weather_cold::append_record(out, entry);
+        break;
+    }
+}
+
+// Compresses a stream handed over in pieces; the output of each piece can be sent right away
+class compressor_t {
+public:
+    explicit compressor_t(compression_t compression) : m_compression{ compression } {
+        if (m_compression == compression_t::gzip) {
+            m_zlib = std::make_unique<z_stream>();
+            if (deflateInit2(m_zlib.get(), Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                throw std::runtime_error("deflateInit2 failed");
+        }
+#ifdef WEATHER_WITH_ZSTD
+        if (m_compression == compression_t::zstd) {
+            m_zstd = ZSTD_createCCtx();
+            ZSTD_CCtx_setParameter(m_zstd, ZSTD_c_compressionLevel, 3);
+        }
+#endif
+    }
+
+    ~compressor_t() {
+        if (m_zlib)
+            deflateEnd(m_zlib.get());
+#ifdef WEATHER_WITH_ZSTD
+        if (m_zstd)
+            ZSTD_freeCCtx(m_zstd);
+#endif
+    }
+
+    compressor_t(const compressor_t &) = delete;
+    compressor_t &operator=(const compressor_t &) = delete;
+
+    // Returns the output for in; with last set, the stream is finished as well
+    std::string process(std::string in, bool last) {
+        if (m_compression == compression_t::gzip)
+            return deflate_piece(in, last);
+#ifdef WEATHER_WITH_ZSTD
+        if (m_compression == compression_t::zstd)
+            return zstd_piece(in, last);
+#endif
+        return in;
+    }
+
+private:
+    std::string deflate_piece(const std::string &in, bool last) {
+        std::string out;
+        m_zlib->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+        m_zlib->avail_in = static_cast<uInt>(in.size());
+        char buf[64 * 1024];
+        int rc;
+        do {
+            m_zlib->next_out = reinterpret_cast<Bytef *>(buf);
+            m_zlib->avail_out = sizeof(buf);
+            rc = deflate(m_zlib.get(), last ? Z_FINISH : Z_NO_FLUSH);
+            out.append(buf, sizeof(buf) - m_zlib->avail_out);
+        } while (m_zlib->avail_out == 0 || (last && rc != Z_STREAM_END));
+        return out;
+    }
+
+#ifdef WEATHER_WITH_ZSTD
+    std::string zstd_piece(const std::string &in, bool last) {
+        std::string out;
+        ZSTD_inBuffer input{ in.data(), in.size(), 0 };
+        char buf[64 * 1024];
+        std::size_t remaining;
+        do {
+            ZSTD_outBuffer output{ buf, sizeof(buf), 0 };
+            remaining = ZSTD_compressStream2(m_zstd, &output, &input, last ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remaining))
+                throw std::runtime_error(ZSTD_getErrorName(remaining));
+            out.append(buf, output.pos);
+        } while (last ? remaining != 0 : input.pos < input.size);
+        return out;
+    }
+#endif
+
+    compression_t m_compression;
+    std::unique_ptr<z_stream> m_zlib;
+#ifdef WEATHER_WITH_ZSTD
+    ZSTD_CCtx *m_zstd = nullptr;
+#endif
+};
+
+} // namespace weather_export
@@ -0,0 +1,338 @@
+#pragma once
+
+// Zero-downtime restart: a running server hands its listening sockets and its store to a new
+// server process on the same machine, then drains and exits.
+//
+// The running server waits on the Unix socket given with --handoff PATH. A new server started
+// with --take-over PATH connects there and sends "TAKE". The old server stops taking writes
+// (they get 503 with Retry-After), copies its store and alert rules into an anonymous
+// shared-memory file (memfd) and sends that file together with its HTTP and replication
+// listening sockets in one SCM_RIGHTS message. The new server builds its store straight from
+// the mapped snapshot, starts accepting on the same sockets and answers "R". Connections that
+// queue meanwhile wait in the shared listen backlog, so none is refused.
+//
+// On "R" the old server stops accepting, closes its WebSocket subscribers with 1012 (service
+// restart) spread over the first half of the drain period, sends Connection: close on every
+// response and exits once nothing is in flight. If the new server goes away before "R", the
+// old one takes writes again and keeps serving.
+//
+// Snapshot layout, in native byte order (both sides are the same build on one machine):
+//
+//   header_t | records in weather_cold's record form | alert rules as JSON
+
+#include "weather_registration.hpp"
+#include "cold_store.hpp"
+
+#include <restinio/all.hpp>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace weather_handoff {
+
+namespace asio = restinio::asio_ns;
+using unix_socket = asio::local::stream_protocol;
+
+constexpr std::string_view take_request = "TAKE";
+constexpr char ready_reply = 'R';
+
+// The HTTP listening socket and how to stop accepting on it; filled in by main
+struct listener_t {
+    int fd = -1;
+    std::function<void()> stop;
+};
+
+struct config_t {
+    std::string listen_path;          // --handoff: hand over to a server connecting here; empty: off
+    std::string take_over_path;       // --take-over: take over from the server waiting here
+    std::chrono::seconds drain{ 10 }; // longest wait for in-flight requests after handing over
+    listener_t *listener = nullptr;
+    std::string rules;                // alert rules taken over, as JSON
+};
+
+// Set once this process has handed over: every response then closes its connection
+inline std::atomic<bool> &draining() {
+    static std::atomic<bool> flag{ false };
+    return flag;
+}
+
+[[noreturn]] inline void fail(const std::string &what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+struct header_t {
+    char magic[4];
+    std::uint32_t records;
+    std::uint64_t records_size;
+    std::uint64_t rules_size;
+};
+
+struct snapshot_t {
+    weatherStation_t records;
+    std::string rules; // JSON array of alert rules
+};
+
+// Writes records and rules to a new memfd and returns its descriptor
+inline int write_snapshot(const weatherStation_t &records, const std::string &rules) {
+    std::string body;
+    for (const auto &entry : records)
+        weather_cold::append_record(body, entry);
+    header_t header{ { 'W', 'H', 'O', '1' }, static_cast<std::uint32_t>(records.size()), body.size(), rules.size() };
+
+    int fd = ::memfd_create("weather-handoff", MFD_CLOEXEC);
+    if (fd < 0)
+        fail("memfd_create");
+    auto size = sizeof(header) + body.size() + rules.size();
+    void *base = ::ftruncate(fd, static_cast<off_t>(size)) == 0 ? ::mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (base == MAP_FAILED) {
+        auto error = errno;
+        ::close(fd);
+        errno = error;
+        fail("cannot map the handoff snapshot");
+    }
+    auto *out = static_cast<char *>(base);
+    std::memcpy(out, &header, sizeof(header));
+    std::memcpy(out + sizeof(header), body.data(), body.size());
+    std::memcpy(out + sizeof(header) + body.size(), rules.data(), rules.size());
+    ::munmap(base, size);
+    return fd;
+}
+
+// Reads a snapshot from the memfd written by write_snapshot; closes fd
+inline snapshot_t read_snapshot(int fd) {
+    struct stat st{};
+    ::fstat(fd, &st);
+    auto size = static_cast<std::size_t>(st.st_size);
+    void *base = size >= sizeof(header_t) ? ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (base == MAP_FAILED)
+        throw std::runtime_error("cannot map the handoff snapshot");
+    std::unique_ptr<void, std::function<void(void *)>> mapping{ base, [size](void *p) { ::munmap(p, size); } };
+
+    header_t header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, "WHO1", 4) != 0 || sizeof(header) + header.records_size + header.rules_size > size)
+        throw std::runtime_error("corrupt handoff snapshot");
+    std::string_view body{ static_cast<const char *>(base) + sizeof(header), header.records_size };
+
+    snapshot_t snapshot;
+    snapshot.records.reserve(header.records);
+    std::size_t pos = 0;
+    while (pos < body.size())
+        snapshot.records.push_back(weather_cold::read_record(body, pos));
+    snapshot.rules.assign(body.data() + body.size(), header.rules_size);
+    return snapshot;
+}
+
+// Sends one byte and the descriptors in one message
+inline bool send_fds(int socket, const std::vector<int> &fds) {
+    char byte = static_cast<char>(fds.size());
+    iovec iov{ &byte, 1 };
+    std::array<char, CMSG_SPACE(sizeof(int) * 4)> control{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    auto *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    return ::sendmsg(socket, &msg, MSG_NOSIGNAL) == 1;
+}
+
+inline std::vector<int> receive_fds(int socket) {
+    char byte = 0;
+    iovec iov{ &byte, 1 };
+    std::array<char, CMSG_SPACE(sizeof(int) * 4)> control{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    if (::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC) != 1)
+        throw std::runtime_error("the running server refused the handoff");
+    std::vector<int> fds;
+    for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            fds.resize((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            std::memcpy(fds.data(), CMSG_DATA(cmsg), sizeof(int) * fds.size());
+        }
+    }
+    if (fds.size() < 2) {
+        for (int fd : fds)
+            ::close(fd);
+        throw std::runtime_error("incomplete handoff");
+    }
+    return fds;
+}
+
+// Waits for a new server to take over. Lives on the I/O thread.
+class source_t {
+public:
+    struct hooks_t {
+        // Stop taking writes and pass a snapshot memfd (or -1 on failure) to the callback
+        std::function<void(std::function<void(int)>)> prepare;
+        // The listening sockets to hand over: HTTP first, then replication if any
+        std::function<std::vector<int>()> listeners;
+        // The new server is accepting: stop accepting and drain
+        std::function<void()> handed_over;
+        // The new server went away before it was ready: take writes again
+        std::function<void()> aborted;
+    };
+
+    source_t(asio::io_context &ioctx, std::string path, hooks_t hooks)
+        : m_path{ std::move(path) }, m_acceptor{ ioctx }, m_hooks{ std::move(hooks) } {
+        ::unlink(m_path.c_str()); // left by a server that did not exit cleanly
+        m_acceptor = unix_socket::acceptor{ ioctx, unix_socket::endpoint{ m_path } };
+        struct stat st{};
+        ::stat(m_path.c_str(), &st);
+        m_inode = st.st_ino;
+        accept();
+    }
+
+    // The server that took over may already wait on the same path: only remove our own socket
+    ~source_t() {
+        struct stat st{};
+        if (::stat(m_path.c_str(), &st) == 0 && st.st_ino == m_inode)
+            ::unlink(m_path.c_str());
+    }
+
+    source_t(const source_t &) = delete;
+    source_t &operator=(const source_t &) = delete;
+
+    std::string render() const {
+        return "# HELP weather_handoffs_aborted_total Handoffs abandoned because the new server went away.\n"
+               "# TYPE weather_handoffs_aborted_total counter\n"
+               "weather_handoffs_aborted_total " + std::to_string(m_aborted) + "\n"
+               "# HELP weather_draining Whether this server has handed over and is draining.\n"
+               "# TYPE weather_draining gauge\n"
+               "weather_draining " + std::to_string(draining() ? 1 : 0) + "\n";
+    }
+
+private:
+    struct session_t {
+        explicit session_t(unix_socket::socket s) : socket{ std::move(s) } {}
+        unix_socket::socket socket;
+        std::array<char, 4> in{};
+    };
+    using session_ptr = std::shared_ptr<session_t>;
+
+    void accept() {
+        m_acceptor.async_accept([this](const auto &ec, unix_socket::socket socket) {
+            if (ec)
+                return;
+            auto session = std::make_shared<session_t>(std::move(socket));
+            asio::async_read(session->socket, asio::buffer(session->in), [this, session](const auto &ec, std::size_t) {
+                if (ec || std::string_view(session->in.data(), 4) != take_request)
+                    return accept();
+                m_hooks.prepare([this, session](int snapshot) { send(session, snapshot); });
+            });
+        });
+    }
+
+    void send(const session_ptr &session, int snapshot) {
+        bool sent = false;
+        if (snapshot >= 0) {
+            auto fds = m_hooks.listeners();
+            fds.insert(fds.begin() + 1, snapshot);
+            sent = send_fds(session->socket.native_handle(), fds);
+            ::close(snapshot);
+        }
+        if (!sent)
+            return abort();
+        asio::async_read(session->socket, asio::buffer(session->in.data(), 1), [this, session](const auto &ec, std::size_t) {
+            if (ec || session->in[0] != ready_reply)
+                return abort();
+            asio::error_code ignored;
+            m_acceptor.close(ignored);
+            m_hooks.handed_over();
+        });
+    }
+
+    void abort() {
+        ++m_aborted;
+        m_hooks.aborted();
+        accept();
+    }
+
+    std::string m_path;
+    ino_t m_inode = 0;
+    unix_socket::acceptor m_acceptor;
+    hooks_t m_hooks;
+    std::uint64_t m_aborted = 0;
+};
+
+// What a new server takes over from the running one
+class taken_t {
+public:
+    int listener = -1;             // HTTP
+    int replication_listener = -1; // -1 if the old server did not serve followers
+    snapshot_t snapshot;
+
+    explicit taken_t(const std::string &path) {
+        m_socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_socket < 0)
+            fail("socket");
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        try {
+            if (::connect(m_socket, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0)
+                fail("cannot reach the running server at " + path);
+            if (::send(m_socket, take_request.data(), take_request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(take_request.size()))
+                fail("handoff request");
+            auto fds = receive_fds(m_socket);
+            listener = fds[0];
+            if (fds.size() > 2)
+                replication_listener = fds[2];
+            snapshot = read_snapshot(fds[1]);
+        } catch (...) {
+            ::close(m_socket); // the old server sees the handoff abort and keeps serving
+            throw;
+        }
+    }
+
+    ~taken_t() { ::close(m_socket); }
+
+    taken_t(const taken_t &) = delete;
+    taken_t &operator=(const taken_t &) = delete;
+
+    // Tells the old server that this one accepts now, so it can drain and exit
+    void ready() {
+        ::send(m_socket, &ready_reply, 1, MSG_NOSIGNAL);
+    }
+
+private:
+    int m_socket = -1;
+};
+
+// Swaps the socket RESTinio has just bound for the inherited listener, before it listens
+inline void adopt(asio::ip::tcp::acceptor &acceptor, int fd) {
+    sockaddr_storage addr{};
+    socklen_t size = sizeof(addr);
+    if (::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &size) != 0)
+        fail("inherited listener");
+    acceptor.close();
+    acceptor.assign(addr.ss_family == AF_INET6 ? asio::ip::tcp::v6() : asio::ip::tcp::v4(), fd);
+}
+
+} // namespace weather_handoff
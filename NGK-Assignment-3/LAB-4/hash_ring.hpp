@@ -0,0 +1,76 @@
+#pragma once
+
+// Consistent-hash ring for spreading the weather store over several server processes.
+//
+// Every node is placed on a 64-bit ring at vnodes pseudo-random points; a key belongs to the
+// node of the first point at or after the key's hash. Adding a node only takes over the arcs
+// just before its own points, so about 1/N of the keys move and all of them move to the new
+// node; keys never move between the nodes that were already there.
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace weather_cluster {
+
+// FNV-1a with a splitmix64 finalizer, so nearby keys ("1", "2", ...) land far apart
+inline std::uint64_t hash_key(std::string_view key) {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+class hash_ring_t {
+public:
+    explicit hash_ring_t(std::size_t vnodes = 128) : m_vnodes{ vnodes } {}
+
+    // Adds a node ("host:port") and returns its index
+    std::size_t add(const std::string &node) {
+        if (std::find(m_nodes.begin(), m_nodes.end(), node) != m_nodes.end())
+            throw std::invalid_argument("node " + node + " is already in the ring");
+        auto index = static_cast<std::uint32_t>(m_nodes.size());
+        m_nodes.push_back(node);
+        for (std::size_t v = 0; v < m_vnodes; ++v)
+            m_points.emplace_back(hash_key(node + "#" + std::to_string(v)), index);
+        std::sort(m_points.begin(), m_points.end());
+        return index;
+    }
+
+    // Index of the node that owns key
+    std::size_t owner(std::string_view key) const {
+        if (m_points.empty())
+            throw std::logic_error("empty hash ring");
+        auto it = std::lower_bound(m_points.begin(), m_points.end(), std::make_pair(hash_key(key), std::uint32_t{ 0 }));
+        return (it == m_points.end() ? m_points.front() : *it).second;
+    }
+
+    const std::vector<std::string> &nodes() const { return m_nodes; }
+
+    // Share of the hash space owned by each node, by index
+    std::vector<double> shares() const {
+        std::vector<double> share(m_nodes.size());
+        if (m_points.size() == 1)
+            share[0] = 1.0;
+        for (std::size_t i = 0; i < m_points.size() && m_points.size() > 1; ++i) {
+            auto from = i == 0 ? m_points.back().first : m_points[i - 1].first;
+            share[m_points[i].second] += static_cast<double>(m_points[i].first - from) / 18446744073709551616.0;
+        }
+        return share;
+    }
+
+private:
+    std::size_t m_vnodes;
+    std::vector<std::string> m_nodes;
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> m_points; // sorted (hash, node index)
+};
+
+} // namespace weather_cluster
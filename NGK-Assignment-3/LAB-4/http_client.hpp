@@ -0,0 +1,371 @@
+#pragma once
+
+// Blocking HTTP/1.1 and WebSocket clients for talking to the weather server nodes of a
+// cluster. Each node client keeps a small pool of keep-alive connections, so concurrent
+// requests from the proxy's threads do not queue behind each other or reconnect every time.
+// A request has a deadline for connecting and one for the whole exchange, so a node that
+// accepts but never answers cannot hold a proxy thread.
+
+#include <restinio/all.hpp>
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace weather_cluster {
+
+namespace asio = restinio::asio_ns;
+using tcp = asio::ip::tcp;
+
+struct response_t {
+    int status = 0;
+    std::string reason;
+    std::string body;
+};
+
+// A node did not connect or answer within its deadline
+struct timeout_error : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+struct timeouts_t {
+    std::chrono::milliseconds connect{ 1000 };
+    std::chrono::milliseconds request{ 8000 }; // writing the request and reading the response
+};
+
+class http_client_t {
+public:
+    // node is "host:port"
+    explicit http_client_t(const std::string &node, timeouts_t timeouts = {}) : m_node{ node }, m_timeouts{ timeouts } {
+        auto colon = node.rfind(':');
+        if (colon == std::string::npos)
+            throw std::invalid_argument("node must be HOST:PORT: " + node);
+        m_host = node.substr(0, colon);
+        m_port = node.substr(colon + 1);
+    }
+
+    http_client_t(const http_client_t &) = delete;
+    http_client_t &operator=(const http_client_t &) = delete;
+
+    const std::string &node() const { return m_node; }
+    const std::string &host() const { return m_host; }
+    const std::string &port() const { return m_port; }
+
+    // Sends one request and reads the whole response. headers are extra "Name: value\r\n"
+    // lines. Throws timeout_error when a deadline passes, other exceptions when the node
+    // cannot be reached.
+    response_t request(std::string_view method, std::string_view target, std::string_view body = {},
+                       std::string_view headers = {}) {
+        std::string request;
+        request.append(method).append(" ").append(target).append(" HTTP/1.1\r\nHost: ").append(m_node).append("\r\n");
+        if (!body.empty() || method == "POST" || method == "PUT")
+            request.append("Content-Type: application/json\r\nContent-Length: ").append(std::to_string(body.size())).append("\r\n");
+        request.append(headers).append("\r\n").append(body);
+
+        // A pooled connection may have been closed by the node meanwhile: retry once on a fresh
+        // one. A node that timed out is not asked again.
+        for (int attempt = 0;; ++attempt) {
+            auto conn = checkout(attempt > 0);
+            try {
+                conn->deadline = std::chrono::steady_clock::now() + m_timeouts.request;
+                run(*conn, [&](auto handler) { asio::async_write(conn->socket, asio::buffer(request), handler); });
+                bool keep_alive = true;
+                auto response = read_response(*conn, keep_alive);
+                if (keep_alive)
+                    checkin(std::move(conn));
+                return response;
+            } catch (const timeout_error &) {
+                throw;
+            } catch (const std::exception &) {
+                if (attempt > 0 || !conn->reused)
+                    throw;
+            }
+        }
+    }
+
+private:
+    // Each connection runs its I/O on its own io_context, so one thread can wait on it with a
+    // deadline while other threads use other connections
+    struct connection_t {
+        asio::io_context ioctx;
+        tcp::socket socket{ ioctx };
+        std::string buffer; // bytes read past the previous response
+        bool reused = false;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    static constexpr std::size_t max_idle = 16;
+
+    std::unique_ptr<connection_t> checkout(bool fresh) {
+        if (!fresh) {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_idle.empty()) {
+                auto conn = std::move(m_idle.back());
+                m_idle.pop_back();
+                conn->reused = true;
+                return conn;
+            }
+        }
+        auto conn = std::make_unique<connection_t>();
+        tcp::resolver resolver{ conn->ioctx };
+        auto endpoints = resolver.resolve(m_host, m_port);
+        conn->deadline = std::chrono::steady_clock::now() + m_timeouts.connect;
+        run(*conn, [&](auto handler) {
+            asio::async_connect(conn->socket, endpoints, [handler](const asio::error_code &ec, const tcp::endpoint &) { handler(ec, 0); });
+        });
+        conn->socket.set_option(tcp::no_delay{ true });
+        return conn;
+    }
+
+    void checkin(std::unique_ptr<connection_t> conn) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_idle.size() < max_idle)
+            m_idle.push_back(std::move(conn));
+    }
+
+    // Starts one asynchronous operation with start(handler) and waits for it until the
+    // connection's deadline. On timeout the socket is closed, which cancels the operation.
+    template <typename START>
+    static std::size_t run(connection_t &conn, START start) {
+        asio::error_code result = asio::error::would_block;
+        std::size_t bytes = 0;
+        start([&result, &bytes](const asio::error_code &ec, std::size_t n) {
+            result = ec;
+            bytes = n;
+        });
+        conn.ioctx.restart();
+        conn.ioctx.run_until(conn.deadline);
+        if (result == asio::error::would_block) {
+            asio::error_code ignored;
+            conn.socket.close(ignored);
+            conn.ioctx.restart();
+            conn.ioctx.run(); // the cancelled handler still refers to result and bytes
+            throw timeout_error("node did not answer in time");
+        }
+        if (result)
+            throw std::runtime_error(result.message());
+        return bytes;
+    }
+
+    static std::size_t read_some(connection_t &conn, char *chunk, std::size_t size) {
+        return run(conn, [&](auto handler) { conn.socket.async_read_some(asio::buffer(chunk, size), handler); });
+    }
+
+    // Reads until the buffer holds at least size bytes
+    static void fill(connection_t &conn, std::size_t size) {
+        char chunk[16 * 1024];
+        while (conn.buffer.size() < size) {
+            auto n = read_some(conn, chunk, sizeof(chunk));
+            conn.buffer.append(chunk, n);
+        }
+    }
+
+    // Reads up to and including the next "\r\n"; returns the line without it
+    static std::string read_line(connection_t &conn) {
+        std::size_t end;
+        char chunk[16 * 1024];
+        while ((end = conn.buffer.find("\r\n")) == std::string::npos) {
+            auto n = read_some(conn, chunk, sizeof(chunk));
+            conn.buffer.append(chunk, n);
+        }
+        auto line = conn.buffer.substr(0, end);
+        conn.buffer.erase(0, end + 2);
+        return line;
+    }
+
+    static response_t read_response(connection_t &conn, bool &keep_alive) {
+        response_t response;
+        auto status_line = read_line(conn);
+        if (status_line.compare(0, 5, "HTTP/") != 0 || status_line.size() < 12)
+            throw std::runtime_error("malformed HTTP status line");
+        response.status = std::stoi(status_line.substr(9, 3));
+        response.reason = status_line.size() > 13 ? status_line.substr(13) : std::string();
+
+        std::size_t length = 0;
+        bool chunked = false;
+        for (std::string line; !(line = read_line(conn)).empty();) {
+            auto colon = line.find(':');
+            if (colon == std::string::npos)
+                continue;
+            std::string name = line.substr(0, colon);
+            for (auto &c : name)
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            auto value = line.substr(line.find_first_not_of(' ', colon + 1));
+            if (name == "content-length")
+                length = std::stoul(value);
+            else if (name == "transfer-encoding" && value.find("chunked") != std::string::npos)
+                chunked = true;
+            else if (name == "connection" && value.find("close") != std::string::npos)
+                keep_alive = false;
+        }
+
+        if (chunked) {
+            for (;;) {
+                auto size = std::stoul(read_line(conn), nullptr, 16);
+                fill(conn, size + 2);
+                response.body.append(conn.buffer, 0, size);
+                conn.buffer.erase(0, size + 2);
+                if (size == 0)
+                    break;
+            }
+        } else {
+            fill(conn, length);
+            response.body = conn.buffer.substr(0, length);
+            conn.buffer.erase(0, length);
+        }
+        return response;
+    }
+
+    std::string m_node;
+    timeouts_t m_timeouts;
+    std::string m_host;
+    std::string m_port;
+    std::mutex m_lock;
+    std::vector<std::unique_ptr<connection_t>> m_idle;
+};
+
+// Subscribes to a node's /chat WebSocket on its own thread and hands every text message to
+// on_message, reconnecting a second after the node goes away
+class ws_feed_t {
+public:
+    ws_feed_t(std::string host, std::string port, std::function<void(std::string)> on_message)
+        : m_host{ std::move(host) }, m_port{ std::move(port) }, m_on_message{ std::move(on_message) },
+          m_thread{ [this] { run(); } } {}
+
+    ~ws_feed_t() {
+        m_stop = true;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_fd >= 0)
+                ::shutdown(m_fd, SHUT_RDWR); // wakes the blocked read
+        }
+        m_thread.join();
+    }
+
+    bool connected() const { return m_connected; }
+
+private:
+    void run() {
+        while (!m_stop) {
+            try {
+                tcp::socket socket{ m_ioctx };
+                tcp::resolver resolver{ m_ioctx };
+                asio::connect(socket, resolver.resolve(m_host, m_port));
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                    m_fd = socket.native_handle();
+                }
+                if (!m_stop)
+                    subscribe(socket);
+            } catch (const std::exception &) {
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_fd = -1;
+            }
+            m_connected = false;
+            for (int i = 0; i < 10 && !m_stop; ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+
+    void subscribe(tcp::socket &socket) {
+        std::string request = "GET /chat HTTP/1.1\r\nHost: " + m_host + ":" + m_port +
+                              "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                              "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+        asio::write(socket, asio::buffer(request));
+        std::string buffer;
+        char chunk[16 * 1024];
+        std::size_t end;
+        while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            auto n = socket.read_some(asio::buffer(chunk));
+            buffer.append(chunk, n);
+        }
+        if (buffer.compare(0, 12, "HTTP/1.1 101") != 0)
+            throw std::runtime_error("WebSocket upgrade refused");
+        buffer.erase(0, end + 4);
+        m_connected = true;
+
+        auto need = [&](std::size_t size) {
+            while (buffer.size() < size) {
+                auto n = socket.read_some(asio::buffer(chunk));
+                buffer.append(chunk, n);
+            }
+        };
+        std::string message;
+        for (;;) {
+            need(2);
+            auto b0 = static_cast<unsigned char>(buffer[0]), b1 = static_cast<unsigned char>(buffer[1]);
+            std::size_t header = 2;
+            std::uint64_t length = b1 & 0x7f;
+            if (length == 126) {
+                need(4);
+                length = (static_cast<unsigned char>(buffer[2]) << 8) | static_cast<unsigned char>(buffer[3]);
+                header = 4;
+            } else if (length == 127) {
+                need(10);
+                length = 0;
+                for (int i = 2; i < 10; ++i)
+                    length = (length << 8) | static_cast<unsigned char>(buffer[i]);
+                header = 10;
+            }
+            need(header + length); // frames from a server are not masked
+            auto payload = buffer.substr(header, length);
+            buffer.erase(0, header + length);
+
+            auto opcode = b0 & 0x0f;
+            if (opcode == 0x8)
+                return; // close
+            if (opcode == 0x9) {
+                send_frame(socket, 0xA, payload); // pong
+                continue;
+            }
+            if (opcode == 0x1 || opcode == 0x0) {
+                message += payload;
+                if (b0 & 0x80) {
+                    m_on_message(std::move(message));
+                    message.clear();
+                }
+            }
+        }
+    }
+
+    // Client frames must be masked
+    void send_frame(tcp::socket &socket, unsigned opcode, const std::string &payload) {
+        std::string frame;
+        frame += static_cast<char>(0x80 | opcode);
+        frame += static_cast<char>(0x80 | std::min<std::size_t>(payload.size(), 125));
+        std::uint32_t mask = m_rng();
+        const auto *key = reinterpret_cast<const unsigned char *>(&mask);
+        frame.append(reinterpret_cast<const char *>(key), 4);
+        for (std::size_t i = 0; i < payload.size() && i < 125; ++i)
+            frame += static_cast<char>(payload[i] ^ key[i % 4]);
+        asio::write(socket, asio::buffer(frame));
+    }
+
+    std::string m_host;
+    std::string m_port;
+    std::function<void(std::string)> m_on_message;
+    asio::io_context m_ioctx;
+    std::mt19937 m_rng{ std::random_device{}() };
+    std::mutex m_lock;
+    int m_fd = -1;
+    std::atomic<bool> m_stop{ false };
+    std::atomic<bool> m_connected{ false };
+    std::thread m_thread; // last: starts once everything above is set up
+};
+
+} // namespace weather_cluster
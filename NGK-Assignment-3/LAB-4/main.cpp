@@ -5,160 +5,402 @@
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <deque>
+#include <cstring>
+#include <thread>
+#include <shared_mutex>
+#include <climits>
+#include <atomic>
+#include <optional>
+#include <unordered_map>
+#include <csignal>
+#include "weather_registration.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+#include "shards.hpp"
+#include "worker_pool.hpp"
+#include "query_cache.hpp"
+#include "cold_store.hpp"
+#include "seed_loader.hpp"
+#include "export_stream.hpp"
+#include "content_encoding.hpp"
+#include "admission.hpp"
+#include "place_index.hpp"
+#include "store_lookup.hpp"
+#include "alert_rules.hpp"
+#include "bloom_filter.hpp"
+#include "broadcast.hpp"
+#include "replication.hpp"
+#include "handoff.hpp"
 
 namespace rr = restinio::router;
 using router_t = rr::express_router_t<>;
+using weather_trace::phase_t;
+
+// Requests pass admission control, then tracing, then routing
+using request_handler_t = weather_admission::admission_router_t<weather_trace::traced_router_t<router_t>>;
 
 using traits_t = restinio::traits_t<
     restinio::asio_timer_manager_t,
     restinio::single_threaded_ostream_logger_t,
-    router_t>;
+    request_handler_t>;
+
+// Traits for --shards mode, where several event loops share the log
+using sharded_traits_t = restinio::traits_t<
+    restinio::asio_timer_manager_t,
+    restinio::shared_ostream_logger_t,
+    request_handler_t>;
 
 namespace rws = restinio::websocket::basic;
 
-// Data structure representing a single weather data entry
-struct weatherRegistration {
-    weatherRegistration() = default;
-
-    weatherRegistration(int ID, int Date, int Time, std::string placeName,
-                        double Lat, double Lon, double Temperature, int Humidity)
-        : m_id{ ID }, m_date{ Date }, m_time{ Time }, m_placeName{ std::move(placeName) },
-          m_lat{ Lat }, m_lon{ Lon }, m_temperature{ Temperature }, m_humidity{ Humidity } {}
-
-    template <typename JSON_IO>
-    void json_io(JSON_IO &io) {
-        io & json_dto::mandatory("ID", m_id)
-           & json_dto::mandatory("Date", m_date)
-           & json_dto::mandatory("Time", m_time)
-           & json_dto::mandatory("PlaceName", m_placeName)
-           & json_dto::mandatory("Lat", m_lat)
-           & json_dto::mandatory("Lon", m_lon)
-           & json_dto::mandatory("Temperature", m_temperature)
-           & json_dto::mandatory("Humidity", m_humidity);
-    }
-
-    int m_id;
-    int m_date;
-    int m_time;
-    std::string m_placeName;
-    double m_lat;
-    double m_lon;
-    double m_temperature;
-    int m_humidity;
-};
+// Standard headers for all responses
+template <typename RESP>
+RESP init_resp(RESP resp) {
+    resp.append_header("Server", "RESTinio WeatherServer")
+        .append_header_date_field()
+        .append_header("Content-Type", "application/json; charset=utf-8")
+        .append_header("Access-Control-Allow-Origin", "*");
+    return resp;
+}
+
+// Sets the body, records the response for the metrics and sends it
+template <typename RESP>
+restinio::request_handling_status_t done(RESP resp, std::string body) {
+    weather_metrics::request_scope_t::set_response(resp.header().status_code().raw_code(), body.size());
+    if (weather_handoff::draining())
+        resp.connection_close();
+    resp.set_body(std::move(body));
+    return resp.done(weather_trace::write_span<restinio::write_status_cb_t>());
+}
+
+template <typename T>
+T parse(const std::string &body) {
+    weather_trace::span_t span{phase_t::parse};
+    return json_dto::from_json<T>(body);
+}
+
+template <typename T>
+std::string serialize(const T &value) {
+    weather_trace::span_t span{phase_t::serialize};
+    return json_dto::to_json(value);
+}
+
+inline bool same_record(const weatherRegistration &a, const weatherRegistration &b) {
+    return a.m_id == b.m_id && a.m_date == b.m_date && a.m_time == b.m_time && a.m_placeName == b.m_placeName &&
+           a.m_lat == b.m_lat && a.m_lon == b.m_lon && a.m_temperature == b.m_temperature && a.m_humidity == b.m_humidity;
+}
+
+// 409 for a PUT that would give a record the ID of another one
+inline restinio::request_handling_status_t id_taken(const restinio::request_handle_t &req, int id) {
+    return done(req->create_response(restinio::status_conflict()), "ID " + std::to_string(id) + " is taken by another record");
+}
+
+// Whether a write is a cluster proxy copying a record to a joining node. The copy is not a new
+// reading, so it is stored without a feed message or alerts.
+inline bool is_copy(const restinio::request_handle_t &req) {
+    return req->header().has_field("X-Weather-Copy");
+}
+
+// Sends one text frame to a WebSocket subscriber; the send of weather_broadcast's fan-out
+inline void send_text(const rws::ws_handle_t &ws, const std::string &msg) {
+    ws->send_message(rws::message_t{ rws::final_frame_flag_t::final_frame, rws::opcode_t::text_frame, msg });
+}
 
-using weatherStation_t = std::vector<weatherRegistration>;
+// Display names of the routes in trace dumps
+inline const std::vector<std::string> &trace_route_names() {
+    static const std::vector<std::string> names = [] {
+        std::vector<std::string> result;
+        for (const auto &route : weather_metrics::routes)
+            result.push_back(std::string(route.method) + " " + route.path);
+        return result;
+    }();
+    return names;
+}
 
 // Handles all HTTP/WebSocket logic for weather endpoints
 class weatherInformationHandler {
 public:
-    explicit weatherInformationHandler(weatherStation_t &weather) : m_weather(weather) {}
+    weatherInformationHandler(weatherStation_t &weather, restinio::asio_ns::io_context &ioctx,
+                              weather_workers::worker_pool_t *workers, weather_cache::query_cache_t *cache,
+                              weather_cold::cold_store_t *cold, std::size_t hot_records, std::size_t compress_min,
+                              const weather_replication::config_t &replication, const weather_handoff::config_t &handoff)
+        : m_weather(weather), m_ioctx(ioctx), m_workers(workers), m_cache(cache),
+          m_cold(cold), m_hot_records(hot_records), m_compress_min(compress_min),
+          m_listener(handoff.listener), m_drain(handoff.drain), m_drain_timer(ioctx) {
+        // Index the place names of the seed data, archived and in memory
+        if (m_cold) {
+            for (const auto &segment : m_cold->segments()) {
+                for (std::size_t block = 0; block < segment->blocks(); ++block) {
+                    segment->scan_block(block, [this, &segment](std::size_t pos, const auto &entry) {
+                        m_places.add(entry.m_placeName, segment->first_seq() + pos);
+                        m_ids.add(entry.m_id);
+                    });
+                }
+            }
+        }
+        auto base = hot_base();
+        for (std::size_t i = 0; i < m_weather.size(); ++i) {
+            m_places.add(m_weather[i].m_placeName, base + i);
+            m_ids.add(m_weather[i].m_id);
+        }
+        index_hot_ids();
+        if (!handoff.rules.empty()) {
+            for (auto &rule : json_dto::from_json<std::vector<weather_alerts::alert_rule_t>>(handoff.rules))
+                m_alerts.add(std::move(rule), true);
+        }
 
-    // GET all weather data
+        if (replication.listen_port != 0) {
+            m_primary = std::make_unique<weather_replication::primary_t>(m_ioctx, replication.listen_port, replication.log_changes,
+                                                                         [this](auto done) { snapshot(std::move(done)); },
+                                                                         replication.listener);
+        }
+        if (!replication.primary_host.empty()) {
+            m_follower = std::make_unique<weather_replication::follower_t>(
+                m_ioctx, replication.primary_host, replication.primary_port,
+                weather_replication::follower_t::apply_t{ [this](const auto &entry) { apply_upsert(entry); },
+                                                          [this](int id, const auto &entry) { apply_update(id, entry); },
+                                                          [this](auto records) { apply_snapshot(std::move(records)); } });
+        }
+        if (!handoff.listen_path.empty()) {
+            m_handoff = std::make_unique<weather_handoff::source_t>(m_ioctx, handoff.listen_path, weather_handoff::source_t::hooks_t{
+                [this](auto send) { prepare_handoff(std::move(send)); },
+                [this] {
+                    std::vector<int> fds{ m_listener->fd };
+                    if (m_primary)
+                        fds.push_back(m_primary->listener());
+                    return fds;
+                },
+                [this] { drain(); },
+                [this] { m_handing_off = false; } });
+        }
+    }
+
+    // GET all weather data (cached, otherwise on the worker pool at low priority)
     auto on_weather_list(const restinio::request_handle_t &req, rr::route_params_t) const {
-        auto resp = init_resp(req->create_response());
-        resp.set_body(json_dto::to_json(m_weather));
-        return resp.done();
+        if (auto body = cache_get("all"))
+            return send_json(req, "all", body);
+
+        return offload(req, weather_workers::priority_t::low, [this, req] {
+            auto tag = m_cache ? m_cache->tag_global() : cache_tag_t{};
+            auto body = cache_put("all", tag, serialize(collect([](const auto &) { return true; }, [](const auto &segment, auto &out) {
+                segment.for_each([&out](const auto &entry) { out.push_back(entry); });
+            })));
+            return send_json(req, "all", body);
+        });
     }
 
-    // POST new weather data
+    // POST new weather data. IDs are unique: resending a stored record (a sensor retrying after
+    // a timeout) is answered 200 without storing it again, a different record with a taken ID 409.
     auto on_weather_post(const restinio::request_handle_t &req, rr::route_params_t) {
+        if (m_follower)
+            return read_only(req);
+        if (m_handing_off)
+            return handing_off(req);
         try {
-            auto body = req->body();
-            auto newEntry = json_dto::from_json<weatherRegistration>(body);
-            m_weather.push_back(std::move(newEntry));
-
-            auto resp = init_resp(req->create_response(restinio::status_created()));
-            resp.set_body(R"({"status": "added"})");
-
-            // Notify all connected WebSocket clients
-            auto json_msg = json_dto::to_json(m_weather.back());
-            for (auto &[id, ws] : m_registry) {
-                ws->send_message(rws::message_t{
-                    rws::final_frame_flag_t::final_frame,
-                    rws::opcode_t::text_frame,
-                    json_msg
-                });
+            auto newEntry = parse<weatherRegistration>(req->body());
+            if (auto existing = insert_record(newEntry, !is_copy(req))) {
+                if (same_record(*existing, newEntry))
+                    return done(init_resp(req->create_response()), R"({"status": "exists"})");
+                auto id = std::to_string(newEntry.m_id);
+                return done(req->create_response(restinio::status_conflict()), "ID " + id + " is taken; use PUT /" + id + " to change it");
             }
-
-            return resp.done();
+            return done(init_resp(req->create_response(restinio::status_created())), R"({"status": "added"})");
         } catch (const std::exception &ex) {
-            return req->create_response(restinio::status_bad_request())
-                      .set_body(std::string("Error: ") + ex.what())
-                      .done();
+            return done(req->create_response(restinio::status_bad_request()), std::string("Error: ") + ex.what());
         }
     }
 
-    // PUT update a weather entry by ID
+    // PUT update a weather entry by ID. Changing the ID to one another record has is a 409.
     auto on_weather_put(const restinio::request_handle_t &req, rr::route_params_t params) {
+        if (m_follower)
+            return read_only(req);
+        if (m_handing_off)
+            return handing_off(req);
         try {
             int id = std::stoi(std::string(params["id"]));
-            auto updatedEntry = json_dto::from_json<weatherRegistration>(req->body());
-
-            for (auto &entry : m_weather) {
-                if (entry.m_id == id) {
-                    entry = updatedEntry;
-                    auto resp = init_resp(req->create_response());
-                    resp.set_body(R"({"status": "updated"})");
-                    return resp.done();
-                }
+            auto updatedEntry = parse<weatherRegistration>(req->body());
+            switch (update_record(id, updatedEntry, !is_copy(req))) {
+            case update_t::updated:
+                return done(init_resp(req->create_response()), R"({"status": "updated"})");
+            case update_t::id_taken:
+                return id_taken(req, updatedEntry.m_id);
+            default:
+                return done(req->create_response(restinio::status_not_found()), "ID not found");
             }
-
-            return req->create_response(restinio::status_not_found())
-                      .set_body("ID not found")
-                      .done();
         } catch (...) {
-            return req->create_response(restinio::status_bad_request())
-                      .set_body("Invalid data")
-                      .done();
+            return done(req->create_response(restinio::status_bad_request()), "Invalid data");
         }
     }
 
     // GET single entry by ID
     auto on_weather_by_id(const restinio::request_handle_t &req, rr::route_params_t params) const {
         int id = std::stoi(std::string(params["id"]));
-        for (const auto &entry : m_weather) {
-            if (entry.m_id == id) {
-                auto resp = init_resp(req->create_response());
-                resp.set_body(json_dto::to_json(entry));
-                return resp.done();
-            }
+        const weatherRegistration *found = nullptr;
+        {
+            weather_trace::span_t span{phase_t::store};
+            auto it = find_hot(id);
+            if (it != m_weather.end())
+                found = &*it;
         }
 
-        return req->create_response(restinio::status_not_found())
-                  .set_body("Not found")
-                  .done();
+        if (found)
+            return done(init_resp(req->create_response()), serialize(*found));
+
+        // Not in the hot window: the segment indexes tell which block to read, if any
+        if (auto [segment, pos] = find_cold(id); segment)
+            return done(init_resp(req->create_response()), serialize(segment->at(pos)));
+        return done(req->create_response(restinio::status_not_found()), "Not found");
     }
 
-    // GET all entries from a specific date
+    // GET all entries from a specific date (on the worker pool)
     auto on_weather_by_date(const restinio::request_handle_t &req, rr::route_params_t params) const {
         int date = std::stoi(std::string(params["date"]));
-        weatherStation_t results;
-        for (const auto &entry : m_weather) {
-            if (entry.m_date == date)
-                results.push_back(entry);
+        auto key = "date:" + std::to_string(date);
+        if (auto body = cache_get(key))
+            return send_json(req, key, body);
+
+        return offload(req, weather_workers::priority_t::high, [this, req, date, key] {
+            auto tag = m_cache ? m_cache->tag_for_date(date) : cache_tag_t{};
+            weatherStation_t results;
+            {
+                weather_trace::span_t span{phase_t::store};
+                results = collect([date](const auto &entry) { return entry.m_date == date; },
+                                  [date](const auto &segment, auto &out) {
+                                      segment.for_date(date, [&out](const auto &entry) { out.push_back(entry); });
+                                  });
+            }
+            return send_json(req, key, cache_put(key, tag, serialize(results)));
+        });
+    }
+
+    // GET /ids?list=1,2,3: many records by ID in one pass
+    auto on_multi_get(const restinio::request_handle_t &req, rr::route_params_t) const {
+        std::vector<int> ids;
+        try {
+            auto qp = restinio::parse_query(req->header().query());
+            auto list = qp.has("list") ? std::string(qp["list"]) : std::string();
+            for (std::size_t pos = 0; pos < list.size();) {
+                auto comma = std::min(list.find(',', pos), list.size());
+                ids.push_back(std::stoi(list.substr(pos, comma - pos)));
+                pos = comma + 1;
+            }
+        } catch (...) {
+            return done(req->create_response(restinio::status_bad_request()), "Invalid ID list");
         }
+        return lookup_ids(req, std::move(ids));
+    }
 
-        auto resp = init_resp(req->create_response());
-        resp.set_body(json_dto::to_json(results));
-        return resp.done();
+    // POST /ids with a JSON array of IDs: the same as GET /ids, for lists too long for a URL
+    auto on_multi_get_post(const restinio::request_handle_t &req, rr::route_params_t) const {
+        std::vector<int> ids;
+        try {
+            ids = parse<std::vector<int>>(req->body());
+        } catch (const std::exception &ex) {
+            return done(req->create_response(restinio::status_bad_request()), std::string("Error: ") + ex.what());
+        }
+        return lookup_ids(req, std::move(ids));
+    }
+
+    // GET /places?prefix=Aar&limit=10: place names starting with prefix, for autocomplete
+    auto on_places(const restinio::request_handle_t &req, rr::route_params_t) const {
+        auto qp = restinio::parse_query(req->header().query());
+        auto prefix = qp.has("prefix") ? std::string(qp["prefix"]) : std::string();
+        std::size_t limit = 10;
+        try {
+            if (qp.has("limit"))
+                limit = static_cast<std::size_t>(std::clamp(restinio::cast_to<int>(qp["limit"]), 1, 1000));
+        } catch (...) {
+            return done(req->create_response(restinio::status_bad_request()), "Invalid limit");
+        }
+
+        std::vector<weather_places::place_match_t> matches;
+        {
+            weather_trace::span_t span{phase_t::store};
+            matches = m_places.complete(prefix, limit);
+        }
+        return send_json(req, {}, std::make_shared<const std::string>(serialize(matches)));
+    }
+
+    // GET /place/:name: all records of one place, through its posting list
+    auto on_place(const restinio::request_handle_t &req, rr::route_params_t params) const {
+        std::string name;
+        try {
+            name = restinio::utils::unescape_percent_encoding(params["name"]);
+        } catch (...) {
+            return done(req->create_response(restinio::status_bad_request()), "Invalid place name");
+        }
+
+        return offload(req, weather_workers::priority_t::high, [this, req, name] {
+            weatherStation_t results;
+            {
+                weather_trace::span_t span{phase_t::store};
+                std::vector<std::uint64_t> archived;
+                weatherStation_t hot;
+                {
+                    std::shared_lock<std::shared_mutex> lock(m_store_lock);
+                    if (const auto *postings = m_places.postings(name)) {
+                        auto base = hot_base();
+                        for (auto seq : *postings) {
+                            if (seq < base)
+                                archived.push_back(seq);
+                            else if (seq - base < m_weather.size() && m_weather[seq - base].m_placeName == name)
+                                hot.push_back(m_weather[seq - base]);
+                        }
+                    }
+                }
+                read_archived(archived, name, results);
+                std::move(hot.begin(), hot.end(), std::back_inserter(results));
+            }
+            return send_json(req, {}, std::make_shared<const std::string>(serialize(results)));
+        });
+    }
+
+    // GET /alerts: the registered alert rules
+    auto on_alerts_list(const restinio::request_handle_t &req, rr::route_params_t) const {
+        return done(init_resp(req->create_response()), serialize(m_alerts.rules()));
+    }
+
+    // POST /alerts: register a rule such as {"PlaceName": "Aarhus", "Field": "Temperature", "Op": ">", "Threshold": 30}
+    auto on_alerts_post(const restinio::request_handle_t &req, rr::route_params_t) {
+        if (m_handing_off)
+            return handing_off(req);
+        try {
+            int id = m_alerts.add(parse<weather_alerts::alert_rule_t>(req->body()));
+            return done(init_resp(req->create_response(restinio::status_created())), R"({"ID": )" + std::to_string(id) + "}");
+        } catch (const std::length_error &ex) {
+            return done(req->create_response(restinio::status_conflict()), std::string("Error: ") + ex.what());
+        } catch (const std::exception &ex) {
+            return done(req->create_response(restinio::status_bad_request()), std::string("Error: ") + ex.what());
+        }
+    }
+
+    // DELETE /alerts/:id
+    auto on_alerts_delete(const restinio::request_handle_t &req, rr::route_params_t params) {
+        if (m_handing_off)
+            return handing_off(req);
+        if (m_alerts.remove(restinio::cast_to<int>(params["id"])))
+            return done(req->create_response(restinio::status_no_content()), {});
+        return done(req->create_response(restinio::status_not_found()), "Rule not found");
     }
 
     // GET the 3 latest entries
     auto on_weather_latest(const restinio::request_handle_t &req, rr::route_params_t) const {
+        if (auto body = cache_get("latest"))
+            return send_json(req, "latest", body);
+
+        auto tag = m_cache ? m_cache->tag_global() : cache_tag_t{};
         weatherStation_t latest;
-        int count = 0;
-        for (auto it = m_weather.rbegin(); it != m_weather.rend() && count < 3; ++it, ++count)
-            latest.push_back(*it);
+        {
+            weather_trace::span_t span{phase_t::store};
+            latest = weather_lookup::latest(m_weather, 3);
+        }
 
-        auto resp = init_resp(req->create_response());
-        resp.set_body(json_dto::to_json(latest));
-        return resp.done();
+        return send_json(req, "latest", cache_put("latest", tag, serialize(latest)));
     }
 
     // WebSocket endpoint for live updates
     auto on_live_update(const restinio::request_handle_t &req, rr::route_params_t) {
-        if (restinio::http_connection_header_t::upgrade == req->header().connection()) {
+        if (restinio::http_connection_header_t::upgrade == req->header().connection() && !weather_handoff::draining()) {
             auto wsh = rws::upgrade<traits_t>(*req, rws::activation_t::immediate,
                 [this](auto wsh, auto m) {
                     if (rws::opcode_t::text_frame == m->opcode()) {
@@ -169,6 +411,7 @@ public:
                 });
 
             m_registry.emplace(wsh->connection_id(), wsh);
+            weather_metrics::request_scope_t::set_response(101, 0);
             return restinio::request_accepted();
         }
         return restinio::request_rejected();
@@ -176,64 +419,1523 @@ public:
 
     // OPTIONS handler for CORS
     auto on_options(const restinio::request_handle_t &req, rr::route_params_t) {
-        return req->create_response()
-            .append_header("Access-Control-Allow-Origin", "*")
-            .append_header("Access-Control-Allow-Methods", "GET, POST, PUT, OPTIONS")
-            .append_header("Access-Control-Allow-Headers", "Content-Type")
-            .done();
+        auto resp = req->create_response();
+        resp.append_header("Access-Control-Allow-Origin", "*")
+            .append_header("Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS")
+            .append_header("Access-Control-Allow-Headers", "Content-Type");
+        return done(std::move(resp), {});
     }
 
-private:
-    weatherStation_t &m_weather;
-    mutable std::map<std::uint64_t, rws::ws_handle_t> m_registry;
+    // GET request counters, latency/body-size histograms and server gauges for Prometheus
+    auto on_metrics(const restinio::request_handle_t &req, rr::route_params_t) const {
+        auto body = weather_metrics::registry_t::instance().render();
+        body += weather_admission::admission_t::instance().render();
+        if (m_primary)
+            body += m_primary->render();
+        if (m_follower)
+            body += m_follower->render();
+        if (m_handoff)
+            body += m_handoff->render();
+        body += "# HELP weather_store_records Weather records held in memory.\n"
+                "# TYPE weather_store_records gauge\n"
+                "weather_store_records " + std::to_string(m_weather.size()) + "\n"
+                "# HELP weather_places Distinct place names in the place index.\n"
+                "# TYPE weather_places gauge\n"
+                "weather_places " + std::to_string(m_places.places()) + "\n"
+                "# HELP weather_alert_rules Registered alert rules.\n"
+                "# TYPE weather_alert_rules gauge\n"
+                "weather_alert_rules " + std::to_string(m_alerts.size()) + "\n"
+                "# HELP weather_alert_rule_checks_total Alert rules checked against ingested samples.\n"
+                "# TYPE weather_alert_rule_checks_total counter\n"
+                "weather_alert_rule_checks_total " + std::to_string(m_alerts.evaluated()) + "\n"
+                "# HELP weather_alerts_fired_total Alerts pushed to WebSocket subscribers.\n"
+                "# TYPE weather_alerts_fired_total counter\n"
+                "weather_alerts_fired_total " + std::to_string(m_alerts.fired()) + "\n"
+                "# HELP weather_ingest_duplicates_total POSTs whose ID was already stored.\n"
+                "# TYPE weather_ingest_duplicates_total counter\n"
+                "weather_ingest_duplicates_total " + std::to_string(m_duplicates) + "\n"
+                "# HELP weather_id_filter_false_positives_total POSTs the ID filter sent to a store lookup that found nothing.\n"
+                "# TYPE weather_id_filter_false_positives_total counter\n"
+                "weather_id_filter_false_positives_total " + std::to_string(m_bloom_false_positives) + "\n"
+                "# HELP weather_id_filter_false_positive_seconds_total Time spent on store lookups for false positives.\n"
+                "# TYPE weather_id_filter_false_positive_seconds_total counter\n"
+                "weather_id_filter_false_positive_seconds_total " +
+                    std::to_string(std::chrono::duration<double>(m_bloom_false_positive_time).count()) + "\n"
+                "# HELP weather_id_filter_false_positive_ratio Share of new IDs the filter did not rule out.\n"
+                "# TYPE weather_id_filter_false_positive_ratio gauge\n"
+                "weather_id_filter_false_positive_ratio " +
+                    std::to_string(m_ingest_checks > m_duplicates
+                                       ? static_cast<double>(m_bloom_false_positives) / (m_ingest_checks - m_duplicates)
+                                       : 0.0) + "\n"
+                "# HELP weather_id_filter_estimated_false_positive_ratio False-positive rate implied by the filter's fill.\n"
+                "# TYPE weather_id_filter_estimated_false_positive_ratio gauge\n"
+                "weather_id_filter_estimated_false_positive_ratio " + std::to_string(m_ids.estimated_fp_rate()) + "\n"
+                "# HELP weather_id_filter_bytes Memory held by the ID filter.\n"
+                "# TYPE weather_id_filter_bytes gauge\n"
+                "weather_id_filter_bytes " + std::to_string(m_ids.bytes()) + "\n"
+                "# HELP weather_ws_subscribers Connected WebSocket clients.\n"
+                "# TYPE weather_ws_subscribers gauge\n"
+                "weather_ws_subscribers " + std::to_string(m_registry.size()) + "\n"
+                "# HELP weather_ws_broadcast_queue_depth Messages waiting to be fanned out to WebSocket clients.\n"
+                "# TYPE weather_ws_broadcast_queue_depth gauge\n"
+                "weather_ws_broadcast_queue_depth " + std::to_string(m_broadcasts.depth()) + "\n"
+                "# HELP weather_ws_messages_sent_total Messages sent to WebSocket clients.\n"
+                "# TYPE weather_ws_messages_sent_total counter\n"
+                "weather_ws_messages_sent_total " + std::to_string(m_messages_sent) + "\n";
+        if (m_cache) {
+            auto stats = m_cache->stats();
+            auto lookups = stats.hits + stats.misses;
+            body += "# HELP weather_cache_requests_total Query cache lookups, by result.\n"
+                    "# TYPE weather_cache_requests_total counter\n"
+                    "weather_cache_requests_total{result=\"hit\"} " + std::to_string(stats.hits) + "\n"
+                    "weather_cache_requests_total{result=\"miss\"} " + std::to_string(stats.misses) + "\n"
+                    "# HELP weather_cache_stale_total Cached results dropped because their date changed.\n"
+                    "# TYPE weather_cache_stale_total counter\n"
+                    "weather_cache_stale_total " + std::to_string(stats.stale) + "\n"
+                    "# HELP weather_cache_evictions_total Cached results evicted to stay within the size limit.\n"
+                    "# TYPE weather_cache_evictions_total counter\n"
+                    "weather_cache_evictions_total " + std::to_string(stats.evictions) + "\n"
+                    "# HELP weather_cache_hit_ratio Share of cache lookups that were hits.\n"
+                    "# TYPE weather_cache_hit_ratio gauge\n"
+                    "weather_cache_hit_ratio " + std::to_string(lookups ? static_cast<double>(stats.hits) / lookups : 0.0) + "\n"
+                    "# HELP weather_cache_entries Cached query results.\n"
+                    "# TYPE weather_cache_entries gauge\n"
+                    "weather_cache_entries " + std::to_string(stats.entries) + "\n"
+                    "# HELP weather_cache_bytes Memory held by cached query results.\n"
+                    "# TYPE weather_cache_bytes gauge\n"
+                    "weather_cache_bytes " + std::to_string(stats.bytes) + "\n";
+        }
+        if (m_cold) {
+            std::size_t records = 0, bytes = 0;
+            auto segments = m_cold->segments();
+            for (const auto &segment : segments) {
+                records += segment->records();
+                bytes += segment->bytes();
+            }
+            body += "# HELP weather_cold_segments Segment files holding compacted records.\n"
+                    "# TYPE weather_cold_segments gauge\n"
+                    "weather_cold_segments " + std::to_string(segments.size()) + "\n"
+                    "# HELP weather_cold_records Records compacted into segment files, including superseded ones.\n"
+                    "# TYPE weather_cold_records gauge\n"
+                    "weather_cold_records " + std::to_string(records) + "\n"
+                    "# HELP weather_cold_bytes Size of the segment files on disk.\n"
+                    "# TYPE weather_cold_bytes gauge\n"
+                    "weather_cold_bytes " + std::to_string(bytes) + "\n"
+                    "# HELP weather_compactions_total Compactions of the hot store, by result.\n"
+                    "# TYPE weather_compactions_total counter\n"
+                    "weather_compactions_total{result=\"done\"} " + std::to_string(m_compactions) + "\n"
+                    "weather_compactions_total{result=\"failed\"} " + std::to_string(m_compactions_failed) + "\n";
+        }
+        body += "# HELP weather_compressed_responses_total Compressed responses, by where the compressed body came from.\n"
+                "# TYPE weather_compressed_responses_total counter\n"
+                "weather_compressed_responses_total{source=\"compressed\"} " + std::to_string(m_compressed_fresh.load()) + "\n"
+                "weather_compressed_responses_total{source=\"cache\"} " + std::to_string(m_compressed_cached.load()) + "\n";
+        if (m_workers) {
+            using weather_workers::priority_t;
+            body += "# HELP weather_worker_queue_depth Jobs waiting for a worker, by priority class.\n"
+                    "# TYPE weather_worker_queue_depth gauge\n"
+                    "weather_worker_queue_depth{priority=\"high\"} " + std::to_string(m_workers->queued(priority_t::high)) + "\n"
+                    "weather_worker_queue_depth{priority=\"low\"} " + std::to_string(m_workers->queued(priority_t::low)) + "\n"
+                    "# HELP weather_worker_rejected_total Jobs rejected because their queue was full.\n"
+                    "# TYPE weather_worker_rejected_total counter\n"
+                    "weather_worker_rejected_total{priority=\"high\"} " + std::to_string(m_workers->rejected(priority_t::high)) + "\n"
+                    "weather_worker_rejected_total{priority=\"low\"} " + std::to_string(m_workers->rejected(priority_t::low)) + "\n";
+        }
 
-    // Standard headers for all responses
-    template <typename RESP>
-    static RESP init_resp(RESP resp) {
+        auto resp = req->create_response();
+        resp.append_header("Server", "RESTinio WeatherServer")
+            .append_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+        return done(std::move(resp), std::move(body));
+    }
+
+    // GET a Chrome trace-event dump of the last ?seconds=N (default 5). If sampling is off,
+    // every request of the next N seconds is traced and the dump is sent afterwards, as the
+    // last chunk of a chunked response (see continue_trace_capture).
+    auto on_debug_trace(const restinio::request_handle_t &req, rr::route_params_t) {
+        auto qp = restinio::parse_query(req->header().query());
+        std::chrono::seconds window{5};
+        if (qp.has("seconds"))
+            window = std::chrono::seconds{std::clamp(restinio::cast_to<int>(qp["seconds"]), 1, 60)};
+
+        auto &tracer = weather_trace::tracer_t::instance();
+        if (tracer.sample_every() != 0)
+            return done(init_resp(req->create_response()), tracer.dump_chrome_json(window, trace_route_names()));
+
+        tracer.capture_until(weather_trace::trace_clock_t::now() + window);
+        auto capture = std::make_shared<trace_capture_t>(init_resp(req->create_response<restinio::chunked_output_t>()),
+                                                         m_ioctx, window);
+        capture->pending = weather_metrics::request_scope_t::defer();
+        capture->resp.flush();
+        continue_trace_capture(capture);
+        return restinio::request_accepted();
+    }
+
+    // GET /export?format=ndjson|csv|binary&from=&to=&compress=gzip|zstd streams the records
+    // dated from..to, oldest first, with chunked encoding. Chunks are read on the worker pool
+    // one at a time and the next one is only read once the previous one is written, so memory
+    // stays flat however slow the client is.
+    auto on_export(const restinio::request_handle_t &req, rr::route_params_t) {
+        auto qp = restinio::parse_query(req->header().query());
+        auto format = weather_export::parse_format(qp.has("format") ? qp["format"] : "ndjson");
+        auto compression = weather_export::parse_compression(qp.has("compress") ? qp["compress"] : "none");
+        if (!format || !compression)
+            return done(req->create_response(restinio::status_bad_request()), "Unknown format or compression");
+
+        int from = INT_MIN, to = INT_MAX;
+        try {
+            if (qp.has("from"))
+                from = restinio::cast_to<int>(qp["from"]);
+            if (qp.has("to"))
+                to = restinio::cast_to<int>(qp["to"]);
+        } catch (...) {
+            return done(req->create_response(restinio::status_bad_request()), "Invalid date range");
+        }
+
+        auto resp = req->create_response<restinio::chunked_output_t>();
         resp.append_header("Server", "RESTinio WeatherServer")
             .append_header_date_field()
-            .append_header("Content-Type", "application/json; charset=utf-8")
+            .append_header("Content-Type", weather_export::content_type(*format))
             .append_header("Access-Control-Allow-Origin", "*");
-        return resp;
+        if (auto encoding = weather_export::content_encoding(*compression))
+            resp.append_header("Content-Encoding", encoding);
+
+        auto job = std::make_shared<export_t>(std::move(resp), *format, *compression, from, to);
+        job->pending = weather_metrics::request_scope_t::defer();
+        job->resp.flush(); // the client sees the status at once, however long the first chunk takes
+        next_export_chunk(job);
+        return restinio::request_accepted();
+    }
+
+private:
+    using cache_tag_t = weather_cache::query_cache_t::tag_t;
+
+    // Store scans on workers copy this many records per lock acquisition
+    static constexpr std::size_t scan_chunk = 4096;
+    // Uncompressed size of one /export chunk
+    static constexpr std::size_t export_chunk = 128 * 1024;
+    // IDs accepted by one /ids request
+    static constexpr std::size_t max_multi_get = 10000;
+
+    // Interval between the spaces that keep a /debug/trace capture's connection open
+    static constexpr std::chrono::milliseconds trace_keep_alive{ 500 };
+
+    // State of one /debug/trace capture while sampling is off
+    struct trace_capture_t {
+        trace_capture_t(restinio::response_builder_t<restinio::chunked_output_t> r, restinio::asio_ns::io_context &ioctx,
+                        std::chrono::seconds w)
+            : resp(std::move(r)), timer(ioctx), window(w), end(std::chrono::steady_clock::now() + w) {}
+
+        restinio::response_builder_t<restinio::chunked_output_t> resp;
+        restinio::asio_ns::steady_timer timer;
+        std::chrono::seconds window;
+        std::chrono::steady_clock::time_point end;
+        weather_metrics::in_flight_t pending;
+    };
+
+    // Outcome of update_record
+    enum class update_t { updated, not_found, id_taken };
+
+    // State of one running /export
+    struct export_t {
+        export_t(restinio::response_builder_t<restinio::chunked_output_t> r, weather_export::format_t f,
+                 weather_export::compression_t c, int first, int last)
+            : resp(std::move(r)), format(f), compressor(c), from(first), to(last) {}
+
+        restinio::response_builder_t<restinio::chunked_output_t> resp;
+        weather_export::format_t format;
+        weather_export::compressor_t compressor;
+        int from, to;
+        std::uint64_t next = 0; // insertion position of the next record to read
+        bool started = false;
+        bool finished = false;
+        bool failed = false;    // reading failed: the response must not end like a complete one
+        std::size_t bytes = 0;
+        weather_metrics::in_flight_t pending;
+    };
+
+    weatherStation_t &m_weather;
+    restinio::asio_ns::io_context &m_ioctx;
+    weather_workers::worker_pool_t *m_workers;
+    weather_cache::query_cache_t *m_cache;
+    weather_cold::cold_store_t *m_cold;
+    std::size_t m_hot_records;
+    std::size_t m_compress_min;
+    // Compressed responses, by whether the compressed body came from the cache
+    mutable std::atomic<std::uint64_t> m_compressed_fresh{0};
+    mutable std::atomic<std::uint64_t> m_compressed_cached{0};
+    // Writes happen on the I/O thread only; they take this exclusively against worker scans
+    mutable std::shared_mutex m_store_lock;
+    // Place names of all records; updated with m_store_lock held exclusively
+    weather_places::place_index_t m_places;
+    weather_alerts::rule_engine_t m_alerts; // touched on the I/O thread only
+    weather_bloom::bloom_filter_t m_ids;    // every stored ID; touched on the I/O thread only
+    // Position in m_weather of each record there; updated with m_store_lock held exclusively
+    std::unordered_map<int, std::size_t> m_hot_ids;
+    std::uint64_t m_ingest_checks = 0;
+    std::uint64_t m_duplicates = 0;
+    std::uint64_t m_bloom_false_positives = 0;
+    std::chrono::steady_clock::duration m_bloom_false_positive_time{};
+    // Bumped under m_store_lock whenever records move between the hot store and the segments
+    std::uint64_t m_generation = 0;
+    // Oldest hot records being written to a segment, and whether one of them changed meanwhile
+    std::size_t m_compacting = 0;
+    bool m_compaction_stale = false;
+    std::uint64_t m_compactions = 0;
+    std::uint64_t m_compactions_failed = 0;
+    mutable std::map<std::uint64_t, rws::ws_handle_t> m_registry;
+    weather_broadcast::queue_t m_broadcasts;
+    std::uint64_t m_messages_sent = 0;
+    // Handoff to a replacing process: writes stop while the snapshot is taken, then this one drains
+    weather_handoff::listener_t *m_listener;
+    std::chrono::seconds m_drain;
+    bool m_handing_off = false;
+    restinio::asio_ns::steady_timer m_drain_timer;
+    std::chrono::steady_clock::time_point m_drain_start;
+    std::vector<std::uint64_t> m_closing; // WebSocket subscribers to close, in order
+    std::size_t m_closed = 0;
+
+    // Last, so their callbacks into the store go away first
+    std::unique_ptr<weather_replication::primary_t> m_primary;
+    std::unique_ptr<weather_replication::follower_t> m_follower;
+    std::unique_ptr<weather_handoff::source_t> m_handoff;
+
+    std::shared_ptr<const std::string> cache_get(const std::string &key) const {
+        return m_cache ? m_cache->get(key) : nullptr;
+    }
+
+    std::shared_ptr<const std::string> cache_put(const std::string &key, const cache_tag_t &tag, std::string body) const {
+        if (m_cache)
+            return m_cache->put(key, tag, std::move(body));
+        return std::make_shared<const std::string>(std::move(body));
+    }
+
+    // Sends a JSON body, compressed if the client accepts an encoding and the body has at least
+    // --compress-min bytes. Compressed copies of a cached body are cached next to it.
+    restinio::request_handling_status_t send_json(const restinio::request_handle_t &req, const std::string &key,
+                                                  const std::shared_ptr<const std::string> &body) const {
+        auto resp = init_resp(req->create_response());
+        resp.append_header("Vary", "Accept-Encoding");
+        auto encoding = weather_encoding::negotiate(req->header().get_field_or(restinio::http_field::accept_encoding, ""));
+        if (encoding == weather_encoding::encoding_t::identity || body->size() < m_compress_min)
+            return done(std::move(resp), *body);
+
+        auto slot = static_cast<std::size_t>(encoding);
+        auto encoded = m_cache ? m_cache->get_encoded(key, body, slot) : nullptr;
+        if (encoded) {
+            ++m_compressed_cached;
+        } else {
+            weather_trace::span_t span{phase_t::serialize};
+            encoded = std::make_shared<const std::string>(weather_encoding::compress(*body, encoding));
+            ++m_compressed_fresh;
+            if (m_cache)
+                m_cache->add_encoded(key, body, slot, encoded);
+        }
+        resp.append_header("Content-Encoding", weather_encoding::name(encoding));
+        return done(std::move(resp), *encoded);
+    }
+
+    // Runs job on the worker pool and lets the I/O thread move on; the job sends the response.
+    // Without a pool the job runs inline. A full queue is answered with 503 straight away, a
+    // job that throws with 500. The request's trace context goes along to the worker.
+    template <typename JOB>
+    restinio::request_handling_status_t offload(const restinio::request_handle_t &req,
+                                                weather_workers::priority_t priority, JOB job) const {
+        if (!m_workers)
+            return job();
+
+        auto pending = weather_metrics::request_scope_t::defer();
+        bool queued = m_workers->try_submit(priority, [this, req, pending, job, trace = weather_trace::current()]() mutable {
+            weather_metrics::request_scope_t scope{pending};
+            weather_trace::context_scope_t trace_scope{trace};
+            try {
+                job();
+            } catch (const std::exception &ex) {
+                fail_offloaded(req, ex.what());
+            } catch (...) {
+                fail_offloaded(req, "unknown exception");
+            }
+        });
+        if (queued)
+            return restinio::request_accepted();
+
+        weather_metrics::request_scope_t scope{pending};
+        auto resp = req->create_response(restinio::status_service_unavailable());
+        resp.append_header("Retry-After", "1");
+        return done(std::move(resp), "Server busy");
+    }
+
+    // Answers 500 for a job that threw on a worker. The response is sent from the I/O thread,
+    // where the connection lives, and the request is recorded there.
+    void fail_offloaded(const restinio::request_handle_t &req, const char *what) const {
+        std::cerr << "Request failed on a worker: " << what << std::endl;
+        restinio::asio_ns::post(m_ioctx, [req, pending = weather_metrics::request_scope_t::defer()] {
+            weather_metrics::request_scope_t scope{pending};
+            done(req->create_response(restinio::status_internal_server_error()), "Internal server error");
+        });
+    }
+
+    // Copies the records matching pred, in insertion order: cold(segment, result) adds the
+    // matches of each segment, then the hot store is scanned. The lock is taken per chunk, so a
+    // long scan never holds off a write on the I/O thread for more than one chunk; if records
+    // move to or from the segments meanwhile, the scan starts over.
+    template <typename PRED, typename COLD>
+    weatherStation_t collect(PRED pred, COLD cold) const {
+        for (;;) {
+            weatherStation_t result;
+            std::uint64_t generation;
+            weather_cold::segments_t segments;
+            {
+                std::shared_lock<std::shared_mutex> lock(m_store_lock);
+                generation = m_generation;
+                if (m_cold)
+                    segments = m_cold->segments();
+            }
+            for (const auto &segment : segments)
+                cold(*segment, result);
+
+            for (std::size_t pos = 0;;) {
+                std::shared_lock<std::shared_mutex> lock(m_store_lock);
+                if (m_generation != generation)
+                    break;
+                auto end = std::min(pos + scan_chunk, m_weather.size());
+                weather_lookup::copy_matching(m_weather, pos, end, pred, result);
+                pos = end;
+                if (pos >= m_weather.size())
+                    return result;
+            }
+        }
+    }
+
+    // Answers /ids with one element per requested ID, in request order: the record as GET
+    // /id/:id returns it, or {"ID": id, "Missing": true}. The hot store is scanned once on a
+    // worker; IDs not found there are looked up in the segment indexes.
+    restinio::request_handling_status_t lookup_ids(const restinio::request_handle_t &req, std::vector<int> ids) const {
+        if (ids.size() > max_multi_get)
+            return done(req->create_response(restinio::status_payload_too_large()),
+                        "At most " + std::to_string(max_multi_get) + " IDs per request");
+
+        return offload(req, weather_workers::priority_t::high, [this, req, ids = std::move(ids)] {
+            std::unordered_map<int, std::optional<weatherRegistration>> found;
+            for (int id : ids)
+                found.emplace(id, std::nullopt);
+            {
+                weather_trace::span_t span{phase_t::store};
+                std::size_t remaining = found.size();
+                std::uint64_t generation = 0;
+                for (std::size_t pos = 0; remaining > 0;) {
+                    std::shared_lock<std::shared_mutex> lock(m_store_lock);
+                    if (pos == 0)
+                        generation = m_generation;
+                    else if (m_generation != generation)
+                        pos = 0, generation = m_generation; // records moved; look again from the start
+                    auto end = std::min(pos + scan_chunk, m_weather.size());
+                    for (; pos < end && remaining > 0; ++pos) {
+                        auto it = found.find(m_weather[pos].m_id);
+                        if (it != found.end() && !it->second) {
+                            it->second = m_weather[pos];
+                            --remaining;
+                        }
+                    }
+                    if (pos >= m_weather.size())
+                        break;
+                }
+                for (auto &[id, entry] : found) {
+                    if (!entry) {
+                        if (auto [segment, pos] = find_cold(id); segment)
+                            entry = segment->at(pos);
+                    }
+                }
+            }
+
+            std::string body = "[";
+            {
+                weather_trace::span_t span{phase_t::serialize};
+                for (std::size_t i = 0; i < ids.size(); ++i) {
+                    if (i > 0)
+                        body += ',';
+                    const auto &entry = found[ids[i]];
+                    body += entry ? json_dto::to_json(*entry) : R"({"ID":)" + std::to_string(ids[i]) + R"(,"Missing":true})";
+                }
+            }
+            body += ']';
+            return send_json(req, {}, std::make_shared<const std::string>(std::move(body)));
+        });
+    }
+
+    // Insertion position of the oldest record in memory
+    std::uint64_t hot_base() const { return m_cold ? m_cold->end_seq() : 0; }
+
+    // Appends the records of a place at the given insertion positions (ascending) from the
+    // segments, decompressing each block once
+    void read_archived(const std::vector<std::uint64_t> &seqs, const std::string &name, weatherStation_t &out) const {
+        for (std::size_t i = 0; i < seqs.size();) {
+            auto segment = m_cold->locate(seqs[i]);
+            if (!segment) {
+                ++i;
+                continue;
+            }
+            auto first = segment->first_seq();
+            auto block = static_cast<std::size_t>(seqs[i] - first) / weather_cold::block_records;
+            auto block_end = first + std::min((block + 1) * weather_cold::block_records, segment->records());
+            auto j = i;
+            while (j < seqs.size() && seqs[j] < block_end)
+                ++j;
+            segment->scan_block(block, [&](std::size_t pos, const weatherRegistration &entry) {
+                if (entry.m_placeName == name && std::binary_search(seqs.begin() + i, seqs.begin() + j, first + pos))
+                    out.push_back(entry);
+            });
+            i = j;
+        }
+    }
+
+    // Stores a new record unless its ID is taken, in which case the stored record is returned.
+    // announce: tell the WebSocket subscribers and raise alerts.
+    std::optional<weatherRegistration> insert_record(const weatherRegistration &newEntry, bool announce = true) {
+        int id = newEntry.m_id;
+        std::optional<weatherRegistration> existing;
+        {
+            weather_trace::span_t span{phase_t::store};
+            std::unique_lock<std::shared_mutex> lock(m_store_lock);
+            // Only IDs the filter may have seen pay for the lookup in the index and the segments
+            if (m_ids.may_contain(id)) {
+                auto started = std::chrono::steady_clock::now();
+                existing = find_stored(id);
+                if (!existing) {
+                    ++m_bloom_false_positives;
+                    m_bloom_false_positive_time += std::chrono::steady_clock::now() - started;
+                }
+            }
+            if (!existing) {
+                m_weather.push_back(newEntry);
+                m_places.add(newEntry.m_placeName, hot_base() + m_weather.size() - 1);
+                m_hot_ids.emplace(id, m_weather.size() - 1);
+                m_ids.add(id);
+            }
+        }
+        ++m_ingest_checks;
+        if (existing) {
+            ++m_duplicates;
+            return existing;
+        }
+        if (m_cache)
+            m_cache->on_write(newEntry.m_date);
+        if (m_primary)
+            m_primary->publish_insert(newEntry);
+
+        // Notify all connected WebSocket clients once the response is on its way
+        if (announce) {
+            broadcast(serialize(newEntry));
+            raise_alerts(newEntry);
+        }
+        maybe_compact();
+        return std::nullopt;
+    }
+
+    // Replaces the record with this ID, unless there is none or the new ID is another record's
+    update_t update_record(int id, const weatherRegistration &updatedEntry, bool announce = true) {
+        int old_date = 0;
+        {
+            weather_trace::span_t span{phase_t::store};
+            std::unique_lock<std::shared_mutex> lock(m_store_lock);
+            auto it = find_hot(id);
+            decltype(find_cold(id)) cold{};
+            if (it == m_weather.end()) {
+                cold = find_cold(id);
+                if (!cold.first)
+                    return update_t::not_found;
+            }
+            if (updatedEntry.m_id != id && m_ids.may_contain(updatedEntry.m_id) && find_stored(updatedEntry.m_id))
+                return update_t::id_taken;
+
+            auto base = hot_base();
+            if (it != m_weather.end()) {
+                auto i = static_cast<std::size_t>(it - m_weather.begin());
+                old_date = it->m_date;
+                if (it->m_placeName != updatedEntry.m_placeName) {
+                    m_places.remove(it->m_placeName, base + i);
+                    m_places.add(updatedEntry.m_placeName, base + i);
+                }
+                *it = updatedEntry;
+                if (updatedEntry.m_id != id) {
+                    m_hot_ids.erase(id);
+                    m_hot_ids.emplace(updatedEntry.m_id, i);
+                }
+                if (i < m_compacting)
+                    m_compaction_stale = true; // the segment being written has the old copy
+            } else {
+                // Segments are immutable: an archived record is hidden there and the new copy
+                // goes to the hot store
+                auto &[segment, pos] = cold;
+                auto archived = segment->at(pos);
+                old_date = archived.m_date;
+                segment->drop(pos);
+                m_places.remove(archived.m_placeName, segment->first_seq() + pos);
+                m_weather.push_back(updatedEntry);
+                m_places.add(updatedEntry.m_placeName, base + m_weather.size() - 1);
+                m_hot_ids.emplace(updatedEntry.m_id, m_weather.size() - 1);
+                ++m_generation;
+            }
+        }
+
+        if (m_cache) {
+            m_cache->on_write(old_date);
+            m_cache->on_write(updatedEntry.m_date);
+        }
+        if (updatedEntry.m_id != id)
+            m_ids.add(updatedEntry.m_id);
+        if (m_primary)
+            m_primary->publish_update(id, updatedEntry);
+        if (announce)
+            raise_alerts(updatedEntry);
+        return update_t::updated;
+    }
+
+    // Changes streamed from the primary. Replays may repeat what a snapshot already holds, so
+    // inserts are upserts and an update whose record has moved to a new ID is one as well.
+    void apply_upsert(const weatherRegistration &entry) {
+        if (auto existing = insert_record(entry); existing && !same_record(*existing, entry))
+            update_record(entry.m_id, entry);
+    }
+
+    void apply_update(int id, const weatherRegistration &entry) {
+        if (update_record(id, entry) != update_t::updated)
+            apply_upsert(entry);
+    }
+
+    // Replaces the whole store with a snapshot from the primary: records the primary no longer
+    // has go, archived ones included, and the indexes and the cache start over
+    void apply_snapshot(weatherStation_t records) {
+        {
+            std::unique_lock<std::shared_mutex> lock(m_store_lock);
+            if (m_cold)
+                m_cold->clear();
+            m_weather = std::move(records);
+            m_places = weather_places::place_index_t{};
+            m_ids = weather_bloom::bloom_filter_t{};
+            auto base = hot_base();
+            for (std::size_t i = 0; i < m_weather.size(); ++i) {
+                m_places.add(m_weather[i].m_placeName, base + i);
+                m_ids.add(m_weather[i].m_id);
+            }
+            index_hot_ids();
+            ++m_generation;
+            if (m_compacting > 0)
+                m_compaction_stale = true; // the segment being written holds replaced records
+        }
+        if (m_cache)
+            m_cache->on_replace();
+        maybe_compact();
+    }
+
+    // Copies the store on a worker for a follower that needs a snapshot
+    void snapshot(std::function<void(std::shared_ptr<weatherStation_t>)> done) const {
+        auto job = [this, done] {
+            auto records = std::make_shared<weatherStation_t>(collect([](const auto &) { return true; }, [](const auto &segment, auto &out) {
+                segment.for_each([&out](const auto &entry) { out.push_back(entry); });
+            }));
+            restinio::asio_ns::post(m_ioctx, [done, records] { done(records); });
+        };
+        if (!m_workers || !m_workers->try_submit(weather_workers::priority_t::low, job))
+            job();
+    }
+
+    restinio::request_handling_status_t read_only(const restinio::request_handle_t &req) const {
+        return done(req->create_response(restinio::status_method_not_allowed()).append_header("Allow", "GET, OPTIONS"),
+                    "Read-only replica; send writes to the primary");
+    }
+
+    restinio::request_handling_status_t handing_off(const restinio::request_handle_t &req) const {
+        return done(req->create_response(restinio::status_service_unavailable()).append_header("Retry-After", "1").connection_close(),
+                    "Restarting; retry shortly");
+    }
+
+    // Stops taking writes and hands a snapshot of the store and the alert rules to send. The
+    // snapshot is taken after the last write, so the new process misses nothing.
+    void prepare_handoff(std::function<void(int)> send) {
+        m_handing_off = true;
+        snapshot([this, send](std::shared_ptr<weatherStation_t> records) {
+            int fd = -1;
+            try {
+                fd = weather_handoff::write_snapshot(*records, serialize(m_alerts.rules()));
+            } catch (const std::exception &ex) {
+                std::cerr << "Handoff snapshot failed: " << ex.what() << std::endl;
+            }
+            send(fd);
+        });
+    }
+
+    // The new process accepts now: stop accepting here, close the WebSocket subscribers a few at
+    // a time over the first half of the drain period so they do not all reconnect at once, and
+    // stop once nothing is in flight or the drain period is over
+    void drain() {
+        weather_handoff::draining() = true;
+        m_listener->stop();
+        if (m_primary)
+            m_primary->stop_accepting();
+        m_drain_start = std::chrono::steady_clock::now();
+        for (const auto &[id, ws] : m_registry)
+            m_closing.push_back(id);
+        drain_tick();
+    }
+
+    void drain_tick() {
+        auto elapsed = std::chrono::steady_clock::now() - m_drain_start;
+        auto spread = std::chrono::duration_cast<std::chrono::steady_clock::duration>(m_drain) / 2;
+        auto due = elapsed >= spread ? m_closing.size()
+                                     : static_cast<std::size_t>(m_closing.size() * static_cast<double>(elapsed.count()) / spread.count());
+        for (; m_closed < due; ++m_closed) {
+            auto it = m_registry.find(m_closing[m_closed]);
+            if (it != m_registry.end()) {
+                it->second->send_message(rws::message_t{
+                    rws::final_frame_flag_t::final_frame,
+                    rws::opcode_t::connection_close_frame,
+                    std::string("\x03\xf4", 2) // 1012: service restart
+                });
+            }
+        }
+        bool idle = m_closed == m_closing.size() && m_registry.empty() && weather_metrics::registry_t::instance().in_flight() == 0;
+        if (idle || elapsed >= m_drain)
+            return m_ioctx.stop();
+        m_drain_timer.expires_after(std::chrono::milliseconds(50));
+        m_drain_timer.async_wait([this](const auto &ec) {
+            if (!ec)
+                drain_tick();
+        });
+    }
+
+    // The stored record with this ID, in memory or archived
+    std::optional<weatherRegistration> find_stored(int id) const {
+        auto it = find_hot(id);
+        if (it != m_weather.end())
+            return *it;
+        if (auto [segment, pos] = find_cold(id); segment)
+            return segment->at(pos);
+        return std::nullopt;
+    }
+
+    // The record with this ID in memory, or m_weather.end()
+    weatherStation_t::iterator find_hot(int id) {
+        auto it = m_hot_ids.find(id);
+        return it == m_hot_ids.end() ? m_weather.end() : m_weather.begin() + static_cast<std::ptrdiff_t>(it->second);
+    }
+
+    weatherStation_t::const_iterator find_hot(int id) const {
+        auto it = m_hot_ids.find(id);
+        return it == m_hot_ids.end() ? m_weather.cend() : m_weather.cbegin() + static_cast<std::ptrdiff_t>(it->second);
+    }
+
+    // Rebuilds m_hot_ids after records moved in m_weather; called with m_store_lock held exclusively
+    void index_hot_ids() {
+        m_hot_ids.clear();
+        m_hot_ids.reserve(m_weather.size());
+        for (std::size_t i = 0; i < m_weather.size(); ++i)
+            m_hot_ids.emplace(m_weather[i].m_id, i);
+    }
+
+    // Newest live copy of a record in the segments, if any
+    std::pair<std::shared_ptr<weather_cold::segment_t>, std::size_t> find_cold(int id) const {
+        if (m_cold) {
+            auto segments = m_cold->segments();
+            for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+                auto pos = (*it)->find(id);
+                if (pos != weather_cold::segment_t::npos)
+                    return { *it, pos };
+            }
+        }
+        return { nullptr, 0 };
+    }
+
+    // Waits for the end of a /debug/trace window, then sends the dump and ends the response.
+    // While nothing is written RESTinio applies handle_request_timeout (1 s) to the response,
+    // so until then a space is sent every trace_keep_alive; JSON allows leading whitespace.
+    void continue_trace_capture(std::shared_ptr<trace_capture_t> capture) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= capture->end) {
+            weather_metrics::request_scope_t scope{capture->pending};
+            auto body = weather_trace::tracer_t::instance().dump_chrome_json(capture->window, trace_route_names());
+            weather_metrics::request_scope_t::set_response(200, body.size());
+            capture->resp.append_chunk(std::move(body));
+            capture->resp.done();
+            return;
+        }
+
+        if (now > capture->end - capture->window) { // on the first call the headers were just flushed
+            capture->resp.append_chunk(" ");
+            capture->resp.flush();
+        }
+        capture->timer.expires_after(std::min<std::chrono::steady_clock::duration>(capture->end - now, trace_keep_alive));
+        capture->timer.async_wait([this, capture](const auto &ec) {
+            if (!ec)
+                continue_trace_capture(capture);
+        });
+    }
+
+    // Reads the next chunk of an export on a worker and writes it on the I/O thread
+    void next_export_chunk(std::shared_ptr<export_t> job) {
+        auto read = [this, job] {
+            std::string chunk;
+            try {
+                chunk = job->compressor.process(read_export_chunk(*job), job->finished);
+            } catch (const std::exception &ex) {
+                std::cerr << "Export failed: " << ex.what() << std::endl;
+                job->failed = true;
+            }
+            restinio::asio_ns::post(m_ioctx, [this, job, chunk = std::move(chunk)]() mutable {
+                write_export_chunk(job, std::move(chunk));
+            });
+        };
+
+        if (!m_workers) {
+            read();
+        } else if (!m_workers->try_submit(weather_workers::priority_t::low, read)) {
+            auto timer = std::make_shared<restinio::asio_ns::steady_timer>(m_ioctx, std::chrono::milliseconds(10));
+            timer->async_wait([this, job, timer](const auto &) { next_export_chunk(job); });
+        }
+    }
+
+    void write_export_chunk(std::shared_ptr<export_t> job, std::string chunk) {
+        if (job->failed) {
+            // No terminating chunk: the builder is dropped with the job, and the connection is
+            // closed once handle_request_timeout passes without more output, so the client sees
+            // a cut-off body instead of a complete 200
+            weather_metrics::request_scope_t scope{job->pending};
+            weather_metrics::request_scope_t::set_response(500, job->bytes);
+            return;
+        }
+        job->bytes += chunk.size();
+        bool chunk_empty = chunk.empty();
+        if (!chunk_empty)
+            job->resp.append_chunk(std::move(chunk));
+
+        if (job->finished) {
+            weather_metrics::request_scope_t scope{job->pending};
+            weather_metrics::request_scope_t::set_response(200, job->bytes);
+            job->resp.done();
+            return;
+        }
+        if (chunk_empty) // the compressor is still buffering
+            return next_export_chunk(job);
+        job->resp.flush([this, job](const auto &ec) {
+            if (!ec)
+                return next_export_chunk(job);
+
+            // The client went away: record what was sent so the request is not left in flight
+            weather_metrics::request_scope_t scope{job->pending};
+            weather_metrics::request_scope_t::set_response(200, job->bytes);
+        });
+    }
+
+    // Encodes records from job.next on until the chunk is full: first from the segment holding
+    // that position, then from the hot store
+    std::string read_export_chunk(export_t &job) const {
+        std::string out;
+        if (!job.started)
+            out = weather_export::preamble(job.format);
+        job.started = true;
+
+        auto add = [&job, &out](const weatherRegistration &entry) {
+            if (entry.m_date >= job.from && entry.m_date <= job.to)
+                weather_export::append(out, job.format, entry);
+        };
+        while (out.size() < export_chunk && !job.finished) {
+            std::shared_ptr<weather_cold::segment_t> segment;
+            {
+                std::shared_lock<std::shared_mutex> lock(m_store_lock);
+                std::uint64_t hot_base = m_cold ? m_cold->end_seq() : 0;
+                if (job.next < hot_base)
+                    segment = m_cold->locate(job.next);
+                if (!segment) {
+                    auto pos = static_cast<std::size_t>(std::max(job.next, hot_base) - hot_base);
+                    auto end = std::min(pos + scan_chunk, m_weather.size());
+                    for (; pos < end; ++pos)
+                        add(m_weather[pos]);
+                    job.next = hot_base + pos;
+                    job.finished = pos >= m_weather.size();
+                    continue;
+                }
+            }
+
+            auto first = segment->first_seq();
+            if (segment->may_hold_dates(job.from, job.to))
+                job.next = first + segment->read_from(static_cast<std::size_t>(job.next - first), add);
+            else
+                job.next = first + segment->records();
+        }
+        return out;
+    }
+
+    // Once the hot store outgrows --hot-records, its oldest half is written to a segment on the
+    // worker pool. The records stay hot until the segment is published back on the I/O thread.
+    void maybe_compact() {
+        if (!m_cold || m_compacting > 0 || m_weather.size() <= m_hot_records)
+            return;
+
+        m_compacting = m_weather.size() - m_hot_records / 2;
+        m_compaction_stale = false;
+        auto records = std::make_shared<weatherStation_t>(m_weather.begin(), m_weather.begin() + static_cast<std::ptrdiff_t>(m_compacting));
+        auto job = [this, records] {
+            std::shared_ptr<weather_cold::segment_t> segment;
+            try {
+                segment = m_cold->write(*records);
+            } catch (const std::exception &ex) {
+                std::cerr << "Compaction failed: " << ex.what() << std::endl;
+            }
+            restinio::asio_ns::post(m_ioctx, [this, segment] { finish_compaction(segment); });
+        };
+        if (!m_workers)
+            job();
+        else if (!m_workers->try_submit(weather_workers::priority_t::low, job))
+            m_compacting = 0; // pool is busy; retry on a later write
+    }
+
+    void finish_compaction(std::shared_ptr<weather_cold::segment_t> segment) {
+        if (segment && !m_compaction_stale) {
+            std::unique_lock<std::shared_mutex> lock(m_store_lock);
+            m_cold->add(segment);
+            m_weather.erase(m_weather.begin(), m_weather.begin() + static_cast<std::ptrdiff_t>(m_compacting));
+            index_hot_ids();
+            ++m_generation;
+            ++m_compactions;
+        } else {
+            if (segment)
+                weather_cold::cold_store_t::discard(segment);
+            else
+                ++m_compactions_failed;
+        }
+        m_compacting = 0;
+    }
+
+    // Pushes the alerts a new or updated record raises to the WebSocket subscribers
+    void raise_alerts(const weatherRegistration &entry) {
+        for (const auto &alert : m_alerts.evaluate(entry))
+            broadcast(serialize(alert));
+    }
+
+    // Queues a message for all WebSocket clients. The fan-out runs as a separate task on the
+    // I/O thread so the request that triggered it does not pay for every subscriber.
+    void broadcast(std::string json_msg) {
+        if (m_broadcasts.push(std::move(json_msg)))
+            restinio::asio_ns::post(m_ioctx, [this] { m_messages_sent += m_broadcasts.drain(m_registry, send_text); });
     }
 };
 
+// Binds a handler method and records the request in the per-route metrics and traces
+template <typename HANDLER, typename METHOD>
+auto bind_route(std::shared_ptr<HANDLER> handler, weather_metrics::route_t route, METHOD method) {
+    return [handler, route, method](const restinio::request_handle_t &req, rr::route_params_t params) {
+        weather_metrics::request_scope_t scope{route, req->body().size()};
+        weather_trace::request_span_t span{static_cast<std::uint32_t>(route)};
+        return ((*handler).*method)(req, std::move(params));
+    };
+}
+
 // Configure routes and bind handlers
-auto server_handler(weatherStation_t &weatherStation) {
+auto server_handler(weatherStation_t &weatherStation, restinio::asio_ns::io_context &ioctx,
+                    weather_workers::worker_pool_t *workers, weather_cache::query_cache_t *cache,
+                    weather_cold::cold_store_t *cold, std::size_t hot_records, std::size_t compress_min,
+                    const weather_replication::config_t &replication, const weather_handoff::config_t &handoff) {
+    using weather_metrics::route_t;
+
+    auto router = std::make_unique<router_t>();
+    auto handler = std::make_shared<weatherInformationHandler>(std::ref(weatherStation), std::ref(ioctx), workers, cache,
+                                                               cold, hot_records, compress_min, replication, handoff);
+    auto bind = [&handler](route_t route, auto method) { return bind_route(handler, route, method); };
+
+    router->http_get("/", bind(route_t::list, &weatherInformationHandler::on_weather_list));
+    router->http_post("/", bind(route_t::post, &weatherInformationHandler::on_weather_post));
+    router->http_put("/:id", bind(route_t::put, &weatherInformationHandler::on_weather_put));
+    router->http_get("/id/:id", bind(route_t::by_id, &weatherInformationHandler::on_weather_by_id));
+    router->http_get("/date/:date", bind(route_t::by_date, &weatherInformationHandler::on_weather_by_date));
+    router->http_get("/latest", bind(route_t::latest, &weatherInformationHandler::on_weather_latest));
+    router->http_get("/chat", bind(route_t::live, &weatherInformationHandler::on_live_update));
+    router->http_get("/metrics", bind(route_t::metrics, &weatherInformationHandler::on_metrics));
+    router->http_get("/debug/trace", bind(route_t::debug_trace, &weatherInformationHandler::on_debug_trace));
+    router->http_get("/export", bind(route_t::bulk_export, &weatherInformationHandler::on_export));
+    router->http_get("/ids", bind(route_t::multi_get, &weatherInformationHandler::on_multi_get));
+    router->http_post("/ids", bind(route_t::multi_get_post, &weatherInformationHandler::on_multi_get_post));
+    router->http_get("/places", bind(route_t::places, &weatherInformationHandler::on_places));
+    router->http_get("/place/:name", bind(route_t::place, &weatherInformationHandler::on_place));
+    router->http_get("/alerts", bind(route_t::alerts_list, &weatherInformationHandler::on_alerts_list));
+    router->http_post("/alerts", bind(route_t::alerts_post, &weatherInformationHandler::on_alerts_post));
+    router->http_delete(R"(/alerts/:id(\d+))", bind(route_t::alerts_delete, &weatherInformationHandler::on_alerts_delete));
+
+    router->add_handler(restinio::http_method_options(), "/", bind(route_t::options, &weatherInformationHandler::on_options));
+    router->add_handler(restinio::http_method_options(), R"(/:id(\d+))", bind(route_t::options, &weatherInformationHandler::on_options));
+    router->add_handler(restinio::http_method_options(), "/ids", bind(route_t::options, &weatherInformationHandler::on_options));
+    router->add_handler(restinio::http_method_options(), "/alerts", bind(route_t::options, &weatherInformationHandler::on_options));
+    router->add_handler(restinio::http_method_options(), R"(/alerts/:id(\d+))", bind(route_t::options, &weatherInformationHandler::on_options));
+
+    return std::make_unique<request_handler_t>(std::make_unique<weather_trace::traced_router_t<router_t>>(std::move(router)));
+}
+
+// Store shard owned by one event loop in --shards mode
+struct weatherShard {
+    weatherStation_t records;
+    std::vector<std::int64_t> inserted; // insertion time of each record, orders results across shards
+    std::map<std::uint64_t, rws::ws_handle_t> registry; // WebSocket clients connected to this loop
+};
+
+using weatherShards_t = weather_shards::shard_set_t<weatherShard>;
+using stampedRecords_t = std::vector<std::pair<std::int64_t, weatherRegistration>>;
+
+inline std::int64_t insertion_stamp() {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+// Merges per-shard results into one list in insertion order
+inline weatherStation_t merge_shards(std::vector<stampedRecords_t> parts) {
+    stampedRecords_t all;
+    for (auto &part : parts)
+        all.insert(all.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+    std::sort(all.begin(), all.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    weatherStation_t result;
+    result.reserve(all.size());
+    for (auto &stamped : all)
+        result.push_back(std::move(stamped.second));
+    return result;
+}
+
+// Handles the weather endpoints for one event loop in --shards mode. Records are partitioned
+// over the loops by ID hash: point operations run on the owning loop, list queries scatter to
+// every loop and gather the results. Each loop only touches its own shard.
+class shardedWeatherHandler {
+public:
+    shardedWeatherHandler(weatherShards_t &shards, std::size_t index) : m_shards(shards), m_index(index) {}
+
+    // GET all weather data
+    auto on_weather_list(const restinio::request_handle_t &req, rr::route_params_t) {
+        return gather(req, [](const weatherShard &shard) {
+            stampedRecords_t part;
+            for (std::size_t i = 0; i < shard.records.size(); ++i)
+                part.emplace_back(shard.inserted[i], shard.records[i]);
+            return part;
+        });
+    }
+
+    // POST new weather data; IDs are unique as with the single event loop
+    auto on_weather_post(const restinio::request_handle_t &req, rr::route_params_t) {
+        try {
+            auto newEntry = parse<weatherRegistration>(req->body());
+            auto owner = m_shards.owner_of(newEntry.m_id);
+
+            m_shards.run_on(owner, m_index,
+                [this, req, copy = is_copy(req), pending = weather_metrics::request_scope_t::defer(), entry = std::move(newEntry)](weatherShard &shard) mutable {
+                    weather_metrics::request_scope_t scope{pending};
+                    if (auto it = weather_lookup::find_id(shard.records, entry.m_id); it != shard.records.end()) {
+                        if (same_record(*it, entry)) {
+                            done(init_resp(req->create_response()), R"({"status": "exists"})");
+                            return;
+                        }
+                        auto id = std::to_string(entry.m_id);
+                        done(req->create_response(restinio::status_conflict()), "ID " + id + " is taken; use PUT /" + id + " to change it");
+                        return;
+                    }
+                    shard.records.push_back(std::move(entry));
+                    shard.inserted.push_back(insertion_stamp());
+                    if (!copy)
+                        broadcast(serialize(shard.records.back()));
+                    done(init_resp(req->create_response(restinio::status_created())), R"({"status": "added"})");
+                });
+            return restinio::request_accepted();
+        } catch (const std::exception &ex) {
+            return done(req->create_response(restinio::status_bad_request()), std::string("Error: ") + ex.what());
+        }
+    }
+
+    // PUT update a weather entry by ID
+    auto on_weather_put(const restinio::request_handle_t &req, rr::route_params_t params) {
+        try {
+            int id = std::stoi(std::string(params["id"]));
+            auto updatedEntry = parse<weatherRegistration>(req->body());
+
+            m_shards.run_on(m_shards.owner_of(id), m_index,
+                [this, req, id, pending = weather_metrics::request_scope_t::defer(), entry = std::move(updatedEntry)](weatherShard &shard) mutable {
+                    weather_metrics::request_scope_t scope{pending};
+                    auto it = weather_lookup::find_id(shard.records, id);
+                    if (it == shard.records.end()) {
+                        done(req->create_response(restinio::status_not_found()), "ID not found");
+                        return;
+                    }
+
+                    auto owner = m_shards.owner_of(id);
+                    auto new_owner = m_shards.owner_of(entry.m_id);
+                    if (new_owner == owner) {
+                        if (entry.m_id != id && weather_lookup::find_id(shard.records, entry.m_id) != shard.records.end()) {
+                            id_taken(req, entry.m_id);
+                            return;
+                        }
+                        *it = std::move(entry);
+                        done(init_resp(req->create_response()), R"({"status": "updated"})");
+                        return;
+                    }
+
+                    // The update changed the ID: move the record to the shard owning the new one.
+                    // That shard checks the new ID is free; if not, the record goes back here.
+                    auto pos = static_cast<std::size_t>(it - shard.records.begin());
+                    auto stamp = shard.inserted[pos];
+                    auto previous = std::move(*it);
+                    shard.records.erase(it);
+                    shard.inserted.erase(shard.inserted.begin() + static_cast<std::ptrdiff_t>(pos));
+                    m_shards.run_on(new_owner, owner,
+                        [this, req, owner, new_owner, stamp, pending = weather_metrics::request_scope_t::defer(), entry = std::move(entry),
+                         previous = std::move(previous)](weatherShard &target) mutable {
+                            weather_metrics::request_scope_t scope{pending};
+                            if (weather_lookup::find_id(target.records, entry.m_id) != target.records.end()) {
+                                m_shards.run_on(owner, new_owner, [stamp, previous = std::move(previous)](weatherShard &source) mutable {
+                                    insert_stamped(source, stamp, std::move(previous));
+                                });
+                                id_taken(req, entry.m_id);
+                                return;
+                            }
+                            insert_stamped(target, stamp, std::move(entry));
+                            done(init_resp(req->create_response()), R"({"status": "updated"})");
+                        });
+                });
+            return restinio::request_accepted();
+        } catch (...) {
+            return done(req->create_response(restinio::status_bad_request()), "Invalid data");
+        }
+    }
+
+    // GET single entry by ID
+    auto on_weather_by_id(const restinio::request_handle_t &req, rr::route_params_t params) {
+        int id = std::stoi(std::string(params["id"]));
+        m_shards.run_on(m_shards.owner_of(id), m_index,
+            [req, id, pending = weather_metrics::request_scope_t::defer()](weatherShard &shard) {
+                weather_metrics::request_scope_t scope{pending};
+                auto it = weather_lookup::find_id(shard.records, id);
+                if (it != shard.records.end())
+                    done(init_resp(req->create_response()), serialize(*it));
+                else
+                    done(req->create_response(restinio::status_not_found()), "Not found");
+            });
+        return restinio::request_accepted();
+    }
+
+    // GET all entries from a specific date
+    auto on_weather_by_date(const restinio::request_handle_t &req, rr::route_params_t params) {
+        int date = std::stoi(std::string(params["date"]));
+        return gather(req, [date](const weatherShard &shard) {
+            stampedRecords_t part;
+            for (std::size_t i = 0; i < shard.records.size(); ++i) {
+                if (shard.records[i].m_date == date)
+                    part.emplace_back(shard.inserted[i], shard.records[i]);
+            }
+            return part;
+        });
+    }
+
+    // GET the 3 latest entries
+    auto on_weather_latest(const restinio::request_handle_t &req, rr::route_params_t) {
+        m_shards.scatter_gather(
+            [](const weatherShard &shard) {
+                stampedRecords_t part;
+                auto n = std::min<std::size_t>(3, shard.records.size());
+                for (auto i = shard.records.size() - n; i < shard.records.size(); ++i)
+                    part.emplace_back(shard.inserted[i], shard.records[i]);
+                return part;
+            },
+            [req, pending = weather_metrics::request_scope_t::defer()](std::vector<stampedRecords_t> parts) {
+                weather_metrics::request_scope_t scope{pending};
+                auto merged = merge_shards(std::move(parts));
+                weatherStation_t latest(merged.rbegin(), merged.rbegin() + static_cast<std::ptrdiff_t>(std::min<std::size_t>(3, merged.size())));
+                done(init_resp(req->create_response()), serialize(latest));
+            });
+        return restinio::request_accepted();
+    }
+
+    // WebSocket endpoint for live updates, registered with this loop's shard
+    auto on_live_update(const restinio::request_handle_t &req, rr::route_params_t) {
+        if (restinio::http_connection_header_t::upgrade == req->header().connection()) {
+            auto &registry = m_shards[m_index].state.registry;
+            auto wsh = rws::upgrade<sharded_traits_t>(*req, rws::activation_t::immediate,
+                [&registry](auto wsh, auto m) {
+                    if (rws::opcode_t::text_frame == m->opcode()) {
+                        wsh->send_message(*m);  // echo back
+                    } else if (rws::opcode_t::connection_close_frame == m->opcode()) {
+                        registry.erase(wsh->connection_id());
+                    }
+                });
+
+            registry.emplace(wsh->connection_id(), wsh);
+            weather_metrics::request_scope_t::set_response(101, 0);
+            return restinio::request_accepted();
+        }
+        return restinio::request_rejected();
+    }
+
+    // OPTIONS handler for CORS
+    auto on_options(const restinio::request_handle_t &req, rr::route_params_t) {
+        auto resp = req->create_response();
+        resp.append_header("Access-Control-Allow-Origin", "*")
+            .append_header("Access-Control-Allow-Methods", "GET, POST, PUT, OPTIONS")
+            .append_header("Access-Control-Allow-Headers", "Content-Type");
+        return done(std::move(resp), {});
+    }
+
+    // GET request metrics plus per-shard store and subscriber gauges
+    auto on_metrics(const restinio::request_handle_t &req, rr::route_params_t) {
+        m_shards.scatter_gather(
+            [](const weatherShard &shard) { return std::make_pair(shard.records.size(), shard.registry.size()); },
+            [req, pending = weather_metrics::request_scope_t::defer()](std::vector<std::pair<std::size_t, std::size_t>> parts) {
+                weather_metrics::request_scope_t scope{pending};
+                auto body = weather_metrics::registry_t::instance().render();
+                body += weather_admission::admission_t::instance().render();
+                body += "# HELP weather_store_records Weather records held in the store.\n"
+                        "# TYPE weather_store_records gauge\n";
+                for (std::size_t i = 0; i < parts.size(); ++i)
+                    body += "weather_store_records{shard=\"" + std::to_string(i) + "\"} " + std::to_string(parts[i].first) + "\n";
+                body += "# HELP weather_ws_subscribers Connected WebSocket clients.\n"
+                        "# TYPE weather_ws_subscribers gauge\n";
+                for (std::size_t i = 0; i < parts.size(); ++i)
+                    body += "weather_ws_subscribers{shard=\"" + std::to_string(i) + "\"} " + std::to_string(parts[i].second) + "\n";
+
+                auto resp = req->create_response();
+                resp.append_header("Server", "RESTinio WeatherServer")
+                    .append_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+                done(std::move(resp), std::move(body));
+            });
+        return restinio::request_accepted();
+    }
+
+private:
+    weatherShards_t &m_shards;
+    std::size_t m_index;
+
+    // Puts a record into a shard at the place its insertion stamp gives it
+    static void insert_stamped(weatherShard &shard, std::int64_t stamp, weatherRegistration entry) {
+        auto at = std::upper_bound(shard.inserted.begin(), shard.inserted.end(), stamp);
+        auto offset = at - shard.inserted.begin();
+        shard.inserted.insert(at, stamp);
+        shard.records.insert(shard.records.begin() + offset, std::move(entry));
+    }
+
+    // Scatters a filter to every shard and responds with the merged records
+    template <typename MAP>
+    restinio::request_handling_status_t gather(const restinio::request_handle_t &req, MAP map) {
+        m_shards.scatter_gather(std::move(map),
+            [req, pending = weather_metrics::request_scope_t::defer()](std::vector<stampedRecords_t> parts) {
+                weather_metrics::request_scope_t scope{pending};
+                done(init_resp(req->create_response()), serialize(merge_shards(std::move(parts))));
+            });
+        return restinio::request_accepted();
+    }
+
+    // Sends a message to the WebSocket clients of every loop, each on its own thread
+    void broadcast(std::string json_msg) {
+        auto msg = std::make_shared<const std::string>(std::move(json_msg));
+        for (std::size_t i = 0; i < m_shards.size(); ++i) {
+            m_shards.run_on(i, m_shards.size(), [msg](weatherShard &shard) {
+                weather_broadcast::send_to_all(shard.registry, *msg, send_text);
+            });
+        }
+    }
+};
+
+// Configure routes for one event loop in --shards mode
+auto sharded_server_handler(weatherShards_t &shards, std::size_t index) {
+    using weather_metrics::route_t;
+
     auto router = std::make_unique<router_t>();
-    auto handler = std::make_shared<weatherInformationHandler>(std::ref(weatherStation));
+    auto handler = std::make_shared<shardedWeatherHandler>(std::ref(shards), index);
+    auto bind = [&handler](route_t route, auto method) { return bind_route(handler, route, method); };
+
+    router->http_get("/", bind(route_t::list, &shardedWeatherHandler::on_weather_list));
+    router->http_post("/", bind(route_t::post, &shardedWeatherHandler::on_weather_post));
+    router->http_put("/:id", bind(route_t::put, &shardedWeatherHandler::on_weather_put));
+    router->http_get("/id/:id", bind(route_t::by_id, &shardedWeatherHandler::on_weather_by_id));
+    router->http_get("/date/:date", bind(route_t::by_date, &shardedWeatherHandler::on_weather_by_date));
+    router->http_get("/latest", bind(route_t::latest, &shardedWeatherHandler::on_weather_latest));
+    router->http_get("/chat", bind(route_t::live, &shardedWeatherHandler::on_live_update));
+    router->http_get("/metrics", bind(route_t::metrics, &shardedWeatherHandler::on_metrics));
+
+    router->add_handler(restinio::http_method_options(), "/", bind(route_t::options, &shardedWeatherHandler::on_options));
+    router->add_handler(restinio::http_method_options(), R"(/:id(\d+))", bind(route_t::options, &shardedWeatherHandler::on_options));
+
+    return std::make_unique<request_handler_t>(std::make_unique<weather_trace::traced_router_t<router_t>>(std::move(router)));
+}
+
+// Runs one event loop per shard, each accepting on its own SO_REUSEPORT listener
+void run_sharded(std::size_t count, std::uint16_t port, const weatherStation_t &seed) {
+    using namespace std::chrono;
+
+    weatherShards_t shards{count};
+    for (const auto &entry : seed) {
+        auto &shard = shards[shards.owner_of(entry.m_id)].state;
+        shard.records.push_back(entry);
+        shard.inserted.push_back(insertion_stamp());
+    }
+
+    std::vector<std::thread> loops;
+    for (std::size_t i = 0; i < count; ++i) {
+        loops.emplace_back([&shards, i, port] {
+            try {
+                restinio::run(shards[i].ioctx,
+                    restinio::on_this_thread<sharded_traits_t>()
+                        .address("localhost")
+                        .port(port)
+                        .request_handler(sharded_server_handler(shards, i))
+                        .acceptor_options_setter([](auto &options) {
+                            options.set_option(restinio::asio_ns::socket_base::reuse_address(true));
+                            options.set_option(weather_shards::reuse_port_t(true));
+                        })
+                        .read_next_http_message_timelimit(10s)
+                        .write_http_response_timelimit(1s)
+                        .handle_request_timeout(1s));
+            } catch (const std::exception &ex) {
+                std::cerr << "Error in shard " << i << ": " << ex.what() << std::endl;
+            }
+        });
+    }
+    for (auto &loop : loops)
+        loop.join();
+}
+
+// Drops the records whose ID an earlier record already has, as POST would refuse them; returns
+// how many were dropped. The IDs are sorted once, so clean seed data costs no more than that.
+std::size_t drop_duplicate_ids(weatherStation_t &records) {
+    std::vector<int> ids;
+    ids.reserve(records.size());
+    for (const auto &entry : records)
+        ids.push_back(entry.m_id);
+    std::sort(ids.begin(), ids.end());
+    if (std::adjacent_find(ids.begin(), ids.end()) == ids.end())
+        return 0;
 
-    router->http_get("/", std::bind(&weatherInformationHandler::on_weather_list, handler, std::placeholders::_1, std::placeholders::_2));
-    router->http_post("/", std::bind(&weatherInformationHandler::on_weather_post, handler, std::placeholders::_1, std::placeholders::_2));
-    router->http_put("/:id", std::bind(&weatherInformationHandler::on_weather_put, handler, std::placeholders::_1, std::placeholders::_2));
-    router->http_get("/id/:id", std::bind(&weatherInformationHandler::on_weather_by_id, handler, std::placeholders::_1, std::placeholders::_2));
-    router->http_get("/date/:date", std::bind(&weatherInformationHandler::on_weather_by_date, handler, std::placeholders::_1, std::placeholders::_2));
-    router->http_get("/latest", std::bind(&weatherInformationHandler::on_weather_latest, handler, std::placeholders::_1, std::placeholders::_2));
-    router->http_get("/chat", std::bind(&weatherInformationHandler::on_live_update, handler, std::placeholders::_1, std::placeholders::_2));
+    std::unordered_map<int, bool> seen; // only the IDs that occur more than once
+    for (auto it = ids.begin(); (it = std::adjacent_find(it, ids.end())) != ids.end(); it = std::upper_bound(it, ids.end(), *it))
+        seen.emplace(*it, false);
+    auto before = records.size();
+    records.erase(std::remove_if(records.begin(), records.end(), [&seen](const auto &entry) {
+                      auto it = seen.find(entry.m_id);
+                      return it != seen.end() && std::exchange(it->second, true);
+                  }),
+                  records.end());
+    return before - records.size();
+}
+
+// Loads the --seed files, each parsed in parallel on every core, and reports the load rate
+weatherStation_t load_seed_files(const std::vector<std::string> &files) {
+    auto start = std::chrono::steady_clock::now();
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
 
-    router->add_handler(restinio::http_method_options(), "/", std::bind(&weatherInformationHandler::on_options, handler, std::placeholders::_1, std::placeholders::_2));
-    router->add_handler(restinio::http_method_options(), R"(/:id(\d+))", std::bind(&weatherInformationHandler::on_options, handler, std::placeholders::_1, std::placeholders::_2));
+    weatherStation_t records;
+    std::size_t skipped = 0;
+    for (const auto &file : files) {
+        auto result = weather_seed::load_file(file, threads);
+        if (records.empty())
+            records = std::move(result.records);
+        else
+            std::move(result.records.begin(), result.records.end(), std::back_inserter(records));
+        skipped += result.skipped;
+    }
+    auto duplicates = drop_duplicate_ids(records);
 
-    return router;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded " << records.size() << " records from " << files.size() << " seed file(s) in "
+              << seconds << " s (" << (records.empty() ? 0.0 : seconds * 1e6 / records.size())
+              << " s per million records, " << threads << " threads)";
+    if (skipped > 0)
+        std::cout << ", skipped " << skipped << " malformed lines";
+    if (duplicates > 0)
+        std::cout << ", dropped " << duplicates << " records with a duplicate ID";
+    std::cout << std::endl;
+    return records;
+}
+
+// Moves all but the newest hot_records / 2 seed records straight into segments, written in
+// parallel, so the server starts with the same layout compaction would have produced
+void archive_seed(weatherStation_t &records, weather_cold::cold_store_t &cold, std::size_t hot_records) {
+    constexpr std::size_t segment_records = 1 << 20;
+    if (records.size() <= hot_records)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    auto archived = records.size() - hot_records / 2;
+    std::vector<std::shared_ptr<weather_cold::segment_t>> segments((archived + segment_records - 1) / segment_records);
+    std::vector<std::thread> writers;
+    for (std::size_t i = 0; i < segments.size(); ++i) {
+        writers.emplace_back([&, i] {
+            auto first = records.begin() + static_cast<std::ptrdiff_t>(i * segment_records);
+            auto last = records.begin() + static_cast<std::ptrdiff_t>(std::min(archived, (i + 1) * segment_records));
+            segments[i] = cold.write(weatherStation_t(first, last));
+        });
+        if (writers.size() == std::max(1u, std::thread::hardware_concurrency())) {
+            for (auto &writer : writers)
+                writer.join();
+            writers.clear();
+        }
+    }
+    for (auto &writer : writers)
+        writer.join();
+
+    for (auto &segment : segments)
+        cold.add(std::move(segment));
+    records.erase(records.begin(), records.begin() + static_cast<std::ptrdiff_t>(archived));
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Archived " << archived << " seed records into " << segments.size() << " segment(s) in "
+              << seconds << " s" << std::endl;
 }
 
 // Entry point of the server application
-int main() {
+//   --trace-sample N   trace one request in every N (default 0: only on /debug/trace demand)
+//   --shards N         run N shared-nothing event loops (0: one per core) instead of one
+//   --workers N        run GET / and /date/:date on N worker threads (default 2, 0: on the I/O thread)
+//   --worker-queue N   jobs queued per priority class before answering 503 (default 64)
+//   --cache-mb N       memory for cached /date/:date, /latest and GET / results (default 64, 0: off)
+//   --hot-records N    keep at most N records in memory (at least 16); older ones are compacted
+//                      into segment files (default 0: keep everything in memory)
+//   --cold-dir PATH    directory for the segment files (default weather-segments)
+//   --seed FILE        load the store from a .csv or NDJSON file before listening (repeatable)
+//   --compress-min N   compress GET /, /date/:date and /latest bodies of at least N bytes when
+//                      the client accepts gzip, deflate or zstd (default 1024)
+//   --read-rate R      GET requests per second per client IP before answering 429 (default 0: no limit)
+//   --write-rate R     POST/PUT/DELETE requests per second per client IP before answering 429 (default 0: no limit)
+//   --max-in-flight N  requests in progress before new ones get 503 (default 0: no limit)
+//   --port N           HTTP port (default 8080)
+//   --replicate-port N serve the store to followers on 127.0.0.1:N
+//   --replication-log N  changes kept for followers to catch up from without a snapshot (default 65536)
+//   --follow HOST:PORT run as a read-only replica of the primary replicating on HOST:PORT
+//                      (replication needs the single event loop: it is ignored with --shards)
+//   --handoff PATH     let a new server take over through the Unix socket PATH (see handoff.hpp)
+//   --take-over PATH   take over the sockets and the store of the server waiting on PATH, instead
+//                      of loading --seed files; upgrade with --take-over PATH --handoff PATH
+//   --drain-seconds N  after handing over, wait at most N seconds for requests in flight (default 10)
+//                      (handoff needs the single event loop as well)
+int main(int argc, char *argv[]) {
     using namespace std::chrono;
 
     try {
+        long shards = -1;
+        std::size_t workers = 2;
+        std::size_t worker_queue = 64;
+        std::size_t cache_mb = 64;
+        std::size_t hot_records = 0;
+        std::string cold_dir = "weather-segments";
+        std::vector<std::string> seed_files;
+        std::size_t compress_min = 1024;
+        weather_admission::config_t admission;
+        std::uint16_t port = 8080;
+        weather_replication::config_t replication;
+        weather_handoff::config_t handoff;
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--trace-sample") == 0 && i + 1 < argc)
+                weather_trace::tracer_t::instance().set_sample_every(static_cast<std::uint32_t>(std::stoul(argv[++i])));
+            else if (std::strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+                shards = std::stol(argv[++i]);
+            else if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+                workers = std::stoul(argv[++i]);
+            else if (std::strcmp(argv[i], "--worker-queue") == 0 && i + 1 < argc)
+                worker_queue = std::stoul(argv[++i]);
+            else if (std::strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc)
+                cache_mb = std::stoul(argv[++i]);
+            else if (std::strcmp(argv[i], "--hot-records") == 0 && i + 1 < argc)
+                hot_records = std::stoul(argv[++i]);
+            else if (std::strcmp(argv[i], "--cold-dir") == 0 && i + 1 < argc)
+                cold_dir = argv[++i];
+            else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+                seed_files.push_back(argv[++i]);
+            else if (std::strcmp(argv[i], "--compress-min") == 0 && i + 1 < argc)
+                compress_min = std::stoul(argv[++i]);
+            else if (std::strcmp(argv[i], "--read-rate") == 0 && i + 1 < argc)
+                admission.read_rate = std::stod(argv[++i]);
+            else if (std::strcmp(argv[i], "--write-rate") == 0 && i + 1 < argc)
+                admission.write_rate = std::stod(argv[++i]);
+            else if (std::strcmp(argv[i], "--max-in-flight") == 0 && i + 1 < argc)
+                admission.max_in_flight = std::stoul(argv[++i]);
+            else if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+                port = static_cast<std::uint16_t>(std::stoul(argv[++i]));
+            else if (std::strcmp(argv[i], "--replicate-port") == 0 && i + 1 < argc)
+                replication.listen_port = static_cast<std::uint16_t>(std::stoul(argv[++i]));
+            else if (std::strcmp(argv[i], "--replication-log") == 0 && i + 1 < argc)
+                replication.log_changes = std::max<std::size_t>(std::stoul(argv[++i]), 1);
+            else if (std::strcmp(argv[i], "--follow") == 0 && i + 1 < argc) {
+                std::string primary = argv[++i];
+                auto colon = primary.rfind(':');
+                if (colon == std::string::npos)
+                    throw std::invalid_argument("--follow expects HOST:PORT");
+                replication.primary_host = primary.substr(0, colon);
+                replication.primary_port = primary.substr(colon + 1);
+            } else if (std::strcmp(argv[i], "--handoff") == 0 && i + 1 < argc)
+                handoff.listen_path = argv[++i];
+            else if (std::strcmp(argv[i], "--take-over") == 0 && i + 1 < argc)
+                handoff.take_over_path = argv[++i];
+            else if (std::strcmp(argv[i], "--drain-seconds") == 0 && i + 1 < argc)
+                handoff.drain = std::chrono::seconds(std::stoul(argv[++i]));
+        }
+        weather_admission::admission_t::instance().configure(admission);
+
         weatherStation_t weatherStation{
             {1, 20240415, 1015, "Aarhus N", 13.692, 19.438, 13.1, 70}
         };
+        std::unique_ptr<weather_handoff::taken_t> taken;
+        if (!handoff.take_over_path.empty() && shards < 0) {
+            taken = std::make_unique<weather_handoff::taken_t>(handoff.take_over_path);
+            weatherStation = std::move(taken->snapshot.records);
+            handoff.rules = std::move(taken->snapshot.rules);
+            if (replication.listen_port != 0)
+                replication.listener = taken->replication_listener;
+            else if (taken->replication_listener >= 0)
+                ::close(taken->replication_listener);
+        } else if (!seed_files.empty())
+            weatherStation = load_seed_files(seed_files);
 
-        restinio::run(
+        if (shards >= 0) {
+            run_sharded(shards > 0 ? static_cast<std::size_t>(shards) : std::max(1u, std::thread::hardware_concurrency()), port,
+                        weatherStation);
+            return 0;
+        }
+
+        restinio::asio_ns::io_context ioctx;
+        std::unique_ptr<weather_workers::worker_pool_t> pool;
+        if (workers > 0)
+            pool = std::make_unique<weather_workers::worker_pool_t>(workers, worker_queue);
+        std::unique_ptr<weather_cache::query_cache_t> cache;
+        if (cache_mb > 0)
+            cache = std::make_unique<weather_cache::query_cache_t>(cache_mb << 20);
+        std::unique_ptr<weather_cold::cold_store_t> cold;
+        if (hot_records > 0) {
+            hot_records = std::max<std::size_t>(hot_records, 16);
+            cold = std::make_unique<weather_cold::cold_store_t>(cold_dir);
+            archive_seed(weatherStation, *cold, hot_records);
+        }
+
+        // A server taking over binds a throwaway port, then swaps in the inherited listener
+        weather_handoff::listener_t listener;
+        handoff.listener = &listener;
+        restinio::http_server_t<traits_t> server{
+            restinio::external_io_context(ioctx),
             restinio::on_this_thread<traits_t>()
                 .address("localhost")
-                .port(8080)
-                .request_handler(server_handler(weatherStation))
+                .port(taken ? 0 : port)
+                .request_handler(server_handler(weatherStation, ioctx, pool.get(), cache.get(), cold.get(), hot_records, compress_min,
+                                                replication, handoff))
+                .acceptor_post_bind_hook([&listener, &taken](auto &acceptor) {
+                    if (taken)
+                        weather_handoff::adopt(acceptor, taken->listener);
+                    listener.fd = acceptor.native_handle();
+                })
                 .read_next_http_message_timelimit(10s)
                 .write_http_response_timelimit(1s)
-                .handle_request_timeout(1s));
+                .handle_request_timeout(1s)};
+        listener.stop = [&server] { server.close_async([] {}, [](std::exception_ptr) {}); };
+
+        // The same start and Ctrl-C handling as restinio::run, plus the handoff's ready reply
+        restinio::asio_ns::signal_set break_signals{ ioctx, SIGINT };
+        break_signals.async_wait([&server, &ioctx](const auto &ec, int) {
+            if (!ec)
+                server.close_async([&ioctx] { ioctx.stop(); }, [](std::exception_ptr ex) { std::rethrow_exception(ex); });
+        });
+        server.open_async(
+            [&taken] {
+                if (taken)
+                    taken->ready();
+            },
+            [](std::exception_ptr ex) { std::rethrow_exception(ex); });
+        ioctx.run();
+        pool.reset(); // finish queued jobs while the handler is alive
     } catch (const std::exception &ex) {
         std::cerr << "Error: " << ex.what() << std::endl;
         return 1;
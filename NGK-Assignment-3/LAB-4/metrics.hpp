@@ -0,0 +1,309 @@
+#pragma once
+
+// Per-route request metrics for the weather server, rendered in the Prometheus text format.
+//
+// Every thread that handles requests owns its own shard of counters. A shard is only ever
+// written by its owning thread, so recording a request is a handful of relaxed atomic
+// stores with no locking and no shared cache lines. A scrape sums all shards.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace weather_metrics {
+
+// Routes tracked individually
+enum class route_t : std::size_t {
+    list, post, put, by_id, by_date, latest, live, options, metrics, debug_trace, bulk_export,
+    multi_get, multi_get_post, places, place, alerts_list, alerts_post, alerts_delete,
+    count
+};
+
+constexpr std::size_t route_count = static_cast<std::size_t>(route_t::count);
+
+struct route_info_t {
+    const char *method;
+    const char *path;
+};
+
+constexpr std::array<route_info_t, route_count> routes{{
+    {"GET", "/"},
+    {"POST", "/"},
+    {"PUT", "/:id"},
+    {"GET", "/id/:id"},
+    {"GET", "/date/:date"},
+    {"GET", "/latest"},
+    {"GET", "/chat"},
+    {"OPTIONS", "/"},
+    {"GET", "/metrics"},
+    {"GET", "/debug/trace"},
+    {"GET", "/export"},
+    {"GET", "/ids"},
+    {"POST", "/ids"},
+    {"GET", "/places"},
+    {"GET", "/place/:name"},
+    {"GET", "/alerts"},
+    {"POST", "/alerts"},
+    {"DELETE", "/alerts/:id"},
+}};
+
+// Status codes counted individually, everything else ends up in the last slot
+constexpr std::array<std::uint16_t, 15> status_codes{
+    101, 200, 201, 202, 204, 206, 304, 400, 404, 405, 409, 413, 429, 500, 503
+};
+constexpr std::size_t status_slots = status_codes.size() + 1;
+
+inline std::size_t status_slot(std::uint16_t code) {
+    auto it = std::find(status_codes.begin(), status_codes.end(), code);
+    return static_cast<std::size_t>(it - status_codes.begin());
+}
+
+// HDR-style log-linear latency buckets in microseconds: two sub-buckets per power of two
+// (1, 2, 3, 4, 6, 8, 12, ...), which keeps the relative error below 50% from 1us up to ~67s.
+constexpr std::size_t latency_buckets = 52;
+
+constexpr std::array<std::uint64_t, latency_buckets> make_latency_bounds() {
+    std::array<std::uint64_t, latency_buckets> bounds{};
+    bounds[0] = 1;
+    for (std::size_t i = 1; i < latency_buckets; ++i) {
+        std::uint64_t octave = std::uint64_t{1} << ((i - 1) / 2);
+        bounds[i] = (i % 2) ? 2 * octave : 3 * octave;
+    }
+    return bounds;
+}
+constexpr auto latency_bounds = make_latency_bounds();
+
+// Body size buckets in bytes: powers of two from 64 B to 64 MiB
+constexpr std::size_t size_buckets = 21;
+
+constexpr std::array<std::uint64_t, size_buckets> make_size_bounds() {
+    std::array<std::uint64_t, size_buckets> bounds{};
+    for (std::size_t i = 0; i < size_buckets; ++i)
+        bounds[i] = std::uint64_t{64} << i;
+    return bounds;
+}
+constexpr auto size_bounds = make_size_bounds();
+
+template <std::size_t N>
+std::size_t bucket_of(const std::array<std::uint64_t, N> &bounds, std::uint64_t value) {
+    return static_cast<std::size_t>(std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin());
+}
+
+// Counter with a single writer: a relaxed load/store pair avoids the locked read-modify-write
+// of fetch_add, while scrapes from other threads still see a consistent value.
+class counter_t {
+public:
+    void add(std::uint64_t n = 1) { m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    std::uint64_t get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<std::uint64_t> m_value{0};
+};
+
+template <std::size_t Buckets>
+struct histogram_t {
+    std::array<counter_t, Buckets + 1> buckets; // last bucket is +Inf
+    counter_t sum;
+};
+
+// All counters written by one thread
+struct alignas(64) shard_t {
+    std::array<std::array<counter_t, status_slots>, route_count> responses;
+    std::array<histogram_t<latency_buckets>, route_count> latency_us;
+    std::array<histogram_t<size_buckets>, route_count> request_bytes;
+    std::array<histogram_t<size_buckets>, route_count> response_bytes;
+};
+
+class registry_t {
+public:
+    static registry_t &instance() {
+        static registry_t registry;
+        return registry;
+    }
+
+    // Records one finished request on the calling thread's shard
+    void observe(route_t route, std::uint16_t status, std::chrono::nanoseconds latency,
+                 std::size_t request_bytes, std::size_t response_bytes) {
+        auto r = static_cast<std::size_t>(route);
+        auto &shard = local_shard();
+        auto us = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+
+        shard.responses[r][status_slot(status)].add();
+        shard.latency_us[r].buckets[bucket_of(latency_bounds, us)].add();
+        shard.latency_us[r].sum.add(us);
+        shard.request_bytes[r].buckets[bucket_of(size_bounds, request_bytes)].add();
+        shard.request_bytes[r].sum.add(request_bytes);
+        shard.response_bytes[r].buckets[bucket_of(size_bounds, response_bytes)].add();
+        shard.response_bytes[r].sum.add(response_bytes);
+    }
+
+    // Requests that have started but not yet sent their response, across all threads
+    std::int64_t in_flight() const { return m_in_flight.load(std::memory_order_relaxed); }
+    void request_started() { m_in_flight.fetch_add(1, std::memory_order_relaxed); }
+    void request_finished() { m_in_flight.fetch_sub(1, std::memory_order_relaxed); }
+
+    // Sums all shards and renders them in the Prometheus text exposition format
+    std::string render() const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        std::string out;
+
+        out += "# HELP weather_http_requests_in_flight Requests waiting for their response.\n"
+               "# TYPE weather_http_requests_in_flight gauge\n"
+               "weather_http_requests_in_flight " + std::to_string(in_flight()) + "\n";
+
+        out += "# HELP weather_http_requests_total Requests handled, by route and status code.\n"
+               "# TYPE weather_http_requests_total counter\n";
+        for (std::size_t r = 0; r < route_count; ++r) {
+            for (std::size_t s = 0; s < status_slots; ++s) {
+                std::uint64_t total = 0;
+                for (const auto &shard : m_shards)
+                    total += shard->responses[r][s].get();
+                if (total == 0)
+                    continue;
+                std::string code = s < status_codes.size() ? std::to_string(status_codes[s]) : "other";
+                out += "weather_http_requests_total{" + labels(r) + ",code=\"" + code + "\"} " + std::to_string(total) + "\n";
+            }
+        }
+
+        render_histogram(out, "weather_http_request_duration_seconds",
+                         "Time spent in the route handler.", &shard_t::latency_us, latency_bounds, 1e-6);
+        render_histogram(out, "weather_http_request_body_bytes",
+                         "Size of request bodies.", &shard_t::request_bytes, size_bounds, 1.0);
+        render_histogram(out, "weather_http_response_body_bytes",
+                         "Size of response bodies.", &shard_t::response_bytes, size_bounds, 1.0);
+        return out;
+    }
+
+private:
+    registry_t() = default;
+
+    shard_t &local_shard() {
+        thread_local shard_t *shard = nullptr;
+        if (!shard) {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_shards.push_back(std::make_unique<shard_t>());
+            shard = m_shards.back().get();
+        }
+        return *shard;
+    }
+
+    static std::string labels(std::size_t r) {
+        return std::string("method=\"") + routes[r].method + "\",route=\"" + routes[r].path + "\"";
+    }
+
+    static std::string number(double value) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.9g", value);
+        return buf;
+    }
+
+    template <std::size_t Buckets>
+    void render_histogram(std::string &out, const char *name, const char *help,
+                          std::array<histogram_t<Buckets>, route_count> shard_t::*field,
+                          const std::array<std::uint64_t, Buckets> &bounds, double scale) const {
+        out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " histogram\n";
+        for (std::size_t r = 0; r < route_count; ++r) {
+            std::array<std::uint64_t, Buckets + 1> buckets{};
+            std::uint64_t sum = 0;
+            for (const auto &shard : m_shards) {
+                const auto &hist = ((*shard).*field)[r];
+                for (std::size_t b = 0; b <= Buckets; ++b)
+                    buckets[b] += hist.buckets[b].get();
+                sum += hist.sum.get();
+            }
+
+            std::uint64_t cumulative = 0;
+            for (std::size_t b = 0; b < Buckets; ++b) {
+                cumulative += buckets[b];
+                out += std::string(name) + "_bucket{" + labels(r) + ",le=\"" + number(bounds[b] * scale) + "\"} " + std::to_string(cumulative) + "\n";
+            }
+            cumulative += buckets[Buckets];
+            out += std::string(name) + "_bucket{" + labels(r) + ",le=\"+Inf\"} " + std::to_string(cumulative) + "\n";
+            out += std::string(name) + "_sum{" + labels(r) + "} " + number(sum * scale) + "\n";
+            out += std::string(name) + "_count{" + labels(r) + "} " + std::to_string(cumulative) + "\n";
+        }
+    }
+
+    mutable std::mutex m_lock;
+    std::vector<std::unique_ptr<shard_t>> m_shards;
+    std::atomic<std::int64_t> m_in_flight{0};
+};
+
+// A request whose response is sent later, possibly from another thread
+struct in_flight_t {
+    route_t route = route_t::count;
+    std::size_t request_bytes = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Times one request on the current thread. The handler reports the response it sent through
+// set_response(); the request is recorded when the scope closes.
+class request_scope_t {
+public:
+    request_scope_t(route_t route, std::size_t request_bytes)
+        : m_route{ route }, m_request_bytes{ request_bytes }, m_start{ std::chrono::steady_clock::now() },
+          m_previous{ current() } {
+        current() = this;
+        if (m_route != route_t::count)
+            registry_t::instance().request_started();
+    }
+
+    // Resumes a deferred request on the thread that sends its response
+    explicit request_scope_t(const in_flight_t &deferred)
+        : m_route{ deferred.route }, m_request_bytes{ deferred.request_bytes }, m_start{ deferred.start },
+          m_previous{ current() } {
+        current() = this;
+    }
+
+    ~request_scope_t() {
+        current() = m_previous;
+        if (m_route != route_t::count) {
+            registry_t::instance().observe(m_route, m_status, std::chrono::steady_clock::now() - m_start,
+                                           m_request_bytes, m_response_bytes);
+            registry_t::instance().request_finished();
+        }
+    }
+
+    request_scope_t(const request_scope_t &) = delete;
+    request_scope_t &operator=(const request_scope_t &) = delete;
+
+    static void set_response(std::uint16_t status, std::size_t response_bytes) {
+        if (auto *scope = current()) {
+            scope->m_status = status;
+            scope->m_response_bytes = response_bytes;
+        }
+    }
+
+    // Hands the current request over to a scope created later with the returned value; the
+    // current scope then records nothing
+    static in_flight_t defer() {
+        in_flight_t deferred;
+        if (auto *scope = current()) {
+            deferred = { scope->m_route, scope->m_request_bytes, scope->m_start };
+            scope->m_route = route_t::count;
+        }
+        return deferred;
+    }
+
+private:
+    static request_scope_t *&current() {
+        thread_local request_scope_t *scope = nullptr;
+        return scope;
+    }
+
+    route_t m_route;
+    std::size_t m_request_bytes;
+    std::chrono::steady_clock::time_point m_start;
+    request_scope_t *m_previous;
+    std::uint16_t m_status = 0;
+    std::size_t m_response_bytes = 0;
+};
+
+} // namespace weather_metrics
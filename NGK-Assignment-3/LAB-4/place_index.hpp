@@ -0,0 +1,102 @@
+#pragma once
+
+// Place-name index for the weather store.
+//
+// Place names are interned once. Each place has a posting list with the insertion positions
+// of its records, which stay the same when records are compacted into segments, so the list
+// covers the hot store and the segments alike. For autocomplete, the case-folded names are
+// kept sorted: all names with a given prefix form one contiguous run found by binary search.
+
+#include <json_dto/pub.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace weather_places {
+
+// One autocomplete suggestion
+struct place_match_t {
+    std::string m_name;
+    std::uint64_t m_records = 0;
+
+    template <typename JSON_IO>
+    void json_io(JSON_IO &io) {
+        io & json_dto::mandatory("PlaceName", m_name)
+           & json_dto::mandatory("Records", m_records);
+    }
+};
+
+class place_index_t {
+public:
+    // Records that the record at insertion position seq belongs to the named place
+    void add(const std::string &name, std::uint64_t seq) {
+        auto &postings = m_postings[intern(name)];
+        if (postings.empty() || postings.back() < seq)
+            postings.push_back(seq);
+        else
+            postings.insert(std::lower_bound(postings.begin(), postings.end(), seq), seq);
+    }
+
+    void remove(const std::string &name, std::uint64_t seq) {
+        auto it = m_ids.find(name);
+        if (it == m_ids.end())
+            return;
+        auto &postings = m_postings[it->second];
+        auto at = std::lower_bound(postings.begin(), postings.end(), seq);
+        if (at != postings.end() && *at == seq)
+            postings.erase(at);
+    }
+
+    // Insertion positions of the records of a place, ascending; nullptr for unknown places
+    const std::vector<std::uint64_t> *postings(const std::string &name) const {
+        auto it = m_ids.find(name);
+        return it == m_ids.end() ? nullptr : &m_postings[it->second];
+    }
+
+    // Up to limit places whose name starts with prefix, ignoring ASCII case, in name order
+    std::vector<place_match_t> complete(std::string_view prefix, std::size_t limit) const {
+        auto key = fold(prefix);
+        std::vector<place_match_t> matches;
+        auto it = std::lower_bound(m_sorted.begin(), m_sorted.end(), std::make_pair(key, std::uint32_t{0}));
+        for (; it != m_sorted.end() && matches.size() < limit; ++it) {
+            if (it->first.compare(0, key.size(), key) != 0)
+                break;
+            if (!m_postings[it->second].empty())
+                matches.push_back({ m_names[it->second], m_postings[it->second].size() });
+        }
+        return matches;
+    }
+
+    std::size_t places() const { return m_names.size(); }
+
+private:
+    static std::string fold(std::string_view name) {
+        std::string folded(name);
+        std::transform(folded.begin(), folded.end(), folded.begin(), [](unsigned char c) { return std::tolower(c); });
+        return folded;
+    }
+
+    std::uint32_t intern(const std::string &name) {
+        auto [it, inserted] = m_ids.try_emplace(name, static_cast<std::uint32_t>(m_names.size()));
+        if (inserted) {
+            m_names.push_back(name);
+            m_postings.emplace_back();
+            auto entry = std::make_pair(fold(name), it->second);
+            m_sorted.insert(std::lower_bound(m_sorted.begin(), m_sorted.end(), entry), std::move(entry));
+        }
+        return it->second;
+    }
+
+    std::vector<std::string> m_names;                       // by place id
+    std::vector<std::vector<std::uint64_t>> m_postings;     // by place id
+    std::unordered_map<std::string, std::uint32_t> m_ids;
+    std::vector<std::pair<std::string, std::uint32_t>> m_sorted; // (folded name, place id)
+};
+
+} // namespace weather_places
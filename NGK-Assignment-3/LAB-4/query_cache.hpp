@@ -0,0 +1,189 @@
+#pragma once
+
+// Bounded LRU cache of serialized query results for the weather server.
+//
+// Every entry is tagged with the version of the data it was built from: the version of one
+// date for /date/:date, or the global version for queries over the whole store (/latest,
+// GET /). A write bumps the version of the date it touched plus the global version, so only
+// the entries depending on that date go stale; historical dates stay cached until evicted.
+// Compressed copies of a body are kept in its entry and go stale with it.
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace weather_cache {
+
+class query_cache_t {
+public:
+    // Content encodings a body may be cached in besides identity
+    static constexpr std::size_t max_encodings = 4;
+
+    // What a cached result depends on, and the version it was built from
+    struct tag_t {
+        bool global;
+        int date;
+        std::uint64_t version;
+    };
+
+    struct stats_t {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t stale = 0;
+        std::uint64_t evictions = 0;
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+    };
+
+    explicit query_cache_t(std::size_t max_bytes) : m_max_bytes{ max_bytes } {}
+
+    // Take the tag before reading the store, so a write racing with the query marks the result stale
+    tag_t tag_for_date(int date) const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto it = m_date_versions.find(date);
+        return { false, date, it == m_date_versions.end() ? m_base_version : it->second };
+    }
+
+    tag_t tag_global() const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return { true, 0, m_global_version };
+    }
+
+    // Returns the cached body if it is still current
+    std::shared_ptr<const std::string> get(const std::string &key) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto it = m_index.find(key);
+        if (it == m_index.end()) {
+            ++m_stats.misses;
+            return nullptr;
+        }
+
+        auto entry = it->second;
+        if (!current(entry->tag)) {
+            ++m_stats.stale;
+            ++m_stats.misses;
+            erase(entry);
+            return nullptr;
+        }
+
+        ++m_stats.hits;
+        m_lru.splice(m_lru.begin(), m_lru, entry);
+        return entry->body;
+    }
+
+    // Caches body if it is still current; returns it either way
+    std::shared_ptr<const std::string> put(const std::string &key, tag_t tag, std::string body) {
+        auto shared = std::make_shared<const std::string>(std::move(body));
+        auto size = key.size() + shared->size();
+        if (size > m_max_bytes / 4)
+            return shared; // one huge result would flush everything else
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!current(tag))
+            return shared; // the data changed while the result was being built
+
+        auto it = m_index.find(key);
+        if (it != m_index.end())
+            erase(it->second);
+
+        m_lru.push_front({ key, tag, shared, {}, size });
+        m_index.emplace(key, m_lru.begin());
+        m_stats.bytes += size;
+        evict();
+        return shared;
+    }
+
+    // The copy of body in the given encoding, if one was cached with it
+    std::shared_ptr<const std::string> get_encoded(const std::string &key, const std::shared_ptr<const std::string> &body,
+                                                   std::size_t encoding) const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto it = m_index.find(key);
+        if (it == m_index.end() || it->second->body != body)
+            return nullptr;
+        return it->second->encoded[encoding];
+    }
+
+    // Keeps an encoded copy next to body, as long as body is still the cached one
+    void add_encoded(const std::string &key, const std::shared_ptr<const std::string> &body, std::size_t encoding,
+                     std::shared_ptr<const std::string> encoded) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto it = m_index.find(key);
+        if (it == m_index.end() || it->second->body != body || it->second->encoded[encoding])
+            return;
+
+        it->second->size += encoded->size();
+        m_stats.bytes += encoded->size();
+        it->second->encoded[encoding] = std::move(encoded);
+        evict();
+    }
+
+    // Invalidates results depending on the given date and on the whole store
+    void on_write(int date) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        ++m_date_versions.try_emplace(date, m_base_version).first->second;
+        ++m_global_version;
+    }
+
+    // Drops every result, for a store replaced as a whole. Every date moves to a version no
+    // tag taken before has, so queries still running cannot cache what they read either.
+    void on_replace() {
+        std::lock_guard<std::mutex> lock(m_lock);
+        while (!m_lru.empty())
+            erase(m_lru.begin());
+        m_base_version = ++m_global_version;
+        m_date_versions.clear();
+    }
+
+    stats_t stats() const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto stats = m_stats;
+        stats.entries = m_lru.size();
+        return stats;
+    }
+
+private:
+    struct entry_t {
+        std::string key;
+        tag_t tag;
+        std::shared_ptr<const std::string> body;
+        std::array<std::shared_ptr<const std::string>, max_encodings> encoded;
+        std::size_t size;
+    };
+    using lru_t = std::list<entry_t>;
+
+    bool current(const tag_t &tag) const {
+        if (tag.global)
+            return tag.version == m_global_version;
+        auto it = m_date_versions.find(tag.date);
+        return tag.version == (it == m_date_versions.end() ? m_base_version : it->second);
+    }
+
+    void evict() {
+        while (m_stats.bytes > m_max_bytes && !m_lru.empty()) {
+            erase(std::prev(m_lru.end()));
+            ++m_stats.evictions;
+        }
+    }
+
+    void erase(lru_t::iterator entry) {
+        m_stats.bytes -= entry->size;
+        m_index.erase(entry->key);
+        m_lru.erase(entry);
+    }
+
+    const std::size_t m_max_bytes;
+    mutable std::mutex m_lock;
+    lru_t m_lru;
+    std::unordered_map<std::string, lru_t::iterator> m_index;
+    std::unordered_map<int, std::uint64_t> m_date_versions;
+    std::uint64_t m_global_version = 0;
+    std::uint64_t m_base_version = 0; // version of the dates not written since the last on_replace
+    stats_t m_stats;
+};
+
+} // namespace weather_cache
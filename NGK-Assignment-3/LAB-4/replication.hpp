@@ -0,0 +1,533 @@
+#pragma once
+
+// Leader/follower replication of the weather store over TCP.
+//
+// The primary numbers every insert and update it stores and keeps the newest ones in a
+// bounded in-memory log. A follower connects, says which primary run (epoch) and sequence
+// number it has applied up to, and is streamed the log from there. A follower that is new,
+// belongs to another run or has fallen behind the log first gets a snapshot of the whole
+// store. The follower builds the snapshot apart from its store and swaps it in whole when the
+// snapshot ends, so records the primary no longer has do not survive. Inserts are applied as
+// upserts by ID, so a snapshot taken while writes continue is made exact by replaying the log
+// from the sequence number the snapshot started at.
+//
+// Each session pulls its next frames from the log or snapshot when its previous write has
+// completed, so a slow follower costs the primary one pending write, never a growing queue.
+// A follower further behind than the log reaches is disconnected; it reconnects and catches
+// up with a snapshot.
+//
+// Every frame is
+//
+//   u32 payload size | u8 type | u64 sequence number | i64 primary clock (us) | payload
+//
+// in native byte order: primary and followers run on the same machine.
+
+#include "weather_registration.hpp"
+#include "cold_store.hpp"
+
+#include <restinio/all.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace weather_replication {
+
+namespace asio = restinio::asio_ns;
+using tcp = asio::ip::tcp;
+
+enum class frame_t : std::uint8_t {
+    hello = 1,       // follower -> primary: u64 epoch, u64 applied sequence number
+    snapshot_begin,  // u64 epoch; the snapshot includes every change up to seq
+    snapshot_records,
+    snapshot_end,
+    insert,          // record
+    update,          // i32 ID, record
+    heartbeat        // u64 epoch; seq is the newest change
+};
+
+constexpr std::size_t header_size = 4 + 1 + 8 + 8;
+constexpr std::size_t max_payload = 64 << 20;
+constexpr std::size_t snapshot_batch = 1024;      // records per snapshot frame
+constexpr std::size_t write_batch = 256 * 1024;   // bytes gathered into one socket write
+
+inline std::int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+template <typename T>
+void put(std::string &out, T value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+T get(std::string_view in, std::size_t &pos) {
+    T value;
+    if (in.size() - pos < sizeof(value))
+        throw std::runtime_error("truncated replication frame");
+    std::memcpy(&value, in.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return value;
+}
+
+inline void append_frame(std::string &out, frame_t type, std::uint64_t seq, std::int64_t time_us, std::string_view payload) {
+    put(out, static_cast<std::uint32_t>(payload.size()));
+    put(out, static_cast<std::uint8_t>(type));
+    put(out, seq);
+    put(out, time_us);
+    out.append(payload);
+}
+
+struct config_t {
+    std::uint16_t listen_port = 0; // serve followers on 127.0.0.1:listen_port; 0: off
+    std::string primary_host;      // follow the primary at primary_host:primary_port; empty: off
+    std::string primary_port;
+    std::size_t log_changes = 65536; // changes kept for followers to catch up from
+    int listener = -1;               // listening socket handed over by a replaced server; -1: bind
+};
+
+// A change in the replication log: an encoded insert or update frame
+struct change_t {
+    std::uint64_t seq;
+    std::string frame;
+};
+
+// Serves the store to followers. Lives on the I/O thread, like the store's writers.
+class primary_t {
+public:
+    // Copies the whole store and hands the copy to done on the I/O thread
+    using snapshot_fn_t = std::function<void(std::function<void(std::shared_ptr<weatherStation_t>)> done)>;
+
+    // listener: a listening socket handed over by the server this one replaces, or -1 to bind port
+    primary_t(asio::io_context &ioctx, std::uint16_t port, std::size_t log_capacity, snapshot_fn_t snapshot, int listener = -1)
+        : m_acceptor{ ioctx }, m_heartbeat{ ioctx }, m_log_capacity{ log_capacity }, m_snapshot{ std::move(snapshot) },
+          m_epoch{ std::random_device{}() | static_cast<std::uint64_t>(std::random_device{}()) << 32 } {
+        if (listener >= 0)
+            m_acceptor.assign(tcp::v4(), listener);
+        else
+            m_acceptor = tcp::acceptor{ ioctx, tcp::endpoint{ asio::ip::make_address("127.0.0.1"), port } };
+        accept();
+        schedule_heartbeat();
+    }
+
+    // The listening socket, for handing over to a replacing server
+    int listener() { return m_acceptor.native_handle(); }
+
+    // Stops taking followers; the connected ones are served until the process exits
+    void stop_accepting() {
+        asio::error_code ignored;
+        m_acceptor.close(ignored);
+    }
+
+    void publish_insert(const weatherRegistration &entry) {
+        std::string payload;
+        weather_cold::append_record(payload, entry);
+        publish(frame_t::insert, payload);
+    }
+
+    void publish_update(int id, const weatherRegistration &entry) {
+        std::string payload;
+        put(payload, static_cast<std::int32_t>(id));
+        weather_cold::append_record(payload, entry);
+        publish(frame_t::update, payload);
+    }
+
+    // Followers, the log and each follower's distance from the head, for Prometheus
+    std::string render() const {
+        std::string out = "# HELP weather_replication_followers Followers connected to this primary.\n"
+                          "# TYPE weather_replication_followers gauge\n"
+                          "weather_replication_followers " + std::to_string(m_sessions.size()) + "\n"
+                          "# HELP weather_replication_log_head Sequence number of the newest replicated change.\n"
+                          "# TYPE weather_replication_log_head counter\n"
+                          "weather_replication_log_head " + std::to_string(m_head) + "\n"
+                          "# HELP weather_replication_log_changes Changes kept for followers to catch up from.\n"
+                          "# TYPE weather_replication_log_changes gauge\n"
+                          "weather_replication_log_changes " + std::to_string(m_log.size()) + "\n"
+                          "# HELP weather_replication_snapshots_sent_total Full snapshots sent to followers.\n"
+                          "# TYPE weather_replication_snapshots_sent_total counter\n"
+                          "weather_replication_snapshots_sent_total " + std::to_string(m_snapshots_sent) + "\n"
+                          "# HELP weather_replication_followers_dropped_total Followers disconnected for falling behind the log.\n"
+                          "# TYPE weather_replication_followers_dropped_total counter\n"
+                          "weather_replication_followers_dropped_total " + std::to_string(m_dropped) + "\n"
+                          "# HELP weather_replication_follower_lag_changes Changes not yet sent to a follower.\n"
+                          "# TYPE weather_replication_follower_lag_changes gauge\n";
+        for (const auto &session : m_sessions)
+            out += "weather_replication_follower_lag_changes{follower=\"" + session->name + "\"} " +
+                   std::to_string(m_head + 1 - std::min(session->next, m_head + 1)) + "\n";
+        return out;
+    }
+
+private:
+    struct session_t {
+        explicit session_t(tcp::socket s) : socket{ std::move(s) } {}
+
+        tcp::socket socket;
+        std::string name;
+        std::string in;
+        std::string out;
+        bool ready = false;   // hello received
+        bool writing = false;
+        std::uint64_t next = 0; // next change to send
+        std::shared_ptr<weatherStation_t> snapshot;
+        std::size_t snapshot_pos = 0;
+        std::uint64_t snapshot_seq = 0;
+        bool snapshot_pending = false;
+    };
+    using session_ptr = std::shared_ptr<session_t>;
+
+    void publish(frame_t type, std::string_view payload) {
+        change_t change{ ++m_head, {} };
+        append_frame(change.frame, type, change.seq, now_us(), payload);
+        m_log.push_back(std::move(change));
+        if (m_log.size() > m_log_capacity)
+            m_log.pop_front();
+        for (const auto &session : m_sessions)
+            pump(session);
+    }
+
+    std::uint64_t log_first() const { return m_log.empty() ? m_head + 1 : m_log.front().seq; }
+
+    void accept() {
+        m_acceptor.async_accept([this](const auto &ec, tcp::socket socket) {
+            if (ec)
+                return;
+            auto session = std::make_shared<session_t>(std::move(socket));
+            asio::error_code ignored;
+            auto remote = session->socket.remote_endpoint(ignored);
+            session->name = remote.address().to_string() + ":" + std::to_string(remote.port());
+            session->socket.set_option(tcp::no_delay{ true }, ignored);
+            m_sessions.push_back(session);
+            read_hello(session);
+            accept();
+        });
+    }
+
+    void read_hello(const session_ptr &session) {
+        session->in.resize(header_size + 16);
+        asio::async_read(session->socket, asio::buffer(session->in), [this, session](const auto &ec, std::size_t) {
+            if (ec)
+                return close(session);
+            try {
+                std::size_t pos = 0;
+                std::string_view in{ session->in };
+                auto size = get<std::uint32_t>(in, pos);
+                auto type = static_cast<frame_t>(get<std::uint8_t>(in, pos));
+                pos += 16;
+                auto epoch = get<std::uint64_t>(in, pos);
+                auto applied = get<std::uint64_t>(in, pos);
+                if (type != frame_t::hello || size != 16)
+                    return close(session);
+                session->ready = true;
+                if (epoch == m_epoch && applied + 1 >= log_first() && applied <= m_head)
+                    session->next = applied + 1;
+                else
+                    start_snapshot(session);
+                pump(session);
+                watch(session);
+            } catch (const std::exception &) {
+                close(session);
+            }
+        });
+    }
+
+    // Followers send nothing after hello; a read completes only when the connection goes away
+    void watch(const session_ptr &session) {
+        session->in.resize(1);
+        session->socket.async_read_some(asio::buffer(session->in), [this, session](const auto &ec, std::size_t) {
+            if (ec)
+                return close(session);
+            watch(session);
+        });
+    }
+
+    void start_snapshot(const session_ptr &session) {
+        session->snapshot_pending = true;
+        session->snapshot_seq = m_head;
+        ++m_snapshots_sent;
+        m_snapshot([this, session](std::shared_ptr<weatherStation_t> records) {
+            if (!session->socket.is_open())
+                return;
+            session->snapshot = std::move(records);
+            session->snapshot_pos = 0;
+            session->snapshot_pending = false;
+            std::string payload;
+            put(payload, m_epoch);
+            append_frame(session->out, frame_t::snapshot_begin, session->snapshot_seq, now_us(), payload);
+            pump(session);
+        });
+    }
+
+    // Starts the next write of a session if it has none in progress
+    void pump(const session_ptr &session) {
+        if (!session->ready || session->writing || session->snapshot_pending || !session->socket.is_open())
+            return;
+
+        if (session->snapshot) {
+            auto &records = *session->snapshot;
+            while (session->out.size() < write_batch && session->snapshot_pos < records.size()) {
+                std::string payload;
+                auto end = std::min(records.size(), session->snapshot_pos + snapshot_batch);
+                for (; session->snapshot_pos < end; ++session->snapshot_pos)
+                    weather_cold::append_record(payload, records[session->snapshot_pos]);
+                append_frame(session->out, frame_t::snapshot_records, session->snapshot_seq, now_us(), payload);
+            }
+            if (session->snapshot_pos == records.size()) {
+                append_frame(session->out, frame_t::snapshot_end, session->snapshot_seq, now_us(), {});
+                session->snapshot.reset();
+                session->next = session->snapshot_seq + 1;
+            }
+        }
+
+        if (!session->snapshot && session->next <= m_head) {
+            if (session->next < log_first()) {
+                ++m_dropped;
+                return close(session); // the changes it needs are gone; it will take a snapshot
+            }
+            for (auto it = m_log.begin() + static_cast<std::ptrdiff_t>(session->next - log_first());
+                 it != m_log.end() && session->out.size() < write_batch; ++it) {
+                session->out += it->frame;
+                session->next = it->seq + 1;
+            }
+        }
+
+        if (session->out.empty())
+            return;
+        session->writing = true;
+        auto buffer = std::make_shared<std::string>(std::move(session->out));
+        session->out.clear();
+        asio::async_write(session->socket, asio::buffer(*buffer), [this, session, buffer](const auto &ec, std::size_t) {
+            session->writing = false;
+            if (ec)
+                return close(session);
+            pump(session);
+        });
+    }
+
+    void schedule_heartbeat() {
+        m_heartbeat.expires_after(std::chrono::seconds(1));
+        m_heartbeat.async_wait([this](const auto &ec) {
+            if (ec)
+                return;
+            std::string payload;
+            put(payload, m_epoch);
+            for (const auto &session : m_sessions) {
+                if (session->ready && !session->writing && !session->snapshot && !session->snapshot_pending && session->next > m_head) {
+                    append_frame(session->out, frame_t::heartbeat, m_head, now_us(), payload);
+                    pump(session);
+                }
+            }
+            schedule_heartbeat();
+        });
+    }
+
+    void close(const session_ptr &session) {
+        asio::error_code ignored;
+        session->socket.close(ignored);
+        session->snapshot.reset();
+        m_sessions.remove(session);
+    }
+
+    tcp::acceptor m_acceptor;
+    asio::steady_timer m_heartbeat;
+    std::size_t m_log_capacity;
+    snapshot_fn_t m_snapshot;
+    std::uint64_t m_epoch;
+    std::uint64_t m_head = 0;
+    std::deque<change_t> m_log;
+    std::list<session_ptr> m_sessions;
+    std::uint64_t m_snapshots_sent = 0;
+    std::uint64_t m_dropped = 0;
+};
+
+// Keeps a local store in step with a primary. Lives on the I/O thread and applies changes
+// there, through the same paths as the HTTP write routes.
+class follower_t {
+public:
+    struct apply_t {
+        std::function<void(const weatherRegistration &)> upsert;
+        std::function<void(int id, const weatherRegistration &)> update;
+        std::function<void(weatherStation_t)> replace; // the whole store, from a snapshot
+    };
+
+    follower_t(asio::io_context &ioctx, std::string host, std::string port, apply_t apply)
+        : m_socket{ ioctx }, m_resolver{ ioctx }, m_retry{ ioctx },
+          m_host{ std::move(host) }, m_port{ std::move(port) }, m_apply{ std::move(apply) } {
+        connect();
+    }
+
+    // Connection state and how far this follower trails the primary, for Prometheus
+    std::string render() const {
+        auto head = std::max(m_head, m_applied);
+        double contact = m_last_contact_us ? (now_us() - m_last_contact_us) / 1e6 : 0.0;
+        return "# HELP weather_replication_connected Whether this follower is connected to its primary.\n"
+               "# TYPE weather_replication_connected gauge\n"
+               "weather_replication_connected " + std::to_string(m_connected ? 1 : 0) + "\n"
+               "# HELP weather_replication_applied Sequence number of the newest change applied here.\n"
+               "# TYPE weather_replication_applied counter\n"
+               "weather_replication_applied " + std::to_string(m_applied) + "\n"
+               "# HELP weather_replication_lag_changes Changes the primary has that are not applied here.\n"
+               "# TYPE weather_replication_lag_changes gauge\n"
+               "weather_replication_lag_changes " + std::to_string(head - m_applied) + "\n"
+               "# HELP weather_replication_lag_seconds Age of the newest applied change when it was applied.\n"
+               "# TYPE weather_replication_lag_seconds gauge\n"
+               "weather_replication_lag_seconds " + std::to_string(m_lag_us / 1e6) + "\n"
+               "# HELP weather_replication_last_contact_seconds Time since the last message from the primary.\n"
+               "# TYPE weather_replication_last_contact_seconds gauge\n"
+               "weather_replication_last_contact_seconds " + std::to_string(contact) + "\n"
+               "# HELP weather_replication_snapshots_total Snapshots received from the primary.\n"
+               "# TYPE weather_replication_snapshots_total counter\n"
+               "weather_replication_snapshots_total " + std::to_string(m_snapshots) + "\n"
+               "# HELP weather_replication_reconnects_total Connections to the primary after the first.\n"
+               "# TYPE weather_replication_reconnects_total counter\n"
+               "weather_replication_reconnects_total " + std::to_string(m_reconnects) + "\n";
+    }
+
+private:
+    void connect() {
+        m_resolver.async_resolve(m_host, m_port, [this](const auto &ec, tcp::resolver::results_type endpoints) {
+            if (ec)
+                return retry();
+            asio::async_connect(m_socket, endpoints, [this](const auto &ec, const tcp::endpoint &) {
+                if (ec)
+                    return retry();
+                m_connected = true;
+                std::string payload;
+                put(payload, m_epoch);
+                put(payload, m_applied);
+                auto hello = std::make_shared<std::string>();
+                append_frame(*hello, frame_t::hello, 0, now_us(), payload);
+                asio::async_write(m_socket, asio::buffer(*hello), [this, hello](const auto &ec, std::size_t) {
+                    if (ec)
+                        return retry();
+                    read_header();
+                });
+            });
+        });
+    }
+
+    void retry() {
+        asio::error_code ignored;
+        m_socket.close(ignored);
+        m_snapshot = weatherStation_t{}; // an interrupted snapshot is fetched again in full
+        if (m_connected)
+            std::cerr << "Replication: lost the primary at " << m_host << ":" << m_port << ", reconnecting" << std::endl;
+        m_connected = false;
+        m_retry.expires_after(std::chrono::seconds(1));
+        m_retry.async_wait([this](const auto &ec) {
+            if (ec)
+                return;
+            ++m_reconnects;
+            connect();
+        });
+    }
+
+    void read_header() {
+        m_in.resize(header_size);
+        asio::async_read(m_socket, asio::buffer(m_in), [this](const auto &ec, std::size_t) {
+            if (ec)
+                return retry();
+            std::size_t pos = 0;
+            std::string_view in{ m_in };
+            auto size = get<std::uint32_t>(in, pos);
+            m_type = static_cast<frame_t>(get<std::uint8_t>(in, pos));
+            m_seq = get<std::uint64_t>(in, pos);
+            m_time_us = get<std::int64_t>(in, pos);
+            if (size > max_payload)
+                return retry();
+            m_in.resize(size);
+            asio::async_read(m_socket, asio::buffer(m_in), [this](const auto &ec, std::size_t) {
+                if (ec)
+                    return retry();
+                try {
+                    handle();
+                } catch (const std::exception &ex) {
+                    std::cerr << "Replication: " << ex.what() << std::endl;
+                    return retry();
+                }
+                read_header();
+            });
+        });
+    }
+
+    void handle() {
+        m_last_contact_us = now_us();
+        std::size_t pos = 0;
+        switch (m_type) {
+        case frame_t::snapshot_begin:
+            m_snapshot_epoch = get<std::uint64_t>(m_in, pos);
+            m_snapshot = weatherStation_t{};
+            ++m_snapshots;
+            break;
+        case frame_t::snapshot_records:
+            while (pos < m_in.size())
+                m_snapshot.push_back(weather_cold::read_record(m_in, pos));
+            break;
+        case frame_t::snapshot_end:
+            // Only a complete snapshot replaces the store and moves this follower to the
+            // primary's run; after an interrupted one it asks for a new snapshot
+            m_apply.replace(std::move(m_snapshot));
+            m_snapshot = weatherStation_t{};
+            m_epoch = m_snapshot_epoch;
+            applied(m_seq);
+            break;
+        case frame_t::insert:
+            m_apply.upsert(weather_cold::read_record(m_in, pos));
+            applied(m_seq);
+            break;
+        case frame_t::update: {
+            auto id = get<std::int32_t>(m_in, pos);
+            m_apply.update(id, weather_cold::read_record(m_in, pos));
+            applied(m_seq);
+            break;
+        }
+        case frame_t::heartbeat:
+            if (get<std::uint64_t>(m_in, pos) != m_epoch)
+                throw std::runtime_error("heartbeat from another primary run");
+            m_head = m_seq;
+            if (m_applied == m_head)
+                m_lag_us = 0;
+            break;
+        default:
+            throw std::runtime_error("unexpected replication frame");
+        }
+    }
+
+    void applied(std::uint64_t seq) {
+        m_applied = seq;
+        m_head = std::max(m_head, seq);
+        m_lag_us = std::max<std::int64_t>(0, now_us() - m_time_us);
+    }
+
+    tcp::socket m_socket;
+    tcp::resolver m_resolver;
+    asio::steady_timer m_retry;
+    std::string m_host;
+    std::string m_port;
+    apply_t m_apply;
+
+    std::string m_in;
+    frame_t m_type{};
+    std::uint64_t m_seq = 0;
+    std::int64_t m_time_us = 0;
+
+    bool m_connected = false;
+    std::uint64_t m_epoch = 0;   // primary run the applied sequence numbers belong to
+    std::uint64_t m_snapshot_epoch = 0;
+    weatherStation_t m_snapshot; // records of the snapshot being received
+    std::uint64_t m_applied = 0;
+    std::uint64_t m_head = 0;
+    std::int64_t m_lag_us = 0;
+    std::int64_t m_last_contact_us = 0;
+    std::uint64_t m_snapshots = 0;
+    std::uint64_t m_reconnects = 0;
+};
+
+} // namespace weather_replication
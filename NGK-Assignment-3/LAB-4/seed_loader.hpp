@@ -0,0 +1,193 @@
+#pragma once
+
+// Bulk loader for seed files at startup.
+//
+// Each file is mmap'd and cut into one chunk per thread at line boundaries; the chunks are
+// parsed in parallel and concatenated in file order. Files ending in .csv hold
+//   ID,Date,Time,PlaceName,Lat,Lon,Temperature,Humidity
+// with an optional header line and double quotes around fields containing commas. Any other
+// file is read as NDJSON: one JSON weather record per line, as accepted by POST /.
+
+#include "weather_registration.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace weather_seed {
+
+struct load_result_t {
+    weatherStation_t records;
+    std::size_t skipped = 0; // malformed lines
+};
+
+// Read-only mapping of a whole file
+class mapped_file_t {
+public:
+    explicit mapped_file_t(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("cannot open seed file " + path + ": " + std::strerror(errno));
+        struct stat st{};
+        ::fstat(fd, &st);
+        m_size = static_cast<std::size_t>(st.st_size);
+        if (m_size > 0) {
+            void *base = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("cannot map seed file " + path + ": " + std::strerror(errno));
+            }
+            m_data = static_cast<const char *>(base);
+            ::madvise(const_cast<char *>(m_data), m_size, MADV_SEQUENTIAL);
+            ::madvise(const_cast<char *>(m_data), m_size, MADV_WILLNEED);
+        }
+        ::close(fd);
+    }
+
+    ~mapped_file_t() {
+        if (m_data)
+            ::munmap(const_cast<char *>(m_data), m_size);
+    }
+
+    mapped_file_t(const mapped_file_t &) = delete;
+    mapped_file_t &operator=(const mapped_file_t &) = delete;
+
+    std::string_view view() const { return { m_data, m_size }; }
+
+private:
+    const char *m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+// Splits a CSV line into at most max fields without copying. A quoted field may contain
+// commas and "" for a quote; it is returned without its outer quotes and quoted is set.
+inline std::size_t split_csv(std::string_view line, std::string_view *fields, bool *quoted, std::size_t max) {
+    std::size_t count = 0;
+    std::size_t pos = 0;
+    for (;;) {
+        if (count == max)
+            return max + 1;
+        quoted[count] = pos < line.size() && line[pos] == '"';
+        std::size_t end;
+        if (quoted[count]) {
+            end = pos + 1;
+            while (end < line.size() && (line[end] != '"' || (end + 1 < line.size() && line[end + 1] == '"')))
+                end += line[end] == '"' ? 2 : 1;
+            fields[count++] = line.substr(pos + 1, end - pos - 1);
+            end = std::min(end + 1, line.size());
+        } else {
+            end = std::min(line.find(',', pos), line.size());
+            fields[count++] = line.substr(pos, end - pos);
+        }
+        if (end >= line.size())
+            return count;
+        pos = end + 1;
+    }
+}
+
+template <typename T>
+bool parse_number(std::string_view field, T &value) {
+    while (!field.empty() && field.front() == ' ')
+        field.remove_prefix(1);
+    auto [end, ec] = std::from_chars(field.data(), field.data() + field.size(), value);
+    return ec == std::errc{} && end == field.data() + field.size();
+}
+
+inline bool parse_csv_line(std::string_view line, weatherRegistration &entry) {
+    std::string_view fields[8];
+    bool quoted[8];
+    if (split_csv(line, fields, quoted, 8) != 8)
+        return false;
+
+    entry.m_placeName.assign(fields[3]);
+    if (quoted[3]) {
+        for (auto at = entry.m_placeName.find("\"\""); at != std::string::npos; at = entry.m_placeName.find("\"\"", at + 1))
+            entry.m_placeName.erase(at, 1);
+    }
+    return parse_number(fields[0], entry.m_id) && parse_number(fields[1], entry.m_date) &&
+           parse_number(fields[2], entry.m_time) && parse_number(fields[4], entry.m_lat) &&
+           parse_number(fields[5], entry.m_lon) && parse_number(fields[6], entry.m_temperature) &&
+           parse_number(fields[7], entry.m_humidity);
+}
+
+inline bool parse_json_line(std::string_view line, weatherRegistration &entry) {
+    try {
+        entry = json_dto::from_json<weatherRegistration>(std::string(line));
+        return true;
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
+// Parses every line of text into out; a CSV header line is skipped silently
+inline void parse_chunk(std::string_view text, bool csv, bool first_chunk, load_result_t &out) {
+    out.records.reserve(text.size() / 80);
+    bool first_line = first_chunk;
+    while (!text.empty()) {
+        auto eol = text.find('\n');
+        auto line = text.substr(0, eol);
+        text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (line.find_first_not_of(" \t") == std::string_view::npos)
+            continue;
+
+        weatherRegistration entry;
+        if (csv ? parse_csv_line(line, entry) : parse_json_line(line, entry))
+            out.records.push_back(std::move(entry));
+        else if (!(csv && first_line))
+            ++out.skipped;
+        first_line = false;
+    }
+}
+
+// Loads one file on up to threads threads
+inline load_result_t load_file(const std::string &path, unsigned threads) {
+    mapped_file_t file{ path };
+    auto text = file.view();
+    bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+
+    // Chunk boundaries, each moved forward to the start of a line
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(text.size() / (1 << 20) + 1)));
+    std::vector<std::size_t> bounds{ 0 };
+    for (unsigned i = 1; i < threads; ++i) {
+        auto pos = std::max(bounds.back(), text.size() * i / threads);
+        auto eol = text.find('\n', pos);
+        bounds.push_back(eol == std::string_view::npos ? text.size() : eol + 1);
+    }
+    bounds.push_back(text.size());
+
+    std::vector<load_result_t> parts(threads);
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            parse_chunk(text.substr(bounds[i], bounds[i + 1] - bounds[i]), csv, i == 0, parts[i]);
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    load_result_t result;
+    std::size_t total = 0;
+    for (const auto &part : parts)
+        total += part.records.size();
+    result.records.reserve(total);
+    for (auto &part : parts) {
+        std::move(part.records.begin(), part.records.end(), std::back_inserter(result.records));
+        result.skipped += part.skipped;
+    }
+    return result;
+}
+
+} // namespace weather_seed
@@ -0,0 +1,93 @@
+#pragma once
+
+// Shared-nothing sharding for the weather server.
+//
+// Each shard is one event loop (an io_context run by one thread) together with the state it
+// owns. Only that thread touches the state; other loops reach it by posting work to the
+// shard's io_context, and reads that span every shard scatter to all of them and gather the
+// partial results.
+
+#include <restinio/all.hpp>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace weather_shards {
+
+// SO_REUSEPORT lets every loop bind its own listener to the same port; the kernel spreads
+// incoming connections over them.
+using reuse_port_t = restinio::asio_ns::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+// Spreads sequential IDs evenly over the shards (murmur3 finalizer)
+inline std::uint64_t mix(std::uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+template <typename STATE>
+class shard_set_t {
+public:
+    struct shard_t {
+        restinio::asio_ns::io_context ioctx{1};
+        STATE state;
+    };
+
+    explicit shard_set_t(std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i)
+            m_shards.push_back(std::make_unique<shard_t>());
+    }
+
+    std::size_t size() const { return m_shards.size(); }
+    shard_t &operator[](std::size_t index) { return *m_shards[index]; }
+
+    std::size_t owner_of(std::int64_t key) const {
+        return static_cast<std::size_t>(mix(static_cast<std::uint64_t>(key)) % m_shards.size());
+    }
+
+    // Runs fn(state) on the thread of the given shard. Runs inline when the caller is already
+    // on that shard.
+    template <typename FN>
+    void run_on(std::size_t index, std::size_t caller, FN &&fn) {
+        auto &shard = *m_shards[index];
+        if (index == caller)
+            fn(shard.state);
+        else
+            restinio::asio_ns::post(shard.ioctx, [&shard, fn = std::forward<FN>(fn)]() mutable { fn(shard.state); });
+    }
+
+    // Runs map(state) on every shard and hands all partial results, in shard order, to
+    // gather() on the thread of the shard that finishes last
+    template <typename MAP, typename GATHER>
+    void scatter_gather(MAP map, GATHER gather) {
+        using part_t = decltype(map(std::declval<STATE &>()));
+
+        struct pending_t {
+            explicit pending_t(std::size_t n, GATHER g) : parts(n), remaining{ n }, gather{ std::move(g) } {}
+            std::vector<part_t> parts;
+            std::atomic<std::size_t> remaining;
+            GATHER gather;
+        };
+
+        auto pending = std::make_shared<pending_t>(m_shards.size(), std::move(gather));
+        for (std::size_t i = 0; i < m_shards.size(); ++i) {
+            auto &shard = *m_shards[i];
+            restinio::asio_ns::post(shard.ioctx, [&shard, i, map, pending] {
+                pending->parts[i] = map(shard.state);
+                if (pending->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    pending->gather(std::move(pending->parts));
+            });
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<shard_t>> m_shards;
+};
+
+} // namespace weather_shards
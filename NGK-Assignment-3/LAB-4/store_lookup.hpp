@@ -0,0 +1,37 @@
+#pragma once
+
+// Lookups on the in-memory records of the weather store.
+//
+// The single event loop's hot store and each --shards shard are plain vectors in insertion
+// order; these are the scans both kinds of handler run on them, kept here so
+// bench/micro_bench.cpp measures the same code the server runs.
+
+#include "weather_registration.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace weather_lookup {
+
+// The record with this ID, or records.end()
+template <typename RECORDS>
+auto find_id(RECORDS &records, int id) {
+    return std::find_if(records.begin(), records.end(), [id](const auto &entry) { return entry.m_id == id; });
+}
+
+// Appends the records in [pos, end) that match pred to out, in insertion order
+template <typename PRED>
+void copy_matching(const weatherStation_t &records, std::size_t pos, std::size_t end, PRED pred, weatherStation_t &out) {
+    for (; pos < end; ++pos) {
+        if (pred(records[pos]))
+            out.push_back(records[pos]);
+    }
+}
+
+// The newest count records, newest first
+inline weatherStation_t latest(const weatherStation_t &records, std::size_t count) {
+    auto n = static_cast<std::ptrdiff_t>(std::min(count, records.size()));
+    return weatherStation_t(records.rbegin(), records.rbegin() + n);
+}
+
+} // namespace weather_lookup
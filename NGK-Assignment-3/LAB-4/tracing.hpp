@@ -0,0 +1,305 @@
+#pragma once
+
+// Opt-in request-phase tracing for the weather server.
+//
+// Sampled requests record one span per phase (routing, parsing, store access, serialization,
+// socket write) into a fixed-size ring buffer owned by the recording thread. Unsampled
+// requests cost one thread-local branch per phase. The rings can be dumped at any time in
+// the Chrome trace-event JSON format (chrome://tracing, Perfetto).
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace weather_trace {
+
+enum class phase_t : std::uint32_t {
+    request, routing, parse, store, serialize, write,
+    count
+};
+
+constexpr std::array<const char *, static_cast<std::size_t>(phase_t::count)> phase_names{
+    "request", "routing", "parse", "store", "serialize", "write"
+};
+
+using trace_clock_t = std::chrono::steady_clock;
+
+// Span storage for one thread. Only the owning thread writes; each slot carries a sequence
+// number (odd while being written) so a concurrent dump can skip torn entries.
+class ring_t {
+public:
+    static constexpr std::size_t capacity = 16384;
+
+    struct record_t {
+        phase_t phase;
+        std::uint32_t detail; // route for request spans
+        std::uint64_t request_id;
+        std::int64_t start_ns;
+        std::int64_t duration_ns;
+    };
+
+    explicit ring_t(std::uint32_t tid) : m_tid{ tid } {}
+
+    void push(const record_t &span) {
+        auto pos = m_head.load(std::memory_order_relaxed);
+        auto &slot = m_slots[pos % capacity];
+        auto seq = slot.seq.load(std::memory_order_relaxed);
+
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.phase.store(static_cast<std::uint32_t>(span.phase), std::memory_order_relaxed);
+        slot.detail.store(span.detail, std::memory_order_relaxed);
+        slot.request_id.store(span.request_id, std::memory_order_relaxed);
+        slot.start_ns.store(span.start_ns, std::memory_order_relaxed);
+        slot.duration_ns.store(span.duration_ns, std::memory_order_relaxed);
+        slot.seq.store(seq + 2, std::memory_order_release);
+
+        m_head.store(pos + 1, std::memory_order_release);
+    }
+
+    // Copies out every complete span that started at or after since_ns
+    template <typename FN>
+    void for_each_since(std::int64_t since_ns, FN &&fn) const {
+        auto head = m_head.load(std::memory_order_acquire);
+        auto first = head > capacity ? head - capacity : 0;
+        for (auto pos = first; pos < head; ++pos) {
+            const auto &slot = m_slots[pos % capacity];
+            auto before = slot.seq.load(std::memory_order_acquire);
+            record_t span{
+                static_cast<phase_t>(slot.phase.load(std::memory_order_relaxed)),
+                slot.detail.load(std::memory_order_relaxed),
+                slot.request_id.load(std::memory_order_relaxed),
+                slot.start_ns.load(std::memory_order_relaxed),
+                slot.duration_ns.load(std::memory_order_relaxed)
+            };
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((before & 1) || before != slot.seq.load(std::memory_order_relaxed))
+                continue;
+            if (span.start_ns >= since_ns)
+                fn(span);
+        }
+    }
+
+    std::uint32_t tid() const { return m_tid; }
+
+private:
+    struct slot_t {
+        std::atomic<std::uint64_t> seq{0};
+        std::atomic<std::uint32_t> phase{0};
+        std::atomic<std::uint32_t> detail{0};
+        std::atomic<std::uint64_t> request_id{0};
+        std::atomic<std::int64_t> start_ns{0};
+        std::atomic<std::int64_t> duration_ns{0};
+    };
+
+    std::uint32_t m_tid;
+    std::atomic<std::uint64_t> m_head{0};
+    std::array<slot_t, capacity> m_slots;
+};
+
+class tracer_t {
+public:
+    static tracer_t &instance() {
+        static tracer_t tracer;
+        return tracer;
+    }
+
+    // Trace one request in every `every` (0 turns sampling off)
+    void set_sample_every(std::uint32_t every) { m_sample_every.store(every, std::memory_order_relaxed); }
+    std::uint32_t sample_every() const { return m_sample_every.load(std::memory_order_relaxed); }
+
+    // Traces every request until the given point in time, regardless of the sampling rate
+    void capture_until(trace_clock_t::time_point until) {
+        m_capture_until_ns.store(to_ns(until), std::memory_order_relaxed);
+    }
+
+    bool should_sample() {
+        thread_local std::uint32_t counter = 0;
+        auto capture_until = m_capture_until_ns.load(std::memory_order_relaxed);
+        if (capture_until != 0 && to_ns(trace_clock_t::now()) < capture_until)
+            return true;
+        auto every = sample_every();
+        return every != 0 && ++counter % every == 0;
+    }
+
+    std::uint64_t next_request_id() { return m_next_request_id.fetch_add(1, std::memory_order_relaxed); }
+
+    void record(phase_t phase, std::uint32_t detail, std::uint64_t request_id,
+                trace_clock_t::time_point start, trace_clock_t::time_point end) {
+        local_ring().push({ phase, detail, request_id, to_ns(start), (end - start).count() });
+    }
+
+    // Renders the spans of the last `window` in the Chrome trace-event JSON format.
+    // route_names maps the detail of request spans to a display name.
+    std::string dump_chrome_json(std::chrono::nanoseconds window, const std::vector<std::string> &route_names) const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto since = to_ns(trace_clock_t::now()) - window.count();
+        std::string out = R"({"displayTimeUnit":"ms","traceEvents":[)";
+        bool first = true;
+        char buf[256];
+
+        for (const auto &ring : m_rings) {
+            ring->for_each_since(since, [&](const ring_t::record_t &span) {
+                const char *name = span.phase == phase_t::request && span.detail < route_names.size()
+                                       ? route_names[span.detail].c_str()
+                                       : phase_names[static_cast<std::size_t>(span.phase)];
+                std::snprintf(buf, sizeof(buf),
+                              R"(%s{"name":"%s","cat":"%s","ph":"X","pid":1,"tid":%u,"ts":%.3f,"dur":%.3f,"args":{"request":%llu}})",
+                              first ? "" : ",", name, phase_names[static_cast<std::size_t>(span.phase)], ring->tid(),
+                              span.start_ns / 1e3, span.duration_ns / 1e3,
+                              static_cast<unsigned long long>(span.request_id));
+                out += buf;
+                first = false;
+            });
+        }
+        out += "]}";
+        return out;
+    }
+
+private:
+    tracer_t() = default;
+
+    std::int64_t to_ns(trace_clock_t::time_point tp) const { return (tp - m_epoch).count(); }
+
+    ring_t &local_ring() {
+        thread_local ring_t *ring = nullptr;
+        if (!ring) {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_rings.push_back(std::make_unique<ring_t>(static_cast<std::uint32_t>(m_rings.size() + 1)));
+            ring = m_rings.back().get();
+        }
+        return *ring;
+    }
+
+    trace_clock_t::time_point m_epoch = trace_clock_t::now();
+    std::atomic<std::uint32_t> m_sample_every{0};
+    std::atomic<std::int64_t> m_capture_until_ns{0};
+    std::atomic<std::uint64_t> m_next_request_id{1};
+    mutable std::mutex m_lock;
+    std::vector<std::unique_ptr<ring_t>> m_rings;
+};
+
+// Trace context of the request being handled on this thread
+struct context_t {
+    bool sampled = false;
+    std::uint64_t request_id = 0;
+    trace_clock_t::time_point received;
+};
+
+inline context_t &current() {
+    thread_local context_t context;
+    return context;
+}
+
+// Carries a request's trace context to another thread, such as a worker running part of
+// the request, and puts back that thread's own context when it goes out of scope
+class context_scope_t {
+public:
+    explicit context_scope_t(const context_t &ctx) : m_saved{ current() } { current() = ctx; }
+    ~context_scope_t() { current() = m_saved; }
+
+    context_scope_t(const context_scope_t &) = delete;
+    context_scope_t &operator=(const context_scope_t &) = delete;
+
+private:
+    context_t m_saved;
+};
+
+// Marks the moment a request enters the router, deciding whether it is sampled
+inline void begin_request() {
+    auto &ctx = current();
+    auto &tracer = tracer_t::instance();
+    ctx.sampled = tracer.should_sample();
+    if (ctx.sampled) {
+        ctx.request_id = tracer.next_request_id();
+        ctx.received = trace_clock_t::now();
+    }
+}
+
+// Records one phase of the current request if it is sampled
+class span_t {
+public:
+    explicit span_t(phase_t phase, std::uint32_t detail = 0)
+        : m_phase{ phase }, m_detail{ detail }, m_sampled{ current().sampled } {
+        if (m_sampled)
+            m_start = trace_clock_t::now();
+    }
+
+    ~span_t() {
+        if (m_sampled)
+            tracer_t::instance().record(m_phase, m_detail, current().request_id, m_start, trace_clock_t::now());
+    }
+
+    span_t(const span_t &) = delete;
+    span_t &operator=(const span_t &) = delete;
+
+private:
+    phase_t m_phase;
+    std::uint32_t m_detail;
+    bool m_sampled;
+    trace_clock_t::time_point m_start;
+};
+
+// Spans the time from entering the router to reaching the route handler, then the handler
+// itself. Closes the trace context of the request when the handler returns.
+class request_span_t {
+public:
+    explicit request_span_t(std::uint32_t route) : m_route{ route } {
+        auto &ctx = current();
+        if (ctx.sampled) {
+            m_start = trace_clock_t::now();
+            tracer_t::instance().record(phase_t::routing, 0, ctx.request_id, ctx.received, m_start);
+        }
+    }
+
+    ~request_span_t() {
+        auto &ctx = current();
+        if (ctx.sampled) {
+            tracer_t::instance().record(phase_t::request, m_route, ctx.request_id, m_start, trace_clock_t::now());
+            ctx.sampled = false;
+        }
+    }
+
+    request_span_t(const request_span_t &) = delete;
+    request_span_t &operator=(const request_span_t &) = delete;
+
+private:
+    std::uint32_t m_route;
+    trace_clock_t::time_point m_start;
+};
+
+// Returns a callback that records the socket write of the current request when it completes,
+// or an empty callback if the request is not sampled
+template <typename CB>
+CB write_span() {
+    auto &ctx = current();
+    if (!ctx.sampled)
+        return CB{};
+    return [id = ctx.request_id, start = trace_clock_t::now()](const auto &) {
+        tracer_t::instance().record(phase_t::write, 0, id, start, trace_clock_t::now());
+    };
+}
+
+// Router wrapper that marks when each request arrives, so routing time can be traced
+template <typename ROUTER>
+class traced_router_t {
+public:
+    explicit traced_router_t(std::unique_ptr<ROUTER> router) : m_router{ std::move(router) } {}
+
+    template <typename REQ>
+    auto operator()(REQ req) const {
+        begin_request();
+        return (*m_router)(std::move(req));
+    }
+
+private:
+    std::unique_ptr<ROUTER> m_router;
+};
+
+} // namespace weather_trace
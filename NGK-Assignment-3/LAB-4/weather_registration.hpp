@@ -0,0 +1,38 @@
+#pragma once
+
+#include <json_dto/pub.hpp>
+#include <string>
+#include <vector>
+
+// Data structure representing a single weather data entry
+struct weatherRegistration {
+    weatherRegistration() = default;
+
+    weatherRegistration(int ID, int Date, int Time, std::string placeName,
+                        double Lat, double Lon, double Temperature, int Humidity)
+        : m_id{ ID }, m_date{ Date }, m_time{ Time }, m_placeName{ std::move(placeName) },
+          m_lat{ Lat }, m_lon{ Lon }, m_temperature{ Temperature }, m_humidity{ Humidity } {}
+
+    template <typename JSON_IO>
+    void json_io(JSON_IO &io) {
+        io & json_dto::mandatory("ID", m_id)
+           & json_dto::mandatory("Date", m_date)
+           & json_dto::mandatory("Time", m_time)
+           & json_dto::mandatory("PlaceName", m_placeName)
+           & json_dto::mandatory("Lat", m_lat)
+           & json_dto::mandatory("Lon", m_lon)
+           & json_dto::mandatory("Temperature", m_temperature)
+           & json_dto::mandatory("Humidity", m_humidity);
+    }
+
+    int m_id;
+    int m_date;
+    int m_time;
+    std::string m_placeName;
+    double m_lat;
+    double m_lon;
+    double m_temperature;
+    int m_humidity;
+};
+
+using weatherStation_t = std::vector<weatherRegistration>;
@@ -0,0 +1,136 @@
+#pragma once
+
+// Worker pool for request handlers that are too expensive to run on the I/O thread.
+//
+// Jobs are queued in two priority classes with a bounded depth each, so an overloaded server
+// rejects work up front instead of queueing it past the request timeout. High-priority jobs
+// are always taken first, and low-priority jobs may occupy at most all but one worker, so a
+// burst of big scans cannot starve the cheaper queries behind them.
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace weather_workers {
+
+enum class priority_t : std::size_t { high, low, count };
+
+class worker_pool_t {
+public:
+    worker_pool_t(std::size_t threads, std::size_t max_queued) : m_max_queued{ max_queued } {
+        threads = std::max<std::size_t>(threads, 1);
+        m_low_limit = threads > 1 ? threads - 1 : 1;
+        for (std::size_t i = 0; i < threads; ++i)
+            m_threads.emplace_back([this] { run(); });
+    }
+
+    ~worker_pool_t() {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+        for (auto &thread : m_threads)
+            thread.join();
+    }
+
+    worker_pool_t(const worker_pool_t &) = delete;
+    worker_pool_t &operator=(const worker_pool_t &) = delete;
+
+    // Queues a job; returns false without queueing if its class is already full
+    bool try_submit(priority_t priority, std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            auto &queue = m_queues[index(priority)];
+            if (queue.size() >= m_max_queued) {
+                ++m_rejected[index(priority)];
+                return false;
+            }
+            queue.push_back(std::move(job));
+        }
+        m_wakeup.notify_one();
+        return true;
+    }
+
+    std::size_t queued(priority_t priority) const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_queues[index(priority)].size();
+    }
+
+    std::uint64_t rejected(priority_t priority) const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_rejected[index(priority)];
+    }
+
+    std::size_t threads() const { return m_threads.size(); }
+
+private:
+    static constexpr std::size_t index(priority_t priority) { return static_cast<std::size_t>(priority); }
+
+    void run() {
+        for (;;) {
+            std::function<void()> job;
+            bool low = false;
+            {
+                std::unique_lock<std::mutex> lock(m_lock);
+                m_wakeup.wait(lock, [this] { return m_stopping || runnable(); });
+                if (m_stopping && !runnable())
+                    return;
+
+                auto &high_queue = m_queues[index(priority_t::high)];
+                auto &low_queue = m_queues[index(priority_t::low)];
+                if (!high_queue.empty()) {
+                    job = std::move(high_queue.front());
+                    high_queue.pop_front();
+                } else {
+                    job = std::move(low_queue.front());
+                    low_queue.pop_front();
+                    low = true;
+                    ++m_low_running;
+                }
+            }
+
+            // Jobs answer their own failures; one that still throws must not end the process
+            try {
+                job();
+            } catch (const std::exception &ex) {
+                std::cerr << "Worker job failed: " << ex.what() << std::endl;
+            } catch (...) {
+                std::cerr << "Worker job failed" << std::endl;
+            }
+
+            if (low) {
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                    --m_low_running;
+                }
+                m_wakeup.notify_one();
+            }
+        }
+    }
+
+    bool runnable() const {
+        return !m_queues[index(priority_t::high)].empty() ||
+               (!m_queues[index(priority_t::low)].empty() && m_low_running < m_low_limit);
+    }
+
+    const std::size_t m_max_queued;
+    std::size_t m_low_limit;
+    std::size_t m_low_running = 0;
+    bool m_stopping = false;
+    mutable std::mutex m_lock;
+    std::condition_variable m_wakeup;
+    std::array<std::deque<std::function<void()>>, static_cast<std::size_t>(priority_t::count)> m_queues;
+    std::array<std::uint64_t, static_cast<std::size_t>(priority_t::count)> m_rejected{};
+    std::vector<std::thread> m_threads;
+};
+
+} // namespace weather_workers
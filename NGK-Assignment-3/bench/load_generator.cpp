@@ -0,0 +1,514 @@
+/* Open-loop HTTP/WebSocket load generator for the LAB weather servers.
+
+Requests are scheduled at a fixed rate and their latency is measured from the moment they
+were scheduled, not from when a connection became free, so a slow server cannot hide its
+queueing delay (no coordinated omission). WebSocket subscribers measure how long a POSTed
+record takes to reach them.
+
+Usage:
+  weather_loadgen [--host 127.0.0.1] [--port 8080] [--rate 1000] [--duration 10]
+                  [--connections 64] [--ws 0] [--ids 1000] [--dates 30] [--preload 0]
+                  [--mix list=1,id=40,date=20,latest=30,post=9] [--out result.json]
+
+GET /id/:id asks for IDs 1..--ids, and --preload POSTs IDs 1..N before measuring. The POSTs
+of the run get fresh IDs above both, since the server answers a taken ID with 409.
+
+The result is written as JSON to stdout (or --out).
+*/
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count();
+}
+
+[[noreturn]] void error(const char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+struct options_t {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    double rate = 1000;
+    double duration = 10;
+    std::size_t connections = 64;
+    std::size_t ws = 0;
+    int ids = 1000;
+    int dates = 30;
+    int preload = 0;
+    std::string mix = "list=1,id=40,date=20,latest=30,post=9";
+    std::string out;
+};
+
+enum op_kind_t { op_list, op_id, op_date, op_latest, op_post, op_count };
+const char *op_names[op_count] = { "list", "id", "date", "latest", "post" };
+
+constexpr int base_date = 20240401;
+
+struct sample_set_t {
+    std::vector<std::int64_t> latency_ns;
+    std::uint64_t errors = 0;
+    std::map<int, std::uint64_t> status;
+};
+
+struct pending_t {
+    op_kind_t op;
+    std::int64_t intended_ns;
+};
+
+struct conn_t {
+    int fd = -1;
+    bool connected = false;
+    bool busy = false;
+    bool websocket = false;
+    bool upgraded = false;
+    std::string out;
+    std::size_t out_off = 0;
+    std::string in;
+    pending_t current{};
+};
+
+// A POST ID no earlier request used, above the IDs that are read and preloaded
+int next_post_id(const options_t &opt) {
+    static int posted = 0;
+    return std::max(opt.ids, opt.preload) + ++posted;
+}
+
+// Builds one request; a POST stores post_id, or a fresh ID if it is 0
+std::string build_request(op_kind_t op, std::mt19937_64 &rng, const options_t &opt, std::int64_t intended_ns, int post_id = 0) {
+    std::uniform_int_distribution<int> id_dist(1, std::max(1, opt.ids));
+    std::uniform_int_distribution<int> date_dist(0, std::max(0, opt.dates - 1));
+    std::string target = "/";
+    std::string body;
+
+    switch (op) {
+    case op_list: target = "/"; break;
+    case op_id: target = "/id/" + std::to_string(id_dist(rng)); break;
+    case op_date: target = "/date/" + std::to_string(base_date + date_dist(rng)); break;
+    case op_latest: target = "/latest"; break;
+    case op_post: {
+        char buf[256];
+        // PlaceName carries the schedule time so WebSocket subscribers can measure delivery latency
+        snprintf(buf, sizeof(buf),
+                 R"({"ID":%d,"Date":%d,"Time":1200,"PlaceName":"lg-%lld","Lat":56.16,"Lon":10.2,"Temperature":%.1f,"Humidity":%d})",
+                 post_id != 0 ? post_id : next_post_id(opt), base_date + date_dist(rng), static_cast<long long>(intended_ns),
+                 static_cast<double>(rng() % 400) / 10.0 - 10.0, static_cast<int>(rng() % 100));
+        body = buf;
+        break;
+    }
+    default: break;
+    }
+
+    std::string req = (op == op_post ? "POST " : "GET ") + target + " HTTP/1.1\r\nHost: localhost\r\n";
+    if (op == op_post)
+        req += "Content-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+    req += "\r\n" + body;
+    return req;
+}
+
+// Returns the length of a complete HTTP response at the start of `in`, or 0 if more data is needed.
+// Supports Content-Length and chunked bodies.
+std::size_t complete_response(const std::string &in, int &status, bool &close) {
+    auto hdr_end = in.find("\r\n\r\n");
+    if (hdr_end == std::string::npos)
+        return 0;
+    status = in.size() > 12 ? std::atoi(in.c_str() + 9) : 0;
+
+    std::string headers = in.substr(0, hdr_end);
+    std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+    close = headers.find("connection: close") != std::string::npos;
+
+    auto body_start = hdr_end + 4;
+    auto cl = headers.find("content-length:");
+    if (cl != std::string::npos) {
+        auto len = std::strtoull(headers.c_str() + cl + 15, nullptr, 10);
+        return in.size() >= body_start + len ? body_start + len : 0;
+    }
+    if (headers.find("transfer-encoding: chunked") != std::string::npos) {
+        auto pos = body_start;
+        for (;;) {
+            auto line_end = in.find("\r\n", pos);
+            if (line_end == std::string::npos)
+                return 0;
+            auto chunk = std::strtoull(in.c_str() + pos, nullptr, 16);
+            pos = line_end + 2 + chunk + 2;
+            if (pos > in.size())
+                return 0;
+            if (chunk == 0)
+                return pos;
+        }
+    }
+    return body_start;
+}
+
+int open_socket(const sockaddr_in &addr) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        error("ERROR opening socket");
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS)
+        error("ERROR connecting");
+    return fd;
+}
+
+sockaddr_in resolve(const options_t &opt) {
+    hostent *server = gethostbyname(opt.host.c_str());
+    if (!server)
+        error("ERROR no such host");
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    std::memcpy(&addr.sin_addr.s_addr, server->h_addr_list[0], server->h_length);
+    addr.sin_port = htons(opt.port);
+    return addr;
+}
+
+// Fills the server with records before measuring, one blocking request at a time
+void preload(const options_t &opt, const sockaddr_in &addr, std::mt19937_64 &rng) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0)
+        error("ERROR connecting for preload");
+
+    std::string in;
+    char buf[65536];
+    for (int i = 0; i < opt.preload; ++i) {
+        auto req = build_request(op_post, rng, opt, 0, i + 1);
+        if (write(fd, req.data(), req.size()) != static_cast<ssize_t>(req.size()))
+            error("ERROR preloading");
+        int status = 0;
+        bool close_conn = false;
+        std::size_t len;
+        while ((len = complete_response(in, status, close_conn)) == 0) {
+            auto n = read(fd, buf, sizeof(buf));
+            if (n <= 0)
+                error("ERROR preloading");
+            in.append(buf, n);
+        }
+        in.erase(0, len);
+    }
+    close(fd);
+}
+
+struct percentiles_t {
+    double p50, p99, p999, max;
+};
+
+percentiles_t percentiles(std::vector<std::int64_t> &v) {
+    if (v.empty())
+        return {0, 0, 0, 0};
+    std::sort(v.begin(), v.end());
+    auto at = [&v](double q) { return v[std::min(v.size() - 1, static_cast<std::size_t>(q * v.size()))] / 1e3; };
+    return {at(0.50), at(0.99), at(0.999), v.back() / 1e3};
+}
+
+std::string summary_json(std::vector<std::int64_t> &latency, std::uint64_t errors, double seconds,
+                         const std::map<int, std::uint64_t> *status) {
+    auto p = percentiles(latency);
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             R"({"count":%zu,"errors":%llu,"throughput_rps":%.1f,"latency_us":{"p50":%.1f,"p99":%.1f,"p99.9":%.1f,"max":%.1f})",
+             latency.size(), static_cast<unsigned long long>(errors), latency.size() / seconds,
+             p.p50, p.p99, p.p999, p.max);
+    std::string out = buf;
+    if (status) {
+        out += R"(,"status":{)";
+        bool first = true;
+        for (auto &[code, n] : *status) {
+            out += (first ? "\"" : ",\"") + std::to_string(code) + "\":" + std::to_string(n);
+            first = false;
+        }
+        out += "}";
+    }
+    return out + "}";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    options_t opt;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i], value = argv[i + 1];
+        if (key == "--host") opt.host = value;
+        else if (key == "--port") opt.port = std::atoi(value.c_str());
+        else if (key == "--rate") opt.rate = std::atof(value.c_str());
+        else if (key == "--duration") opt.duration = std::atof(value.c_str());
+        else if (key == "--connections") opt.connections = std::strtoul(value.c_str(), nullptr, 10);
+        else if (key == "--ws") opt.ws = std::strtoul(value.c_str(), nullptr, 10);
+        else if (key == "--ids") opt.ids = std::atoi(value.c_str());
+        else if (key == "--dates") opt.dates = std::atoi(value.c_str());
+        else if (key == "--preload") opt.preload = std::atoi(value.c_str());
+        else if (key == "--mix") opt.mix = value;
+        else if (key == "--out") opt.out = value;
+        else {
+            fprintf(stderr, "ERROR unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+
+    // Parse the workload mix into cumulative weights
+    std::vector<double> weights(op_count, 0.0);
+    {
+        std::string mix = opt.mix + ",";
+        std::size_t pos = 0, comma;
+        while ((comma = mix.find(',', pos)) != std::string::npos) {
+            auto item = mix.substr(pos, comma - pos);
+            auto eq = item.find('=');
+            for (int k = 0; eq != std::string::npos && k < op_count; ++k) {
+                if (item.compare(0, eq, op_names[k]) == 0)
+                    weights[k] = std::atof(item.c_str() + eq + 1);
+            }
+            pos = comma + 1;
+        }
+    }
+    std::discrete_distribution<int> pick(weights.begin(), weights.end());
+
+    std::mt19937_64 rng(42);
+    auto addr = resolve(opt);
+    {
+        // Fail fast instead of reconnecting forever when nothing is listening
+        int probe = socket(AF_INET, SOCK_STREAM, 0);
+        if (probe < 0 || connect(probe, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0)
+            error("ERROR connecting");
+        close(probe);
+    }
+    if (opt.preload > 0)
+        preload(opt, addr, rng);
+
+    int ep = epoll_create1(0);
+    if (ep < 0)
+        error("ERROR creating epoll");
+
+    std::vector<conn_t> conns(opt.connections + opt.ws);
+    auto arm = [ep](conn_t &c, std::size_t index, bool add) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | (c.out_off < c.out.size() || !c.connected ? static_cast<std::uint32_t>(EPOLLOUT) : 0u);
+        ev.data.u64 = index;
+        epoll_ctl(ep, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c.fd, &ev);
+    };
+    auto reopen = [&](std::size_t index) {
+        auto &c = conns[index];
+        if (c.fd >= 0)
+            close(c.fd);
+        c = conn_t{};
+        c.websocket = index >= opt.connections;
+        c.fd = open_socket(addr);
+        if (c.websocket) {
+            c.out = "GET /chat HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+        }
+        arm(c, index, true);
+    };
+    for (std::size_t i = 0; i < conns.size(); ++i)
+        reopen(i);
+
+    std::vector<sample_set_t> samples(op_count);
+    std::vector<std::int64_t> ws_latency;
+    std::uint64_t ws_messages = 0;
+    std::vector<pending_t> backlog;
+    std::size_t backlog_head = 0;
+    std::size_t inflight = 0;
+
+    const auto interval_ns = static_cast<std::int64_t>(1e9 / opt.rate);
+    const auto start_ns = now_ns();
+    const auto end_ns = start_ns + static_cast<std::int64_t>(opt.duration * 1e9);
+    const auto drain_deadline_ns = end_ns + 5'000'000'000LL;
+    auto next_ns = start_ns;
+
+    std::vector<epoll_event> events(256);
+    char buf[65536];
+
+    for (;;) {
+        auto now = now_ns();
+        if (now >= drain_deadline_ns || (now >= end_ns && inflight == 0 && backlog_head == backlog.size()))
+            break;
+
+        // Schedule every request whose time has come, whether or not a connection is free
+        while (next_ns <= now && next_ns < end_ns) {
+            backlog.push_back({static_cast<op_kind_t>(pick(rng)), next_ns});
+            next_ns += interval_ns;
+        }
+
+        // Hand queued requests to idle connections
+        for (std::size_t i = 0; i < opt.connections && backlog_head < backlog.size(); ++i) {
+            auto &c = conns[i];
+            if (!c.connected || c.busy)
+                continue;
+            c.current = backlog[backlog_head++];
+            c.out = build_request(c.current.op, rng, opt, c.current.intended_ns);
+            c.out_off = 0;
+            c.busy = true;
+            ++inflight;
+            arm(c, i, false);
+        }
+        if (backlog_head == backlog.size()) {
+            backlog.clear();
+            backlog_head = 0;
+        }
+
+        int timeout_ms = next_ns < end_ns ? static_cast<int>(std::max<std::int64_t>(0, (next_ns - now) / 1'000'000)) : 10;
+        int n = epoll_wait(ep, events.data(), static_cast<int>(events.size()), timeout_ms);
+
+        for (int e = 0; e < n; ++e) {
+            auto index = static_cast<std::size_t>(events[e].data.u64);
+            auto &c = conns[index];
+
+            if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+                if (c.busy) {
+                    ++samples[c.current.op].errors;
+                    --inflight;
+                }
+                reopen(index);
+                continue;
+            }
+
+            if (events[e].events & EPOLLOUT) {
+                c.connected = true;
+                while (c.out_off < c.out.size()) {
+                    auto w = write(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off);
+                    if (w <= 0)
+                        break;
+                    c.out_off += static_cast<std::size_t>(w);
+                }
+                arm(c, index, false);
+            }
+
+            if (!(events[e].events & EPOLLIN))
+                continue;
+
+            ssize_t r;
+            bool peer_closed = false;
+            while ((r = read(c.fd, buf, sizeof(buf))) > 0)
+                c.in.append(buf, static_cast<std::size_t>(r));
+            if (r == 0)
+                peer_closed = true;
+
+            if (c.websocket) {
+                if (!c.upgraded) {
+                    auto hdr_end = c.in.find("\r\n\r\n");
+                    if (hdr_end == std::string::npos)
+                        continue;
+                    c.upgraded = true;
+                    c.in.erase(0, hdr_end + 4);
+                }
+                // Server frames are unmasked: opcode, 7/16/64-bit length, payload
+                while (c.in.size() >= 2) {
+                    std::size_t len = static_cast<unsigned char>(c.in[1]) & 0x7f, hdr = 2;
+                    if (len == 126 && c.in.size() >= 4) {
+                        len = (static_cast<unsigned char>(c.in[2]) << 8) | static_cast<unsigned char>(c.in[3]);
+                        hdr = 4;
+                    } else if (len == 127 && c.in.size() >= 10) {
+                        len = 0;
+                        for (int b = 2; b < 10; ++b)
+                            len = (len << 8) | static_cast<unsigned char>(c.in[b]);
+                        hdr = 10;
+                    } else if (len >= 126) {
+                        break;
+                    }
+                    if (c.in.size() < hdr + len)
+                        break;
+                    auto payload = c.in.substr(hdr, len);
+                    auto tag = payload.find("\"lg-");
+                    if (tag != std::string::npos) {
+                        auto sent = std::strtoll(payload.c_str() + tag + 4, nullptr, 10);
+                        if (sent > 0)
+                            ws_latency.push_back(now_ns() - sent);
+                    }
+                    ++ws_messages;
+                    c.in.erase(0, hdr + len);
+                }
+                if (peer_closed)
+                    reopen(index);
+                continue;
+            }
+
+            int status = 0;
+            bool close_conn = false;
+            if (c.busy) {
+                auto len = complete_response(c.in, status, close_conn);
+                if (len > 0) {
+                    auto &set = samples[c.current.op];
+                    set.latency_ns.push_back(now_ns() - c.current.intended_ns);
+                    ++set.status[status];
+                    if (status >= 400)
+                        ++set.errors;
+                    c.in.erase(0, len);
+                    c.busy = false;
+                    --inflight;
+                }
+            }
+            if (peer_closed || close_conn) {
+                if (c.busy) {
+                    ++samples[c.current.op].errors;
+                    --inflight;
+                }
+                reopen(index);
+            }
+        }
+    }
+
+    auto seconds = (std::min(now_ns(), end_ns) - start_ns) / 1e9;
+    std::vector<std::int64_t> all;
+    std::uint64_t all_errors = 0;
+    std::string ops;
+    for (int k = 0; k < op_count; ++k) {
+        all.insert(all.end(), samples[k].latency_ns.begin(), samples[k].latency_ns.end());
+        all_errors += samples[k].errors;
+        if (weights[k] > 0)
+            ops += (ops.empty() ? "\"" : ",\"") + std::string(op_names[k]) + "\":" +
+                   summary_json(samples[k].latency_ns, samples[k].errors, seconds, &samples[k].status);
+    }
+
+    char head[256];
+    snprintf(head, sizeof(head), R"({"target":"%s:%d","rate_rps":%.1f,"duration_s":%.2f,"connections":%zu,)",
+             opt.host.c_str(), opt.port, opt.rate, seconds, opt.connections);
+    std::string result = head;
+    result += R"("overall":)" + summary_json(all, all_errors, seconds, nullptr);
+    result += R"(,"ops":{)" + ops + "}";
+    if (opt.ws > 0) {
+        auto p = percentiles(ws_latency);
+        char wsbuf[256];
+        snprintf(wsbuf, sizeof(wsbuf),
+                 R"(,"websocket":{"subscribers":%zu,"messages":%llu,"delivery_latency_us":{"p50":%.1f,"p99":%.1f,"p99.9":%.1f,"max":%.1f}})",
+                 opt.ws, static_cast<unsigned long long>(ws_messages), p.p50, p.p99, p.p999, p.max);
+        result += wsbuf;
+    }
+    result += "}\n";
+
+    if (opt.out.empty()) {
+        fputs(result.c_str(), stdout);
+    } else {
+        FILE *f = fopen(opt.out.c_str(), "w");
+        if (!f)
+            error("ERROR writing result");
+        fputs(result.c_str(), f);
+        fclose(f);
+    }
+
+    for (auto &c : conns)
+        close(c.fd);
+    close(ep);
+    return 0;
+}
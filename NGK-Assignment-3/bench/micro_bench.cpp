@@ -0,0 +1,201 @@
+/* Microbenchmarks for the hot paths of the LAB-4 weather server: json_io (de)serialization,
+store lookups, the ID filter, place index and query cache, WebSocket broadcast fan-out and
+alert evaluation. Each one calls the server's own code from the LAB-4 headers.
+
+Usage:
+  weather_microbench [--min-time 0.2] [--filter substring]
+
+Each benchmark prints one JSON object per line with the mean time per operation.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../LAB-4/weather_registration.hpp"
+#include "../LAB-4/alert_rules.hpp"
+#include "../LAB-4/bloom_filter.hpp"
+#include "../LAB-4/broadcast.hpp"
+#include "../LAB-4/place_index.hpp"
+#include "../LAB-4/query_cache.hpp"
+#include "../LAB-4/store_lookup.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+double min_time = 0.2;
+std::string filter;
+
+// Keeps the optimizer from discarding a benchmark result
+template <typename T>
+void keep(const T &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Runs fn in growing batches until min_time has passed and reports the mean time per call
+void bench(const std::string &name, const std::function<void()> &fn) {
+    if (!filter.empty() && name.find(filter) == std::string::npos)
+        return;
+
+    fn(); // warm-up
+    std::size_t iterations = 1;
+    for (;;) {
+        auto start = clock_type::now();
+        for (std::size_t i = 0; i < iterations; ++i)
+            fn();
+        double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+        if (elapsed >= min_time) {
+            printf("{\"benchmark\":\"%s\",\"iterations\":%zu,\"ns_per_op\":%.1f}\n",
+                   name.c_str(), iterations, elapsed * 1e9 / iterations);
+            fflush(stdout);
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+weatherStation_t make_store(std::size_t records, int dates) {
+    std::mt19937 rng(7);
+    weatherStation_t store;
+    store.reserve(records);
+    for (std::size_t i = 0; i < records; ++i) {
+        store.emplace_back(static_cast<int>(i + 1), 20240401 + static_cast<int>(rng() % dates), 1200,
+                           "Station " + std::to_string(rng() % 500), 56.16, 10.2,
+                           static_cast<double>(rng() % 400) / 10.0 - 10.0, static_cast<int>(rng() % 100));
+    }
+    return store;
+}
+
+void bench_json_io() {
+    weatherRegistration entry{1, 20240415, 1015, "Aarhus N", 13.692, 19.438, 13.1, 70};
+    auto json = json_dto::to_json(entry);
+
+    bench("json_io/to_json/single", [&] { keep(json_dto::to_json(entry)); });
+    bench("json_io/from_json/single", [&] { keep(json_dto::from_json<weatherRegistration>(json)); });
+
+    for (std::size_t n : {100, 10000}) {
+        auto store = make_store(n, 30);
+        auto list_json = json_dto::to_json(store);
+        bench("json_io/to_json/list_" + std::to_string(n), [&] { keep(json_dto::to_json(store)); });
+        bench("json_io/from_json/list_" + std::to_string(n),
+              [&] { keep(json_dto::from_json<weatherStation_t>(list_json)); });
+    }
+}
+
+// The server's lookups: the store scans of GET /id/:id, /date/:date and /latest, the ID filter
+// in front of the duplicate check on POST, the place index and the query cache
+void bench_lookups() {
+    for (std::size_t n : {1000, 100000}) {
+        auto store = make_store(n, 30);
+        std::mt19937 rng(3);
+        auto suffix = "/" + std::to_string(n);
+
+        bench("lookup/by_id" + suffix, [&] {
+            keep(weather_lookup::find_id(store, static_cast<int>(rng() % n) + 1));
+        });
+        bench("lookup/by_date" + suffix, [&] {
+            int date = 20240401 + static_cast<int>(rng() % 30);
+            weatherStation_t results;
+            weather_lookup::copy_matching(store, 0, store.size(), [date](const auto &e) { return e.m_date == date; }, results);
+            keep(results);
+        });
+        bench("lookup/latest" + suffix, [&] { keep(weather_lookup::latest(store, 3)); });
+
+        weather_bloom::bloom_filter_t ids;
+        for (const auto &entry : store)
+            ids.add(entry.m_id);
+        bench("lookup/id_filter_new" + suffix, [&] { keep(ids.may_contain(static_cast<int>(n + 1 + rng() % n))); });
+
+        weather_places::place_index_t places;
+        for (std::size_t i = 0; i < store.size(); ++i)
+            places.add(store[i].m_placeName, i);
+        bench("lookup/places_complete" + suffix, [&] { keep(places.complete("station 1", 10)); });
+        bench("lookup/place_postings" + suffix, [&] { keep(places.postings("Station " + std::to_string(rng() % 500))); });
+    }
+
+    weather_cache::query_cache_t cache(64 << 20);
+    for (int date = 20240401; date < 20240431; ++date)
+        cache.put("date:" + std::to_string(date), cache.tag_for_date(date), std::string(4096, 'x'));
+    std::mt19937 rng(5);
+    bench("lookup/cache_hit", [&] { keep(cache.get("date:" + std::to_string(20240401 + rng() % 30))); });
+}
+
+// A WebSocket subscriber that keeps the message, as RESTinio's message_t copies it before
+// framing; the framing and the socket write are RESTinio's and are not measured here
+struct fake_subscriber_t {
+    std::string message;
+    std::size_t bytes = 0;
+};
+
+// A stored record's broadcast: serialize, queue and fan out to every subscriber, as the
+// single event loop does
+void bench_broadcast() {
+    weatherRegistration entry{1, 20240415, 1015, "Aarhus N", 13.692, 19.438, 13.1, 70};
+    auto send = [](const std::shared_ptr<fake_subscriber_t> &subscriber, const std::string &msg) {
+        subscriber->message = msg;
+        subscriber->bytes += msg.size();
+    };
+
+    for (std::size_t subscribers : {1, 100, 1000}) {
+        std::map<std::uint64_t, std::shared_ptr<fake_subscriber_t>> registry;
+        for (std::uint64_t id = 0; id < subscribers; ++id)
+            registry.emplace(id, std::make_shared<fake_subscriber_t>());
+        weather_broadcast::queue_t queue;
+        bench("broadcast/fanout_" + std::to_string(subscribers), [&] {
+            queue.push(json_dto::to_json(entry));
+            keep(queue.drain(registry, send));
+        });
+    }
+}
+
+// What each stored record costs before its alerts are broadcast: the rule engine's evaluate,
+// with level rules and change rules on the record's place and on every place. The WebSocket
+// framing of the broadcast itself is RESTinio's and is not measured here.
+void bench_alerts() {
+    using weather_alerts::alert_rule_t;
+
+    for (std::size_t rules : {10, 1000}) {
+        weather_alerts::rule_engine_t engine;
+        std::mt19937 rng(11);
+        for (std::size_t i = 0; i < rules; ++i) {
+            static const char *ops[] = {">", "<", "rise", "drop"};
+            std::string place = i % 2 ? "" : "Station " + std::to_string(rng() % 500);
+            engine.add(alert_rule_t{0, place, i % 3 ? "Temperature" : "Humidity", ops[i % 4],
+                                    static_cast<double>(rng() % 40), 30 + static_cast<int>(rng() % 90)});
+        }
+
+        auto store = make_store(4096, 1);
+        std::size_t next = 0;
+        bench("alerts/evaluate_" + std::to_string(rules), [&] {
+            auto entry = store[next++ % store.size()];
+            entry.m_time = static_cast<int>(next / 60 % 24 * 100 + next % 60);
+            keep(engine.evaluate(entry));
+        });
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        if (key == "--min-time")
+            min_time = std::atof(argv[i + 1]);
+        else if (key == "--filter")
+            filter = argv[i + 1];
+    }
+
+    bench_json_io();
+    bench_lookups();
+    bench_broadcast();
+    bench_alerts();
+    return 0;
+}
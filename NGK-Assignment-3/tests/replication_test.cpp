@@ -0,0 +1,121 @@
+// Primary and follower of LAB-4/replication.hpp on one io_context, over loopback TCP.
+//
+// The follower's store starts with records the primary never had; a snapshot must replace
+// them, not merge into them. The test then streams an insert and an update from the log, and
+// finally publishes past the end of a short log so the primary drops the follower, which must
+// come back with a second snapshot that again matches the primary exactly.
+//
+// Exits 0 when every check passes; prints the failed checks and exits 1 otherwise.
+
+#include "../LAB-4/replication.hpp"
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace {
+
+namespace asio = weather_replication::asio;
+using store_t = std::map<int, weatherRegistration>;
+
+int failures = 0;
+
+void check(bool ok, const std::string &what) {
+    std::cout << (ok ? "ok   " : "FAIL ") << what << std::endl;
+    if (!ok)
+        ++failures;
+}
+
+weatherRegistration record(int id, double temperature) {
+    return { id, 20240101, 1200, "Aarhus", 56.15, 10.21, temperature, 80 };
+}
+
+bool same(const store_t &a, const store_t &b) {
+    if (a.size() != b.size())
+        return false;
+    for (auto ia = a.begin(), ib = b.begin(); ia != a.end(); ++ia, ++ib) {
+        if (ia->first != ib->first || ia->second.m_temperature != ib->second.m_temperature)
+            return false;
+    }
+    return true;
+}
+
+// Runs the loop until done() holds or the deadline passes
+bool run_until(asio::io_context &ioctx, const std::function<bool()> &done, std::chrono::seconds deadline) {
+    auto until = std::chrono::steady_clock::now() + deadline;
+    while (!done() && std::chrono::steady_clock::now() < until)
+        ioctx.run_for(std::chrono::milliseconds(10));
+    return done();
+}
+
+} // namespace
+
+int main() {
+    asio::io_context ioctx;
+
+    // Bind an ephemeral port and hand the socket over, as a replaced server would
+    weather_replication::tcp::acceptor listener{ ioctx, { asio::ip::make_address("127.0.0.1"), 0 } };
+    auto port = std::to_string(listener.local_endpoint().port());
+
+    store_t primary_store;
+    for (int id = 1; id <= 3; ++id)
+        primary_store[id] = record(id, id);
+
+    weather_replication::primary_t primary{
+        ioctx, 0, 4,
+        [&](auto done) {
+            auto copy = std::make_shared<weatherStation_t>();
+            for (const auto &[id, entry] : primary_store)
+                copy->push_back(entry);
+            done(copy);
+        },
+        listener.release() };
+
+    store_t follower_store{ { 900, record(900, -1) }, { 901, record(901, -1) } };
+    int replaced = 0;
+    weather_replication::follower_t follower{
+        ioctx, "127.0.0.1", port,
+        weather_replication::follower_t::apply_t{
+            [&](const auto &entry) { follower_store[entry.m_id] = entry; },
+            [&](int id, const auto &entry) {
+                follower_store.erase(id);
+                follower_store[entry.m_id] = entry;
+            },
+            [&](weatherStation_t records) {
+                ++replaced;
+                follower_store.clear();
+                for (auto &entry : records)
+                    follower_store[entry.m_id] = std::move(entry);
+            } } };
+
+    auto in_step = [&] { return same(primary_store, follower_store); };
+
+    run_until(ioctx, [&] { return replaced == 1; }, std::chrono::seconds(5));
+    check(replaced == 1, "first connection takes a snapshot");
+    check(in_step(), "snapshot replaces the follower's store");
+    check(follower_store.count(900) == 0 && follower_store.count(901) == 0, "records the primary never had are gone");
+
+    primary_store[4] = record(4, 4);
+    primary.publish_insert(primary_store[4]);
+    primary_store.erase(2);
+    primary_store[5] = record(5, 25);
+    primary.publish_update(2, primary_store[5]);
+    check(run_until(ioctx, in_step, std::chrono::seconds(5)), "insert and update stream from the log");
+    check(replaced == 1, "no snapshot while the follower keeps up");
+
+    // More changes than the log holds, published while the first is still being written: the
+    // primary drops the follower. A record also goes without a change in the log, so only a
+    // replacing snapshot can bring the follower back in step.
+    for (int id = 10; id < 30; ++id) {
+        primary_store[id] = record(id, id);
+        primary.publish_insert(primary_store[id]);
+    }
+    primary_store.erase(1);
+    check(run_until(ioctx, [&] { return replaced == 2 && in_step(); }, std::chrono::seconds(10)),
+          "a follower behind the log takes a second snapshot");
+    check(follower_store.count(1) == 0, "the second snapshot drops records the primary no longer has");
+
+    return failures == 0 ? 0 : 1;
+}